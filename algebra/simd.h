@@ -0,0 +1,130 @@
+//File: simd.h
+//Brief: SSE and NEON versions of the component-wise operations in vector.h for
+//       vectors of 4 floats.  cl_float3 is padded to 4 floats anyway, so float3
+//       and float4 both fit in 1 register.  vector<> uses these through
+//       simd::ops<>::enabled and falls back to the For<> templates for every
+//       other type and on CPUs that have neither instruction set.  The 4th
+//       component of a float3 is padding that might hold anything, so results
+//       for it are garbage, and dot() leaves it out.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef CL_SIMD_H
+#define CL_SIMD_H
+
+//OpenCL includes
+#include <CL/cl_platform.h>
+
+//SIMD includes
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define CL_VECTOR_SSE
+#elif defined(__ARM_NEON) && defined(__aarch64__) //32-bit ARM doesn't have vdivq_f32() or vaddvq_f32()
+  #include <arm_neon.h>
+  #define CL_VECTOR_NEON
+#endif
+
+namespace cl
+{
+  namespace simd
+  {
+    //Types without a specialization below use the For<> templates in vector.h
+    template <class TYPE, unsigned int SIZE, class BASE_TYPE>
+    struct ops
+    {
+      static constexpr bool enabled = false;
+    };
+
+    #if defined(CL_VECTOR_SSE) || defined(CL_VECTOR_NEON)
+    //cl_float3 is the same type as cl_float4, so this covers both sizes
+    template <unsigned int SIZE>
+    struct ops<float, SIZE, cl_float4>
+    {
+      static_assert(SIZE == 3 || SIZE == 4, "cl_float4 only backs vectors with 3 or 4 components.");
+      static constexpr bool enabled = true;
+
+      #if defined(CL_VECTOR_SSE)
+        using reg_t = __m128;
+        #if defined(__CL_FLOAT4__) //cl_platform.h gives cl_float4 an __m128 member, so it can stay in a register
+          static inline reg_t load(const cl_float4& vec) { return vec.v4; }
+          static inline cl_float4 store(const reg_t reg) { cl_float4 result; result.v4 = reg; return result; }
+        #else
+          static inline reg_t load(const cl_float4& vec) { return _mm_loadu_ps(vec.s); }
+          static inline cl_float4 store(const reg_t reg) { cl_float4 result; _mm_storeu_ps(result.s, reg); return result; }
+        #endif
+        static inline reg_t splat(const float scalar) { return _mm_set1_ps(scalar); }
+        static inline cl_float4 set(const float x, const float y, const float z, const float w) { return store(_mm_setr_ps(x, y, z, w)); }
+        static inline reg_t add(const reg_t lhs, const reg_t rhs) { return _mm_add_ps(lhs, rhs); }
+        static inline reg_t sub(const reg_t lhs, const reg_t rhs) { return _mm_sub_ps(lhs, rhs); }
+        static inline reg_t mul(const reg_t lhs, const reg_t rhs) { return _mm_mul_ps(lhs, rhs); }
+        static inline reg_t div(const reg_t lhs, const reg_t rhs) { return _mm_div_ps(lhs, rhs); }
+        static inline reg_t min(const reg_t lhs, const reg_t rhs) { return _mm_min_ps(lhs, rhs); }
+        static inline reg_t max(const reg_t lhs, const reg_t rhs) { return _mm_max_ps(lhs, rhs); }
+        static inline reg_t neg(const reg_t reg) { return _mm_xor_ps(reg, _mm_set1_ps(-0.f)); } //Keeps -0 like the For<> version
+
+        //Sum of the first SIZE components
+        static inline float sum(reg_t reg)
+        {
+          if(SIZE == 3) reg = _mm_and_ps(reg, _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)));
+          const reg_t pairs = _mm_add_ps(reg, _mm_movehl_ps(reg, reg)); //{x + z, y + w, ...}
+          return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 1, 1, 1))));
+        }
+
+        //{y, z, x, w}
+        static inline reg_t rotate(const reg_t reg) { return _mm_shuffle_ps(reg, reg, _MM_SHUFFLE(3, 0, 2, 1)); }
+      #else //CL_VECTOR_NEON
+        using reg_t = float32x4_t;
+        static inline reg_t load(const cl_float4& vec) { return vld1q_f32(vec.s); }
+        static inline cl_float4 store(const reg_t reg) { cl_float4 result; vst1q_f32(result.s, reg); return result; }
+        static inline reg_t splat(const float scalar) { return vdupq_n_f32(scalar); }
+        static inline cl_float4 set(const float x, const float y, const float z, const float w)
+        {
+          const float values[] = {x, y, z, w};
+          return store(vld1q_f32(values));
+        }
+        static inline reg_t add(const reg_t lhs, const reg_t rhs) { return vaddq_f32(lhs, rhs); }
+        static inline reg_t sub(const reg_t lhs, const reg_t rhs) { return vsubq_f32(lhs, rhs); }
+        static inline reg_t mul(const reg_t lhs, const reg_t rhs) { return vmulq_f32(lhs, rhs); }
+        static inline reg_t div(const reg_t lhs, const reg_t rhs) { return vdivq_f32(lhs, rhs); }
+        static inline reg_t min(const reg_t lhs, const reg_t rhs) { return vminq_f32(lhs, rhs); }
+        static inline reg_t max(const reg_t lhs, const reg_t rhs) { return vmaxq_f32(lhs, rhs); }
+        static inline reg_t neg(const reg_t reg) { return vnegq_f32(reg); }
+
+        static inline float sum(reg_t reg)
+        {
+          if(SIZE == 3) reg = vsetq_lane_f32(0.f, reg, 3);
+          return vaddvq_f32(reg);
+        }
+
+        //{y, z, x, w}
+        static inline reg_t rotate(const reg_t reg)
+        {
+          const reg_t yzwx = vextq_f32(reg, reg, 1);
+          return vsetq_lane_f32(vgetq_lane_f32(reg, 3), vsetq_lane_f32(vgetq_lane_f32(reg, 0), yzwx, 2), 3);
+        }
+      #endif
+
+      //Operations on cl_float4s that vector<> calls
+      static inline cl_float4 add(const cl_float4& lhs, const cl_float4& rhs) { return store(add(load(lhs), load(rhs))); }
+      static inline cl_float4 sub(const cl_float4& lhs, const cl_float4& rhs) { return store(sub(load(lhs), load(rhs))); }
+      static inline cl_float4 mul(const cl_float4& lhs, const cl_float4& rhs) { return store(mul(load(lhs), load(rhs))); }
+      static inline cl_float4 div(const cl_float4& lhs, const cl_float4& rhs) { return store(div(load(lhs), load(rhs))); }
+      static inline cl_float4 min(const cl_float4& lhs, const cl_float4& rhs) { return store(min(load(lhs), load(rhs))); }
+      static inline cl_float4 max(const cl_float4& lhs, const cl_float4& rhs) { return store(max(load(lhs), load(rhs))); }
+      static inline cl_float4 mul(const cl_float4& lhs, const float scalar) { return store(mul(load(lhs), splat(scalar))); }
+      static inline cl_float4 div(const cl_float4& lhs, const float scalar) { return store(div(load(lhs), splat(scalar))); }
+      static inline cl_float4 negate(const cl_float4& vec) { return store(neg(load(vec))); }
+      static inline float dot(const cl_float4& lhs, const cl_float4& rhs) { return sum(mul(load(lhs), load(rhs))); }
+
+      //lhs.yzx*rhs.zxy - lhs.zxy*rhs.yzx, but with 1 fewer shuffle: rotate the difference of
+      //lhs*rhs.yzx and lhs.yzx*rhs instead
+      static inline cl_float4 cross(const cl_float4& lhs, const cl_float4& rhs)
+      {
+        const reg_t left = load(lhs), right = load(rhs);
+        return store(rotate(sub(mul(left, rotate(right)), mul(rotate(left), right))));
+      }
+    };
+    #endif //CL_VECTOR_SSE || CL_VECTOR_NEON
+  }
+}
+
+#endif //CL_SIMD_H
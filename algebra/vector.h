@@ -9,12 +9,17 @@
 //OpenCL includes
 #include <CL/cl_platform.h>
 
+//algebra includes
+#include "algebra/simd.h"
+
 //c++ includes
 #include <initializer_list>
 #include <cmath> //std::sqrt
 #include <ostream>
 #include <vector>
 #include <cassert>
+#include <type_traits>
+#include <algorithm> //std::min() and std::max()
 
 namespace
 {
@@ -139,6 +144,40 @@ namespace
 
 namespace cl
 {
+  template <class TYPE, unsigned int SIZE, class BASE_TYPE>
+  union vector;
+
+  //OpenCL type with 2 components of TYPE.  Swizzles of 2 components produce these.
+  template <class TYPE> struct pairOf;
+  template <> struct pairOf<cl_float> { using type = cl_float2; };
+  template <> struct pairOf<cl_int> { using type = cl_int2; };
+  template <> struct pairOf<cl_uchar> { using type = cl_uchar2; };
+  template <> struct pairOf<cl_double> { using type = cl_double2; };
+
+  //2 components of a bigger vector<> like .xz in OpenCL C.  This only makes sense as a member of
+  //vector<>'s union where data is the same memory as the vector it's part of.  It's read-only: it
+  //converts to a 2-component vector<> for everything else.
+  template <class TYPE, class BASE_TYPE, int FIRST, int SECOND>
+  struct swizzle
+  {
+    using result_t = vector<TYPE, 2, typename pairOf<TYPE>::type>;
+    BASE_TYPE data;
+
+    operator result_t() const
+    {
+      return result_t{data.s[FIRST], data.s[SECOND]};
+    }
+
+    //Member operators don't convert their left-hand sides, so forward arithmetic to result_t
+    result_t operator +(const result_t& other) const { return result_t(*this) + other; }
+    result_t operator -(const result_t& other) const { return result_t(*this) - other; }
+    result_t operator *(const result_t& other) const { return result_t(*this) * other; }
+    result_t operator /(const result_t& other) const { return result_t(*this) / other; }
+    result_t operator *(const TYPE scalar) const { return result_t(*this) * scalar; }
+    result_t operator /(const TYPE scalar) const { return result_t(*this) / scalar; }
+    result_t operator -() const { return -result_t(*this); }
+  };
+
   //Core implementation of component-wise operations.  Defines vector
   //addition, subtraction, dot product, Hadderhad
   //product, and magnitude.  I will provide typedefs for specific
@@ -155,18 +194,35 @@ namespace cl
       BASE_TYPE data;
       struct { COMPONENT_TYPE x, y, z, w; };
 
+      //SIMD versions of the operations below when simd_t::enabled.  See simd.h.
+      using simd_t = simd::ops<TYPE, SIZE, BASE_TYPE>;
+
+      //Swizzles that serial/ code uses.  Add more here as the kernels need them.
+      swizzle<TYPE, BASE_TYPE, 0, 1> xy;
+      swizzle<TYPE, BASE_TYPE, 0, 2> xz;
+      swizzle<TYPE, BASE_TYPE, 1, 2> yz;
+
       //Default constructor is the 0 vector
       vector()
       {
         //TODO: unroll at compile time?
         for(unsigned long int pos = 0ul; pos < SIZE; ++pos) data.s[pos] = 0;
+        if constexpr(simd_t::enabled && SIZE < 4) data.s[3] = 0; //simd.h does math on the padding too
       }
 
       //constructor from initializer list
       vector(const std::initializer_list<TYPE> values)
       {
+        //Filling in a register all at once keeps the next SIMD load from waiting on SIZE separate
+        //stores.  simd.h does math on the padding in float3s too, so make sure it's not garbage
+        //that could be a slow denormal.
+        if constexpr(simd_t::enabled)
+        {
+          const TYPE* value = values.begin();
+          data = simd_t::set(value[0], value[1], value[2], (SIZE > 3)?value[3]:0);
+        }
         //TODO: unroll at compile time
-        for(unsigned long int pos = 0ul; pos < SIZE; ++pos) data.s[pos] = *(values.begin() + pos);
+        else for(unsigned long int pos = 0ul; pos < SIZE; ++pos) data.s[pos] = *(values.begin() + pos);
       }
 
       //Constructor from BASE_TYPE
@@ -180,8 +236,9 @@ namespace cl
       {
       }
 
-      //constructor from components
-      template <class ...ARGS>
+      //constructor from components.  Only for more than 1 component so that a single argument,
+      //like a swizzle, always converts instead of becoming the first component.
+      template <class ...ARGS, class = typename std::enable_if<(sizeof...(ARGS) > 1)>::type>
       vector(ARGS... args): vector({args...})
       {
       }
@@ -189,78 +246,92 @@ namespace cl
       //Unary negation
       vector<TYPE, SIZE, BASE_TYPE>operator -() const
       {
-        return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [](const auto& value) { return -value; });
+        if constexpr(simd_t::enabled) return simd_t::negate(data);
+        else return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [](const auto& value) { return -value; });
       }
 
       //Multiplication by a scalar
       vector<TYPE, SIZE, BASE_TYPE>operator *(const TYPE scalar) const
       {
-        return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [scalar](const auto& value) { return value * scalar; });
+        if constexpr(simd_t::enabled) return simd_t::mul(data, scalar);
+        else return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [scalar](const auto& value) { return value * scalar; });
       }
 
       vector<TYPE, SIZE, BASE_TYPE>operator /(const TYPE scalar) const
       {
-        return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [scalar](const auto& value) { return value / scalar; });
+        if constexpr(simd_t::enabled) return simd_t::div(data, scalar);
+        else return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [scalar](const auto& value) { return value / scalar; });
       }
 
       //Vector addition
       vector<TYPE, SIZE, BASE_TYPE>operator +(const vector<TYPE, SIZE, BASE_TYPE>& other) const
       {
-        return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs + rhs; });
+        if constexpr(simd_t::enabled) return simd_t::add(data, other.data);
+        else return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs + rhs; });
       }
 
       vector<TYPE, SIZE, BASE_TYPE>operator -(const vector<TYPE, SIZE, BASE_TYPE>& other) const
       {
-        return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs - rhs; });
+        if constexpr(simd_t::enabled) return simd_t::sub(data, other.data);
+        else return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs - rhs; });
       }
 
       //Hadderhad product: multiply each component of each vectortogether
       vector<TYPE, SIZE, BASE_TYPE>operator *(const vector<TYPE, SIZE, BASE_TYPE>& other) const
       {
-        return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs * rhs; });
+        if constexpr(simd_t::enabled) return simd_t::mul(data, other.data);
+        else return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs * rhs; });
       }
 
       //Component-wise division al a OpenCL C
       vector<TYPE, SIZE, BASE_TYPE>operator /(const vector<TYPE, SIZE, BASE_TYPE>& other) const
       {
-        return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs / rhs; });
+        if constexpr(simd_t::enabled) return simd_t::div(data, other.data);
+        else return ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs / rhs; });
       }
 
       //Perform operations that modify this vector in place
       vector<TYPE, SIZE, BASE_TYPE>& operator *=(const TYPE scalar)
       {
-        ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [scalar](auto& value) { value *= scalar; });
+        if constexpr(simd_t::enabled) data = simd_t::mul(data, scalar);
+        else ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [scalar](auto& value) { value *= scalar; });
         return *this;
       }
 
       vector<TYPE, SIZE, BASE_TYPE>& operator /=(const TYPE scalar)
       {
-        ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [scalar](auto& value) { value /= scalar; });
+        if constexpr(simd_t::enabled) data = simd_t::div(data, scalar);
+        else ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, [scalar](auto& value) { value /= scalar; });
         return *this;
       }
 
       vector<TYPE, SIZE, BASE_TYPE>& operator +=(const vector<TYPE, SIZE, BASE_TYPE>& other)
       {
-        ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](auto& lhs, const auto& rhs) { return lhs += rhs; });
+        if constexpr(simd_t::enabled) data = simd_t::add(data, other.data);
+        else ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](auto& lhs, const auto& rhs) { return lhs += rhs; });
         return *this;
       }
 
       vector<TYPE, SIZE, BASE_TYPE>& operator -=(const vector<TYPE, SIZE, BASE_TYPE>& other)
       {
-        ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](auto& lhs, const auto& rhs) { return lhs -= rhs; });
+        if constexpr(simd_t::enabled) data = simd_t::sub(data, other.data);
+        else ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](auto& lhs, const auto& rhs) { return lhs -= rhs; });
         return *this;
       }
 
       //Hadderhad product.  See const version above for explanation.
       vector<TYPE, SIZE, BASE_TYPE>& operator *=(const vector<TYPE, SIZE, BASE_TYPE>& other)
       {
-        ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { lhs *= rhs; });
+        if constexpr(simd_t::enabled) data = simd_t::mul(data, other.data);
+        else ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [](auto& lhs, const auto& rhs) { lhs *= rhs; });
         return *this;
       }
 
       //Dot product
       TYPE dot(const vector<TYPE, SIZE, BASE_TYPE>& other) const
       {
+        if constexpr(simd_t::enabled) return simd_t::dot(data, other.data);
+
         TYPE result = 0;
         ::For<BASE_TYPE, SIZE, SIZE-1>::each(data, other.data, [&result](const auto& lhs, const auto& rhs) { return (result += lhs * rhs); });
         return result;
@@ -270,6 +341,7 @@ namespace cl
       vector<TYPE, SIZE, BASE_TYPE> cross(const vector<TYPE, SIZE, BASE_TYPE>& rhs) const
       {
         static_assert(SIZE == 3, "The cross product is only defined for 3-vectors.");
+        if constexpr(simd_t::enabled) return simd_t::cross(data, rhs.data);
         return vector<TYPE, SIZE, BASE_TYPE>{data.y*rhs.data.z - data.z*rhs.data.y,
                                    data.z*rhs.data.x - data.x*rhs.data.z,
                                    data.x*rhs.data.y - data.y*rhs.data.x};
@@ -328,8 +400,9 @@ namespace cl
       {
       }
 
-      //constructor from components
-      template <class ...ARGS>
+      //constructor from components.  Only for more than 1 component so that a single argument,
+      //like a swizzle, always converts instead of becoming the first component.
+      template <class ...ARGS, class = typename std::enable_if<(sizeof...(ARGS) > 1)>::type>
       vector(ARGS... args): vector({args...})
       {
       }
@@ -368,6 +441,12 @@ namespace cl
         return ::For<BASE_TYPE, 2, 2-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs * rhs; });
       }
 
+      //Component-wise division al a OpenCL C
+      vector<TYPE, 2, BASE_TYPE>operator /(const vector<TYPE, 2, BASE_TYPE>& other) const
+      {
+        return ::For<BASE_TYPE, 2, 2-1>::each(data, other.data, [](const auto& lhs, const auto& rhs) { return lhs / rhs; });
+      }
+
       //Perform operations that modify this vector in place
       vector<TYPE, 2, BASE_TYPE>& operator *=(const TYPE scalar)
       {
@@ -452,6 +531,21 @@ namespace cl
     return os;
   }
 
+  //Component-wise minimum and maximum like min() and max() in OpenCL C
+  template <class TYPE, unsigned int SIZE, class BASE_TYPE>
+  vector<TYPE, SIZE, BASE_TYPE> min(const vector<TYPE, SIZE, BASE_TYPE>& lhs, const vector<TYPE, SIZE, BASE_TYPE>& rhs)
+  {
+    if constexpr(simd::ops<TYPE, SIZE, BASE_TYPE>::enabled) return simd::ops<TYPE, SIZE, BASE_TYPE>::min(lhs.data, rhs.data);
+    else return ::For<BASE_TYPE, SIZE, SIZE-1>::each(lhs.data, rhs.data, [](const auto& left, const auto& right) { return std::min(left, right); });
+  }
+
+  template <class TYPE, unsigned int SIZE, class BASE_TYPE>
+  vector<TYPE, SIZE, BASE_TYPE> max(const vector<TYPE, SIZE, BASE_TYPE>& lhs, const vector<TYPE, SIZE, BASE_TYPE>& rhs)
+  {
+    if constexpr(simd::ops<TYPE, SIZE, BASE_TYPE>::enabled) return simd::ops<TYPE, SIZE, BASE_TYPE>::max(lhs.data, rhs.data);
+    else return ::For<BASE_TYPE, SIZE, SIZE-1>::each(lhs.data, rhs.data, [](const auto& left, const auto& right) { return std::max(left, right); });
+  }
+
   #define CL_WRAPPER(TYPE, SIZE)\
     using TYPE##SIZE = vector<TYPE, SIZE, cl_##TYPE##SIZE>;\
     static_assert(sizeof(vector<TYPE, SIZE, cl_##TYPE##SIZE>) == sizeof(cl_##TYPE##SIZE), "vector<> is not aligned to match OpenCL!");
@@ -0,0 +1,194 @@
+//File: vectorBenchmark.cpp
+//Brief: Times the operations in vector.h that simd.h speeds up against the For<>
+//       templates that every vector<> used before.  scalarFloat4 has the same layout
+//       as cl_float4, but simd::ops<> has no specialization for it, so vector<>
+//       falls back to For<> for it.  Also checks that both versions agree before
+//       timing anything.  Takes the number of vectors to loop over as an optional
+//       argument.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//algebra includes
+#include "algebra/vector.h"
+
+//c++ includes
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <functional>
+#include <limits>
+#include <cmath>
+
+namespace
+{
+  //Same layout as cl_float4 without the SIMD specialization
+  union scalarFloat4
+  {
+    cl_float s[4];
+    struct { cl_float x, y, z, w; };
+  };
+
+  using scalar3 = cl::vector<float, 3, scalarFloat4>;
+  using scalar4 = cl::vector<float, 4, scalarFloat4>;
+
+  //Copy components from one kind of vector to another
+  template <class TO, class FROM>
+  TO convert(const FROM& from)
+  {
+    TO to;
+    for(int pos = 0; pos < 4; ++pos) to.data.s[pos] = from.data.s[pos];
+    return to;
+  }
+
+  //Run bench nRepeats times and report the fastest time per vector in ns.  sink
+  //keeps the compiler from throwing results away.
+  double time(const std::function<float()>& bench, const size_t nVectors, float& sink)
+  {
+    constexpr int nRepeats = 7;
+    double best = std::numeric_limits<double>::max();
+    for(int repeat = 0; repeat < nRepeats; ++repeat)
+    {
+      const auto start = std::chrono::steady_clock::now();
+      sink += bench();
+      const auto stop = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double, std::nano>(stop - start).count()/nVectors);
+    }
+    return best;
+  }
+
+  //The same loops for SIMD and For<> vectors.  Each returns a float that depends on every result.
+  template <class VEC, int SIZE>
+  struct benchmarks
+  {
+    const std::vector<VEC>& lhs;
+    const std::vector<VEC>& rhs;
+
+    float add() const
+    {
+      VEC sum;
+      for(size_t which = 0; which < lhs.size(); ++which) sum += lhs[which] + rhs[which];
+      return sum.x + sum.y + sum.z;
+    }
+
+    float mul() const
+    {
+      VEC sum;
+      for(size_t which = 0; which < lhs.size(); ++which) sum += lhs[which] * rhs[which] * 0.5f;
+      return sum.x + sum.y + sum.z;
+    }
+
+    float dot() const
+    {
+      float sum = 0;
+      for(size_t which = 0; which < lhs.size(); ++which) sum += lhs[which].dot(rhs[which]);
+      return sum;
+    }
+
+    float cross() const
+    {
+      if constexpr(SIZE != 3) return 0; //Only defined for 3-vectors
+      else
+      {
+        VEC sum;
+        for(size_t which = 0; which < lhs.size(); ++which) sum += lhs[which].cross(rhs[which]);
+        return sum.x + sum.y + sum.z;
+      }
+    }
+
+    float minMax() const
+    {
+      VEC low = lhs.front(), high = lhs.front();
+      for(size_t which = 0; which < lhs.size(); ++which)
+      {
+        low = cl::min(low, rhs[which]);
+        high = cl::max(high, rhs[which]);
+      }
+      return low.x + high.y + low.z;
+    }
+
+    float norm() const
+    {
+      VEC sum;
+      for(size_t which = 0; which < lhs.size(); ++which) sum += lhs[which].norm();
+      return sum.x + sum.y + sum.z;
+    }
+
+    //What Geometry::calcGridLimits() does with box corners
+    float corners() const
+    {
+      VEC low = lhs.front(), high = lhs.front();
+      for(size_t which = 0; which < lhs.size(); ++which)
+      {
+        const VEC& center = lhs[which];
+        const VEC half = rhs[which]*0.5f;
+        for(const auto& corner: {center + half, center - half, center + VEC{half.x, -half.y, half.z, half.w}, center - VEC{half.x, -half.y, half.z, half.w}})
+        {
+          low = cl::min(low, corner);
+          high = cl::max(high, corner);
+        }
+      }
+      return low.x + high.y + low.z;
+    }
+  };
+
+  template <class SIMD, class SCALAR, int SIZE>
+  void run(const std::string& name, const size_t nVectors, std::mt19937& gen)
+  {
+    std::uniform_real_distribution<float> dist(-100.f, 100.f);
+    std::vector<SIMD> lhs(nVectors), rhs(nVectors);
+    for(size_t which = 0; which < nVectors; ++which)
+    {
+      lhs[which] = SIMD{dist(gen), dist(gen), dist(gen), dist(gen)};
+      rhs[which] = SIMD{dist(gen), dist(gen), dist(gen), dist(gen)};
+    }
+
+    std::vector<SCALAR> scalarLhs, scalarRhs;
+    for(const auto& vec: lhs) scalarLhs.push_back(convert<SCALAR>(vec));
+    for(const auto& vec: rhs) scalarRhs.push_back(convert<SCALAR>(vec));
+
+    const benchmarks<SIMD, SIZE> simd{lhs, rhs};
+    const benchmarks<SCALAR, SIZE> scalar{scalarLhs, scalarRhs};
+
+    std::vector<std::pair<std::string, std::pair<std::function<float()>, std::function<float()>>>> tests = {
+      {"add",     {[&simd] { return simd.add(); },     [&scalar] { return scalar.add(); }}},
+      {"mul",     {[&simd] { return simd.mul(); },     [&scalar] { return scalar.mul(); }}},
+      {"dot",     {[&simd] { return simd.dot(); },     [&scalar] { return scalar.dot(); }}},
+      {"min/max", {[&simd] { return simd.minMax(); },  [&scalar] { return scalar.minMax(); }}},
+      {"norm",    {[&simd] { return simd.norm(); },    [&scalar] { return scalar.norm(); }}},
+      {"corners", {[&simd] { return simd.corners(); }, [&scalar] { return scalar.corners(); }}}
+    };
+    if(SIZE == 3) tests.push_back({"cross", {[&simd] { return simd.cross(); }, [&scalar] { return scalar.cross(); }}});
+
+    std::cout << name << " (" << (SIMD::simd_t::enabled ? "SIMD" : "no SIMD on this machine") << "):\n"
+              << std::setw(10) << "operation" << std::setw(14) << "For<> [ns]" << std::setw(14) << "simd.h [ns]" << std::setw(10) << "speedup" << "\n";
+    float sink = 0;
+    for(const auto& test: tests)
+    {
+      //The SIMD versions add in a different order, so allow some rounding error
+      const float simdResult = test.second.first(), scalarResult = test.second.second();
+      if(std::fabs(simdResult - scalarResult) > 1e-3f * std::max(1.f, std::fabs(scalarResult)))
+      {
+        std::cerr << "simd.h and For<> disagree about " << test.first << " for " << name << ": " << simdResult << " != " << scalarResult << "\n";
+      }
+
+      const double scalarTime = time(test.second.second, nVectors, sink),
+                   simdTime = time(test.second.first, nVectors, sink);
+      std::cout << std::setw(10) << test.first << std::setw(14) << std::setprecision(3) << scalarTime << std::setw(14) << simdTime
+                << std::setw(9) << scalarTime/simdTime << "x\n";
+    }
+    std::cout << "(ignore this: " << sink << ")\n\n";
+  }
+}
+
+int main(const int argc, const char** argv)
+{
+  const size_t nVectors = (argc > 1) ? std::stoul(argv[1]) : 1 << 16;
+  std::mt19937 gen(42);
+
+  run<cl::float3, scalar3, 3>("float3", nVectors, gen);
+  run<cl::float4, scalar4, 4>("float4", nVectors, gen);
+
+  return 0;
+}
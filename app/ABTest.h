@@ -0,0 +1,52 @@
+//File: ABTest.h
+//Brief: An ABTest alternates between 2 variants of the path tracing kernel
+//       from one frame to the next and keeps the average kernel time of each.
+//       Both variants see the same scene, camera, and GPU clocks, so the
+//       comparison is fair even while I'm flying around.  Each variant adds
+//       its own build options to the engine's.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_ABTEST_H
+#define APP_ABTEST_H
+
+//c++ includes
+#include <string>
+#include <array>
+
+namespace app
+{
+  struct ABTest
+  {
+    bool enabled = false;
+    std::array<std::string, 2> options; //Extra build options for A and B
+    std::string error; //Why the last test stopped.  Empty if it didn't fail.
+
+    int side = 0; //Which variant renders this frame
+    std::array<double, 2> totalTime = {0., 0.}; //in ms
+    std::array<int, 2> nFrames = {0, 0};
+
+    //Options to add to the engine's for this frame
+    inline const std::string& current() const { return options[side]; }
+
+    //Record how long this frame's kernel took in ms and switch to the other variant
+    inline void record(const float kernelTime)
+    {
+      totalTime[side] += kernelTime;
+      ++nFrames[side];
+      side = 1 - side;
+    }
+
+    //Average kernel time of a variant in ms
+    inline float average(const int which) const { return (nFrames[which] > 0)?totalTime[which]/nFrames[which]:0.f; }
+
+    //Start over, like when either variant's options change
+    inline void reset()
+    {
+      side = 0;
+      totalTime = {0., 0.};
+      nFrames = {0, 0};
+    }
+  };
+}
+
+#endif //APP_ABTEST_H
@@ -0,0 +1,88 @@
+//File: BoxPicker.cpp
+//Brief: A BoxPicker finds boxes that the user points at on the GPU.  The only data that comes
+//       back to the host is 1 pixel for a single box or the list of boxes in a rectangle.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//app includes
+#include "app/BoxPicker.h"
+
+//c++ includes
+#include <algorithm>
+
+namespace app
+{
+  BoxPicker::BoxPicker(cl::Context& ctx): fContext(ctx)
+  {
+  }
+
+  void BoxPicker::render(cl::CommandQueue& queue, const cl::Program& program, Geometry& geom, const bool shortIndices,
+                         const camera& cam, const int width, const int height)
+  {
+    if(width != fWidth || height != fHeight)
+    {
+      fIDs = cl::Image2D(fContext, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_SIGNED_INT32), width, height);
+      fWidth = width;
+      fHeight = height;
+    }
+
+    cl::make_kernel<cl::Image2D, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, grid, cl::Buffer, sphere, cl_float2, camera>
+      pickBoxes(cl::Kernel(program, "pickBoxes"));
+    pickBoxes(cl::EnqueueArgs(queue, cl::NDRange(fWidth, fHeight)), fIDs, geom.boxes(), geom.bounds(),
+              shortIndices?geom.gridIndices16():geom.gridIndices(), geom.gridCells(), geom.gridSize(), geom.materials(),
+              geom.sky(), geom.groundTexNorm().data, cam);
+  }
+
+  int BoxPicker::at(cl::CommandQueue& queue, const Geometry& geom, const cl::int2 pixel) const
+  {
+    if(fWidth == 0 || fHeight == 0) return -1;
+
+    const cl::int2 inImage = toImage(pixel);
+    cl::size_t<3> origin, region;
+    origin[0] = inImage.x;
+    origin[1] = inImage.y;
+    region[0] = region[1] = region[2] = 1;
+
+    cl_int deviceBox = -1;
+    queue.enqueueReadImage(fIDs, CL_TRUE, origin, region, 0, 0, &deviceBox);
+    return (deviceBox < 0)?-1:geom.deviceToHost(deviceBox);
+  }
+
+  std::vector<int> BoxPicker::inRectangle(cl::CommandQueue& queue, const cl::Program& program, const Geometry& geom,
+                                          const cl::int2 corner, const cl::int2 otherCorner)
+  {
+    std::vector<int> found;
+    if(fWidth == 0 || fHeight == 0 || geom.nBoxes() == 0) return found;
+
+    if(geom.nBoxes() > fMaxBoxes)
+    {
+      fMaxBoxes = geom.nBoxes();
+      fSeen = cl::Buffer(fContext, CL_MEM_READ_WRITE, fMaxBoxes * sizeof(cl_uint));
+      fFound = cl::Buffer(fContext, CL_MEM_READ_WRITE, fMaxBoxes * sizeof(cl_int));
+      fNFound = cl::Buffer(fContext, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    }
+
+    const cl::int2 first = toImage(corner), last = toImage(otherCorner);
+    const cl_int4 rect = {{std::min(first.x, last.x), std::min(first.y, last.y), std::max(first.x, last.x) + 1, std::max(first.y, last.y) + 1}};
+
+    const cl_uint zero = 0;
+    queue.enqueueFillBuffer(fSeen, zero, 0, geom.nBoxes() * sizeof(cl_uint));
+    queue.enqueueWriteBuffer(fNFound, CL_FALSE, 0, sizeof(cl_uint), &zero);
+
+    cl::make_kernel<cl::Image2D, cl_int4, cl::Buffer, cl::Buffer, cl::Buffer> visibleBoxes(cl::Kernel(program, "visibleBoxes"));
+    visibleBoxes(cl::EnqueueArgs(queue, cl::NDRange(rect.s[2] - rect.s[0], rect.s[3] - rect.s[1])), fIDs, rect, fSeen, fFound, fNFound);
+
+    //Only read back as many boxes as the rectangle found
+    cl_uint nFound = 0;
+    queue.enqueueReadBuffer(fNFound, CL_TRUE, 0, sizeof(cl_uint), &nFound);
+    found.resize(nFound);
+    if(nFound > 0) queue.enqueueReadBuffer(fFound, CL_TRUE, 0, nFound * sizeof(cl_int), found.data());
+
+    for(auto& box: found) box = geom.deviceToHost(box);
+    return found;
+  }
+
+  cl::int2 BoxPicker::toImage(const cl::int2 pixel) const
+  {
+    return cl::int2{std::clamp(pixel.x, 0, fWidth - 1), std::clamp(fHeight - 1 - pixel.y, 0, fHeight - 1)};
+  }
+}
@@ -0,0 +1,60 @@
+//File: BoxPicker.h
+//Brief: A BoxPicker finds boxes that the user points at on the GPU instead of casting rays on
+//       the host.  The pickBoxes kernel in skyline.cl renders which box each pixel sees into
+//       an integer image.  Picking 1 box reads back 1 pixel, and a rectangle of pixels is
+//       reduced on the GPU to the list of boxes that it sees.  render() has to run again
+//       whenever the camera or the boxes change before the other functions give the right
+//       answers.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_BOXPICKER_H
+#define APP_BOXPICKER_H
+
+//OpenCL c++ API includes
+#include <CL/cl.hpp>
+
+//app includes
+#include "app/Geometry.h"
+
+//c++ includes
+#include <vector>
+
+namespace app
+{
+  class BoxPicker
+  {
+    public:
+      BoxPicker(cl::Context& ctx);
+
+      //Render which box each pixel sees with the pickBoxes kernel from program.  program should
+      //be the same variant that pathTrace comes from so that it agrees with geom about box indices.
+      //Use geom's 16-bit box indices if shortIndices.
+      void render(cl::CommandQueue& queue, const cl::Program& program, Geometry& geom, const bool shortIndices,
+                  const camera& cam, const int width, const int height);
+
+      //Index in geom of the box at pixel, or -1 for the sky and the ground.  pixel is in GLFW's
+      //convention with y going down the window.
+      int at(cl::CommandQueue& queue, const Geometry& geom, const cl::int2 pixel) const;
+
+      //Every box that can be seen in the rectangle between 2 corners in GLFW's convention.  Indices
+      //are in geom.  Boxes that are completely hidden behind other boxes aren't in the list.
+      std::vector<int> inRectangle(cl::CommandQueue& queue, const cl::Program& program, const Geometry& geom,
+                                   const cl::int2 corner, const cl::int2 otherCorner);
+
+    private:
+      cl::Context& fContext;
+      cl::Image2D fIDs; //Index on the device of the box that each pixel sees.  Same y convention as pathTrace's pixels.
+      int fWidth = 0, fHeight = 0; //Size of fIDs
+
+      //Results of the visibleBoxes reduction.  Big enough for every box on the device.
+      cl::Buffer fSeen;
+      cl::Buffer fFound;
+      cl::Buffer fNFound;
+      size_t fMaxBoxes = 0;
+
+      //Convert a pixel from GLFW's convention to fIDs' convention and clamp it to the image
+      cl::int2 toImage(const cl::int2 pixel) const;
+  };
+}
+
+#endif //APP_BOXPICKER_H
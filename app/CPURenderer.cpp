@@ -0,0 +1,961 @@
+//File: CPURenderer.cpp
+//Brief: A CPURenderer path traces a Geometry on the host with the same serial/ functions
+//       that the pathTrace kernel uses.  Every thread renders tiles from its own queue and
+//       steals tiles from the other threads' queues when it runs out.  Box tests in each
+//       grid cell run 8 boxes at a time with AVX2 or 4 at a time with SSE.  Packets of rays
+//       from neighboring pixels walk the grid together and test 1 box against 8 or 4 rays
+//       at a time instead.
+//
+//       The kernel-only parts of kernels/skyline.cl are ported here function by function.
+//       Keep them in sync when the kernel changes, or the comparison in skyline-render
+//       --compare stops meaning anything.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//app includes
+#include "app/CPURenderer.h"
+
+//serial includes.  Geometry.cpp already compiles the other serial/ functions.
+#include "serial/groundPlane.h"
+#include "serial/camera.cpp"
+
+//SIMD includes
+#if defined(__AVX2__) || defined(__SSE2__)
+  #include <immintrin.h>
+#endif
+
+//c++ includes
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <limits>
+
+namespace
+{
+  //Must match kernels/skyline.cl
+  constexpr int skyDiffuseSize = 32; //SKY_DIFFUSE_SIZE
+
+  //Color of textures that couldn't be loaded, like TextureStreamer's placeholder.  Not reflective at all.
+  const cl::float4 placeholderColor{0.5f, 0.5f, 0.5f, 0.f};
+
+  //Tiles that one thread renders.  Its owner takes tiles from the front, and other threads
+  //steal from the back so that they don't fight over the same end.
+  struct tileQueue
+  {
+    std::mutex mutex;
+    std::deque<int> tiles;
+  };
+
+  bool takeTile(tileQueue& queue, const bool fromFront, int& tile)
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.tiles.empty()) return false;
+    if(fromFront)
+    {
+      tile = queue.tiles.front();
+      queue.tiles.pop_front();
+    }
+    else
+    {
+      tile = queue.tiles.back();
+      queue.tiles.pop_back();
+    }
+    return true;
+  }
+
+  //1 channel of an 8-bit RGBA texel in [0, 1] like read_imagef() returns for CL_UNORM_INT8
+  float texel(const unsigned char* texels, const int width, const int col, const int row, const int channel)
+  {
+    return texels[4*(col + row*width) + channel]/255.f;
+  }
+
+  //CLK_FILTER_LINEAR with CLK_ADDRESS_REPEAT and normalized coordinates
+  cl::float4 sampleRepeat(const unsigned char* texels, const int width, const int height, const float s, const float t)
+  {
+    const float u = (s - std::floor(s))*width - 0.5f, v = (t - std::floor(t))*height - 0.5f;
+    const float colFloor = std::floor(u), rowFloor = std::floor(v);
+    const float a = u - colFloor, b = v - rowFloor;
+    const int col0 = ((int)colFloor + width) % width, col1 = (col0 + 1) % width,
+              row0 = ((int)rowFloor + height) % height, row1 = (row0 + 1) % height;
+
+    cl::float4 result;
+    for(int channel = 0; channel < 4; ++channel)
+    {
+      result.data.s[channel] = (1.f - a)*(1.f - b)*texel(texels, width, col0, row0, channel) + a*(1.f - b)*texel(texels, width, col1, row0, channel)
+                               + (1.f - a)*b*texel(texels, width, col0, row1, channel) + a*b*texel(texels, width, col1, row1, channel);
+    }
+    return result;
+  }
+
+  //The same SIMD operations for packets of 8 rays with AVX2 and packets of 4 with SSE2.  Masks
+  //are registers with every bit of a lane set or every bit clear like the compare instructions
+  //make.
+  #if defined(__AVX2__)
+    #define PACKET_LANES
+    struct lanes
+    {
+      static constexpr int width = 8;
+      using reals = __m256;
+
+      static inline reals splat(const float value) { return _mm256_set1_ps(value); }
+      static inline reals splatInt(const int value) { return _mm256_castsi256_ps(_mm256_set1_epi32(value)); }
+      static inline reals load(const float* values) { return _mm256_loadu_ps(values); }
+      static inline void store(float* values, const reals reg) { _mm256_storeu_ps(values, reg); }
+      static inline void storeInts(int* values, const reals reg) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(values), _mm256_castps_si256(reg)); }
+      static inline reals sub(const reals lhs, const reals rhs) { return _mm256_sub_ps(lhs, rhs); }
+      static inline reals mul(const reals lhs, const reals rhs) { return _mm256_mul_ps(lhs, rhs); }
+      static inline reals min(const reals lhs, const reals rhs) { return _mm256_min_ps(lhs, rhs); }
+      static inline reals max(const reals lhs, const reals rhs) { return _mm256_max_ps(lhs, rhs); }
+      static inline reals greater(const reals lhs, const reals rhs) { return _mm256_cmp_ps(lhs, rhs, _CMP_GT_OQ); }
+      static inline reals greaterEqual(const reals lhs, const reals rhs) { return _mm256_cmp_ps(lhs, rhs, _CMP_GE_OQ); }
+      static inline reals less(const reals lhs, const reals rhs) { return _mm256_cmp_ps(lhs, rhs, _CMP_LT_OQ); }
+      static inline reals both(const reals lhs, const reals rhs) { return _mm256_and_ps(lhs, rhs); }
+      static inline reals select(const reals mask, const reals ifTrue, const reals ifFalse) { return _mm256_blendv_ps(ifFalse, ifTrue, mask); }
+
+      //Mask with lane i set where bit i of bits is set
+      static inline reals fromBits(const int bits)
+      {
+        const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), bit), bit));
+      }
+      static inline int toBits(const reals mask) { return _mm256_movemask_ps(mask); }
+    };
+  #elif defined(__SSE2__)
+    #define PACKET_LANES
+    struct lanes
+    {
+      static constexpr int width = 4;
+      using reals = __m128;
+
+      static inline reals splat(const float value) { return _mm_set1_ps(value); }
+      static inline reals splatInt(const int value) { return _mm_castsi128_ps(_mm_set1_epi32(value)); }
+      static inline reals load(const float* values) { return _mm_loadu_ps(values); }
+      static inline void store(float* values, const reals reg) { _mm_storeu_ps(values, reg); }
+      static inline void storeInts(int* values, const reals reg) { _mm_storeu_si128(reinterpret_cast<__m128i*>(values), _mm_castps_si128(reg)); }
+      static inline reals sub(const reals lhs, const reals rhs) { return _mm_sub_ps(lhs, rhs); }
+      static inline reals mul(const reals lhs, const reals rhs) { return _mm_mul_ps(lhs, rhs); }
+      static inline reals min(const reals lhs, const reals rhs) { return _mm_min_ps(lhs, rhs); }
+      static inline reals max(const reals lhs, const reals rhs) { return _mm_max_ps(lhs, rhs); }
+      static inline reals greater(const reals lhs, const reals rhs) { return _mm_cmpgt_ps(lhs, rhs); }
+      static inline reals greaterEqual(const reals lhs, const reals rhs) { return _mm_cmpge_ps(lhs, rhs); }
+      static inline reals less(const reals lhs, const reals rhs) { return _mm_cmplt_ps(lhs, rhs); }
+      static inline reals both(const reals lhs, const reals rhs) { return _mm_and_ps(lhs, rhs); }
+      static inline reals select(const reals mask, const reals ifTrue, const reals ifFalse)
+      {
+        return _mm_or_ps(_mm_and_ps(mask, ifTrue), _mm_andnot_ps(mask, ifFalse));
+      }
+
+      static inline reals fromBits(const int bits)
+      {
+        const __m128i bit = _mm_setr_epi32(1, 2, 4, 8);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits), bit), bit));
+      }
+      static inline int toBits(const reals mask) { return _mm_movemask_ps(mask); }
+    };
+  #endif
+
+  #if defined(PACKET_LANES)
+    //Origins and 1/directions of every ray in a packet.  Lanes without a ray copy another lane
+    //so that they don't make NaNs, but they're always masked off.
+    struct packetRays
+    {
+      lanes::reals posX, posY, posZ;
+      lanes::reals invX, invY, invZ;
+    };
+
+    //Same slab test as aabbBounds_intersect() against 1 box at a time for every ray in rays.
+    //Only tests lanes whose bit is set in laneBits.  Each lane's limit is the distance a hit
+    //has to beat.  Lanes that found a box get its index in boxIds and its distance in limits.
+    //Returns the lanes that found a box.
+    int packetNearestBox(const packetRays& rays, const aabbBounds* bounds, const int* boxes, const int nBoxes, const int laneBits,
+                         float* limits, int* boxIds)
+    {
+      const lanes::reals zero = lanes::splat(0.f), active = lanes::fromBits(laneBits);
+      lanes::reals laneBest = lanes::load(limits), laneBox = lanes::splatInt(-1);
+
+      for(int which = 0; which < nBoxes; ++which)
+      {
+        const aabbBounds& box = bounds[boxes[which]];
+        const lanes::reals tx0 = lanes::mul(lanes::sub(lanes::splat(box.min.x), rays.posX), rays.invX),
+                           tx1 = lanes::mul(lanes::sub(lanes::splat(box.max.x), rays.posX), rays.invX),
+                           ty0 = lanes::mul(lanes::sub(lanes::splat(box.min.y), rays.posY), rays.invY),
+                           ty1 = lanes::mul(lanes::sub(lanes::splat(box.max.y), rays.posY), rays.invY),
+                           tz0 = lanes::mul(lanes::sub(lanes::splat(box.min.z), rays.posZ), rays.invZ),
+                           tz1 = lanes::mul(lanes::sub(lanes::splat(box.max.z), rays.posZ), rays.invZ);
+        const lanes::reals tmin = lanes::max(lanes::max(lanes::min(tx0, tx1), lanes::min(ty0, ty1)), lanes::min(tz0, tz1)),
+                           tmax = lanes::min(lanes::min(lanes::max(tx0, tx1), lanes::max(ty0, ty1)), lanes::max(tz0, tz1));
+
+        //(tmin > 0)?tmin:tmax when a ray starts inside the box
+        const lanes::reals dist = lanes::select(lanes::greater(tmin, zero), tmin, tmax);
+        const lanes::reals hit = lanes::both(lanes::both(active, lanes::greaterEqual(tmax, lanes::max(tmin, zero))),
+                                             lanes::both(lanes::greater(dist, zero), lanes::less(dist, laneBest)));
+        laneBest = lanes::select(hit, dist, laneBest);
+        laneBox = lanes::select(hit, lanes::splatInt(boxes[which]), laneBox);
+      }
+
+      lanes::store(limits, laneBest);
+      lanes::storeInts(boxIds, laneBox);
+      int found = 0;
+      for(int lane = 0; lane < lanes::width; ++lane) found |= (boxIds[lane] >= 0) << lane;
+      return found;
+    }
+  #endif
+
+  //Pixels that 1 packet covers.  Square-ish blocks keep a packet's rays close together.
+  void packetFootprint(const int packetSize, int& width, int& height)
+  {
+    width = (packetSize >= 8)?4:((packetSize >= 2)?2:1);
+    height = packetSize/width;
+  }
+
+  int countBits(const int bits)
+  {
+    return __builtin_popcount(bits);
+  }
+}
+
+namespace app
+{
+  CPURenderer::CPURenderer(Geometry& geom, const int nThreads): fNThreads((nThreads > 0)?nThreads:std::max(1u, std::thread::hardware_concurrency())),
+                                                               fStats{0, 0, 0, 0}, fBoxes(geom.hostBoxes()), fMaterials(geom.hostMaterials()),
+                                                               fGridSize(geom.gridSize()), fGridCells(geom.hostGridCells()),
+                                                               fGridIndices(geom.hostGridIndices()), fSky(geom.sky()), fSun(geom.sun()),
+                                                               fSunEmission(geom.sunEmission()), fGroundTexNorm(geom.groundTexNorm()),
+                                                               fSkyMap(geom.hostSkyMap()), fSkyMapSize(geom.skyMapSize()),
+                                                               fTextures(geom.textures().nTextures()), fTextureWidth(geom.textures().width()),
+                                                               fTextureHeight(geom.textures().height())
+  {
+    fBounds.resize(fBoxes.size());
+    std::transform(fBoxes.begin(), fBoxes.end(), fBounds.begin(), aabb_bounds);
+    for(int axis = 0; axis < 3; ++axis)
+    {
+      fMin[axis].resize(fBounds.size());
+      fMax[axis].resize(fBounds.size());
+      for(size_t whichBox = 0; whichBox < fBounds.size(); ++whichBox)
+      {
+        fMin[axis][whichBox] = fBounds[whichBox].min.data.s[axis];
+        fMax[axis][whichBox] = fBounds[whichBox].max.data.s[axis];
+      }
+    }
+
+    //The GPU only decodes textures that rays actually hit.  A reference render can afford all of them.
+    std::atomic<int> nextTexture(0);
+    std::vector<std::thread> decoders;
+    for(int thread = 0; thread < fNThreads; ++thread)
+    {
+      decoders.emplace_back([this, &geom, &nextTexture]()
+                            {
+                              for(int id = nextTexture++; id < (int)fTextures.size(); id = nextTexture++)
+                              {
+                                auto decoded = geom.textures().decode(id);
+                                fTextures[id].full = std::move(decoded.full);
+                                fTextures[id].coarse = std::move(decoded.coarse);
+                              }
+                            });
+    }
+    for(auto& decoder: decoders) decoder.join();
+  }
+
+  std::vector<float> CPURenderer::render(const camera& cam, const settings& config)
+  {
+    std::vector<float> pixels(config.width * config.height * 4, 0.f);
+    const int tilesX = (config.width + config.tileSize - 1)/config.tileSize,
+              nTiles = tilesX * ((config.height + config.tileSize - 1)/config.tileSize);
+
+    //Each thread starts with a contiguous block of tiles so that its tiles share grid cells in cache
+    std::vector<tileQueue> queues(fNThreads);
+    for(int thread = 0; thread < fNThreads; ++thread)
+    {
+      for(int tile = thread*nTiles/fNThreads; tile < (thread + 1)*nTiles/fNThreads; ++tile) queues[thread].tiles.push_back(tile);
+    }
+
+    std::vector<traversalStats> threadStats(fNThreads, traversalStats{0, 0, 0, 0});
+    std::vector<std::thread> workers;
+    for(int thread = 0; thread < fNThreads; ++thread)
+    {
+      workers.emplace_back([this, thread, &queues, &cam, &config, &pixels, &threadStats]()
+                           {
+                             //Counters in the same cache line would bounce between cores, so add them up at the end
+                             traversalStats myStats = {0, 0, 0, 0};
+                             int tile = -1;
+                             while(true)
+                             {
+                               bool found = takeTile(queues[thread], true, tile);
+
+                               //Out of my own tiles.  Steal from the next thread that has any left.
+                               for(int victim = 1; victim < fNThreads && !found; ++victim)
+                               {
+                                 found = takeTile(queues[(thread + victim) % fNThreads], false, tile);
+                               }
+                               if(!found) break; //Nobody adds tiles, so everything is done or being rendered
+
+                               renderTile(cam, config, tile, pixels, myStats);
+                             }
+                             threadStats[thread] = myStats;
+                           });
+    }
+    for(auto& worker: workers) worker.join();
+
+    fStats = traversalStats{0, 0, 0, 0};
+    for(const auto& stats: threadStats)
+    {
+      fStats.nRays += stats.nRays;
+      fStats.nBoxTests += stats.nBoxTests;
+      fStats.nMailboxHits += stats.nMailboxHits;
+    }
+
+    return pixels;
+  }
+
+  int CPURenderer::packetSize() const
+  {
+    #if defined(PACKET_LANES)
+      return lanes::width;
+    #else
+      return 1;
+    #endif
+  }
+
+  void CPURenderer::renderTile(const camera& cam, const settings& config, const int whichTile, std::vector<float>& pixels, traversalStats& stats) const
+  {
+    const int tilesX = (config.width + config.tileSize - 1)/config.tileSize,
+              firstX = (whichTile % tilesX)*config.tileSize, firstY = (whichTile / tilesX)*config.tileSize,
+              endX = std::min(firstX + config.tileSize, config.width), endY = std::min(firstY + config.tileSize, config.height);
+    const cl::int2 cameraCell = positionToCell(fGridSize, cam.position);
+    const bool cameraInGrid = (cameraCell.x >= 0 && cameraCell.y >= 0 && cameraCell.x < fGridSize.max.x && cameraCell.y < fGridSize.max.y);
+
+    int blockWidth = 1, blockHeight = 1;
+    ::packetFootprint(config.packets?packetSize():1, blockWidth, blockHeight);
+
+    //Every pixel in a block of the tile follows its own path, but their rays walk the grid together
+    for(int blockY = firstY; blockY < endY; blockY += blockHeight)
+    {
+      for(int blockX = firstX; blockX < endX; blockX += blockWidth)
+      {
+        cl::int2 pixelPos[maxPacketSize];
+        size_t seeds[maxPacketSize];
+        cl::float3 pixelColors[maxPacketSize];
+        int nPixels = 0;
+        for(int y = blockY; y < std::min(blockY + blockHeight, endY); ++y)
+        {
+          for(int x = blockX; x < std::min(blockX + blockWidth, endX); ++x)
+          {
+            pixelPos[nPixels] = cl::int2{x, y};
+            seeds[nPixels] = x * config.height + y + 1; //Same seed that skyline-render starts this pixel with on the GPU
+            pixelColors[nPixels] = cl::float3{0.f, 0.f, 0.f};
+            ++nPixels;
+          }
+        }
+
+        //The kernel tonemaps the sum of each frame's samples, so do the same thing frame by frame
+        for(int frame = 0; frame < config.nFrames; ++frame)
+        {
+          cl::float3 lightColors[maxPacketSize];
+          for(int pixel = 0; pixel < nPixels; ++pixel) lightColors[pixel] = cl::float3{0.f, 0.f, 0.f};
+
+          for(int sample = 0; sample < config.samplesPerFrame; ++sample)
+          {
+            ray localRays[maxPacketSize];
+            cl::float3 maskColors[maxPacketSize], normals[maxPacketSize], texCoords[maxPacketSize];
+            cl::int2 cells[maxPacketSize];
+            bool wantFull[maxPacketSize];
+            int active[maxPacketSize];
+            for(int pixel = 0; pixel < nPixels; ++pixel)
+            {
+              maskColors[pixel] = cl::float3{1.f, 1.f, 1.f};
+              localRays[pixel] = generateRay(cam, pixelPos[pixel], config.width, config.height, &seeds[pixel]);
+              cells[pixel] = entryCell(localRays[pixel], cameraCell, cameraInGrid);
+              wantFull[pixel] = true;
+              active[pixel] = pixel;
+            }
+
+            intersectPacket(localRays, normals, cells, texCoords, active, nPixels, stats);
+            int nActive = nPixels;
+            for(int bounce = 1; bounce < config.nBounces; ++bounce)
+            {
+              //Paths that hit the sky are done
+              nActive = std::remove_if(active, active + nActive, [&texCoords](const int pixel) { return texCoords[pixel].z == SKY_TEXTURE; }) - active;
+              if(nActive == 0) break;
+
+              for(int which = 0; which < nActive; ++which)
+              {
+                const int pixel = active[which];
+                wantFull[pixel] &= scatterAndShade(localRays[pixel], maskColors[pixel], seeds[pixel], normals[pixel], texCoords[pixel],
+                                                   wantFull[pixel], config.gamma);
+              }
+              intersectPacket(localRays, normals, cells, texCoords, active, nActive, stats);
+            }
+
+            for(int pixel = 0; pixel < nPixels; ++pixel)
+            {
+              if(texCoords[pixel].z == SKY_TEXTURE) lightColors[pixel] += sampleSky(localRays[pixel], maskColors[pixel], wantFull[pixel]);
+            }
+          }
+
+          //Reinhard tonemapping
+          for(int pixel = 0; pixel < nPixels; ++pixel)
+          {
+            pixelColors[pixel] += lightColors[pixel] / (lightColors[pixel] + cl::float3{1.f, 1.f, 1.f}) / (float)config.samplesPerFrame;
+          }
+        }
+
+        for(int which = 0; which < nPixels; ++which)
+        {
+          float* pixel = pixels.data() + 4*(pixelPos[which].x + pixelPos[which].y*config.width);
+          for(int channel = 0; channel < 3; ++channel) pixel[channel] = std::pow(pixelColors[which].data.s[channel]/config.nFrames, 1.f/config.gamma);
+          pixel[3] = 1.f;
+        }
+      }
+    }
+  }
+
+  cl::int2 CPURenderer::entryCell(const ray& thisRay, const cl::int2 cameraCell, const bool cameraInGrid) const
+  {
+    if(cameraInGrid) return cameraCell;
+
+    const float distToGrid = grid_intersect(fGridSize, thisRay);
+    if(distToGrid > 0) return positionToCell(fGridSize, thisRay.position + thisRay.direction * (distToGrid + 0.001f));
+    return cameraCell;
+  }
+
+  cl::float3 CPURenderer::intersect(ray& thisRay, cl::float3& normal, cl::int2& whichGridCell, traversalStats& stats) const
+  {
+    closestHit closest = startHit(thisRay);
+    walkGrid(thisRay, whichGridCell, closest, stats);
+    return finishHit(thisRay, closest, normal);
+  }
+
+  void CPURenderer::intersectPacket(ray* rays, cl::float3* normals, cl::int2* cells, cl::float3* texCoords, const int* which, const int count,
+                                    traversalStats& stats) const
+  {
+    if(count == 1)
+    {
+      texCoords[which[0]] = intersect(rays[which[0]], normals[which[0]], cells[which[0]], stats);
+      return;
+    }
+
+    closestHit closest[maxPacketSize];
+    for(int lane = 0; lane < count; ++lane) closest[which[lane]] = startHit(rays[which[lane]]);
+    walkGridPacket(rays, cells, closest, which, count, stats);
+    for(int lane = 0; lane < count; ++lane) texCoords[which[lane]] = finishHit(rays[which[lane]], closest[which[lane]], normals[which[lane]]);
+  }
+
+  CPURenderer::closestHit CPURenderer::startHit(const ray& thisRay) const
+  {
+    closestHit closest = {FLT_MAX, -1, false};
+    const float skyDist = sphere_intersect(fSky, thisRay);
+    if(skyDist > 0) closest.dist = skyDist;
+
+    const float groundDist = groundPlane_intersect(thisRay);
+    if(groundDist > 0 && groundDist < closest.dist)
+    {
+      closest.dist = groundDist;
+      closest.ground = true;
+    }
+
+    return closest;
+  }
+
+  cl::float3 CPURenderer::finishHit(ray& thisRay, const closestHit& closest, cl::float3& normal) const
+  {
+    cl::float3 texCoords{0.f, 0.f, (float)SKY_TEXTURE};
+    normal = -thisRay.direction;
+
+    const cl::float3 hitPos = thisRay.position + thisRay.direction*closest.dist;
+    if(closest.box >= 0)
+    {
+      const aabb& box = fBoxes[closest.box];
+      const int face = aabb_entry_face(&box, thisRay);
+      normal = aabb_face_normal(face);
+      texCoords = aabb_face_tex_coords(&box, hitPos, face, fMaterials[box.material].textures.data.s[face]);
+    }
+    else if(closest.ground)
+    {
+      texCoords = groundPlane_tex_coords(fGroundTexNorm, hitPos);
+      normal = groundPlane_normal(hitPos);
+    }
+
+    thisRay.position = hitPos;
+    normal = (dot(normal, thisRay.direction) < 0)?normal:-normal;
+    thisRay.position += normal*0.0003f; //sqrt(FLT_EPSILON)
+
+    return texCoords;
+  }
+
+  void CPURenderer::walkGrid(const ray& thisRay, cl::int2& whichGridCell, closestHit& closest, traversalStats& stats) const
+  {
+    const cl::float3 invDir{1.f/thisRay.direction.x, 1.f/thisRay.direction.y, 1.f/thisRay.direction.z};
+    ++stats.nRays;
+
+    nearestBox(fGridIndices.data() + fGridSize.largeBoxes.x, fGridSize.largeBoxes.y - fGridSize.largeBoxes.x, thisRay, invDir,
+               closest.dist, closest.dist, closest.box, stats);
+    walkCells(thisRay, invDir, whichGridCell, distToCellEdge(fGridSize, thisRay, whichGridCell), distBetweenCells(fGridSize, thisRay), closest, stats);
+  }
+
+  void CPURenderer::walkCells(const ray& thisRay, const cl::float3 invDir, cl::int2& whichGridCell, cl::float2 distToNext,
+                              const cl::float2 betweenCells, closestHit& closest, traversalStats& stats) const
+  {
+    //No mailbox here.  Testing a shared box again costs less than searching the mailbox once
+    //8 boxes are tested at a time.
+    while(whichGridCell.x < fGridSize.max.x && whichGridCell.y < fGridSize.max.y && whichGridCell.x >= 0 && whichGridCell.y >= 0)
+    {
+      const float nextCellDist = std::min(distToNext.x, distToNext.y);
+      const gridCell cell = fGridCells[grid_cellIndex(fGridSize, whichGridCell)];
+      if(gridCell_isInline(cell))
+      {
+        const int inlineBoxes[2] = {gridCell_volume(cell, nullptr, 0), (gridCell_count(cell) > 1)?gridCell_volume(cell, nullptr, 1):-1};
+        nearestBox(inlineBoxes, gridCell_count(cell), thisRay, invDir, std::min(closest.dist, nextCellDist), closest.dist, closest.box, stats);
+      }
+      else nearestBox(fGridIndices.data() + cell.first, gridCell_count(cell), thisRay, invDir, std::min(closest.dist, nextCellDist),
+                      closest.dist, closest.box, stats);
+
+      if(closest.dist <= nextCellDist) break;
+
+      //Step along every axis whose next cell edge is the closest one like step() does in the kernel
+      if(distToNext.x <= nextCellDist)
+      {
+        whichGridCell.x += (thisRay.direction.x < 0.f)?-1:1;
+        distToNext.x += betweenCells.x;
+      }
+      if(distToNext.y <= nextCellDist)
+      {
+        whichGridCell.y += (thisRay.direction.z < 0.f)?-1:1;
+        distToNext.y += betweenCells.y;
+      }
+    }
+  }
+
+  void CPURenderer::walkGridPacket(const ray* rays, cl::int2* cells, closestHit* closest, const int* which, const int count,
+                                   traversalStats& stats) const
+  {
+    #if defined(PACKET_LANES)
+      //Rays that step through the grid in different directions split up right away.  Diffuse bounces
+      //usually do.  Don't pay for a packet that would only ever have 1 ray in a cell.
+      const bool leftward = (rays[which[0]].direction.x < 0.f), backward = (rays[which[0]].direction.z < 0.f);
+      for(int lane = 1; lane < count; ++lane)
+      {
+        if((rays[which[lane]].direction.x < 0.f) != leftward || (rays[which[lane]].direction.z < 0.f) != backward)
+        {
+          for(int single = 0; single < count; ++single) walkGrid(rays[which[single]], cells[which[single]], closest[which[single]], stats);
+          return;
+        }
+      }
+
+      const auto inGrid = [this](const cl::int2 cell) { return cell.x < fGridSize.max.x && cell.y < fGridSize.max.y && cell.x >= 0 && cell.y >= 0; };
+
+      //Rays in structure of arrays layout.  Lanes past count copy the last ray.
+      float posX[lanes::width], posY[lanes::width], posZ[lanes::width], invX[lanes::width], invY[lanes::width], invZ[lanes::width];
+      cl::float3 invDirs[lanes::width];
+      cl::float2 distToNext[lanes::width], betweenCells[lanes::width];
+      for(int lane = 0; lane < lanes::width; ++lane)
+      {
+        const ray& thisRay = rays[which[std::min(lane, count - 1)]];
+        invDirs[lane] = cl::float3{1.f/thisRay.direction.x, 1.f/thisRay.direction.y, 1.f/thisRay.direction.z};
+        posX[lane] = thisRay.position.x;
+        posY[lane] = thisRay.position.y;
+        posZ[lane] = thisRay.position.z;
+        invX[lane] = invDirs[lane].x;
+        invY[lane] = invDirs[lane].y;
+        invZ[lane] = invDirs[lane].z;
+        if(lane < count)
+        {
+          distToNext[lane] = distToCellEdge(fGridSize, thisRay, cells[which[lane]]);
+          betweenCells[lane] = distBetweenCells(fGridSize, thisRay);
+        }
+      }
+      const packetRays packet{lanes::load(posX), lanes::load(posY), lanes::load(posZ), lanes::load(invX), lanes::load(invY), lanes::load(invZ)};
+      stats.nRays += count;
+
+      //Test laneBits' rays against boxes and keep whatever is closer than each lane's limit
+      float limits[lanes::width];
+      int boxIds[lanes::width];
+      const auto testBoxes = [this, &packet, &limits, &boxIds, closest, which, &stats](const int* boxes, const int nBoxes, const int laneBits)
+                             {
+                               stats.nBoxTests += nBoxes * countBits(laneBits);
+                               const int found = ::packetNearestBox(packet, fBounds.data(), boxes, nBoxes, laneBits, limits, boxIds);
+                               for(int lane = 0; lane < lanes::width; ++lane)
+                               {
+                                 if(found & (1 << lane))
+                                 {
+                                   closest[which[lane]].dist = limits[lane];
+                                   closest[which[lane]].box = boxIds[lane];
+                                 }
+                               }
+                             };
+
+      const int allLanes = (1 << count) - 1;
+      for(int lane = 0; lane < lanes::width; ++lane) limits[lane] = (lane < count)?closest[which[lane]].dist:0.f;
+      testBoxes(fGridIndices.data() + fGridSize.largeBoxes.x, fGridSize.largeBoxes.y - fGridSize.largeBoxes.x, allLanes);
+
+      int active = 0;
+      for(int lane = 0; lane < count; ++lane) active |= inGrid(cells[which[lane]]) << lane;
+
+      while(active)
+      {
+        //Find the cell with the most rays in it
+        int group = 0;
+        for(int unsorted = active; unsorted;)
+        {
+          const int first = __builtin_ctz(unsorted);
+          int sameCell = 0;
+          for(int lane = first; lane < count; ++lane)
+          {
+            if((unsorted & (1 << lane)) && cells[which[lane]].x == cells[which[first]].x && cells[which[lane]].y == cells[which[first]].y) sameCell |= 1 << lane;
+          }
+          if(countBits(sameCell) > countBits(group)) group = sameCell;
+          unsorted &= ~sameCell;
+        }
+
+        //Every ray is in a different cell, so a packet would only test 1 ray at a time.  Finish them
+        //1 at a time.
+        if(countBits(group) < 2)
+        {
+          for(int lane = 0; lane < count; ++lane)
+          {
+            if(active & (1 << lane)) walkCells(rays[which[lane]], invDirs[lane], cells[which[lane]], distToNext[lane], betweenCells[lane], closest[which[lane]], stats);
+          }
+          break;
+        }
+
+        float nextCellDist[lanes::width];
+        for(int lane = 0; lane < lanes::width; ++lane)
+        {
+          nextCellDist[lane] = (group & (1 << lane))?std::min(distToNext[lane].x, distToNext[lane].y):0.f;
+          limits[lane] = (group & (1 << lane))?std::min(closest[which[lane]].dist, nextCellDist[lane]):0.f;
+        }
+
+        const gridCell cell = fGridCells[grid_cellIndex(fGridSize, cells[which[__builtin_ctz(group)]])];
+        if(gridCell_isInline(cell))
+        {
+          const int inlineBoxes[2] = {gridCell_volume(cell, nullptr, 0), (gridCell_count(cell) > 1)?gridCell_volume(cell, nullptr, 1):-1};
+          testBoxes(inlineBoxes, gridCell_count(cell), group);
+        }
+        else testBoxes(fGridIndices.data() + cell.first, gridCell_count(cell), group);
+
+        //Step each ray in this cell like walkCells()
+        for(int lane = 0; lane < count; ++lane)
+        {
+          if(!(group & (1 << lane))) continue;
+
+          const ray& thisRay = rays[which[lane]];
+          cl::int2& whichGridCell = cells[which[lane]];
+          if(closest[which[lane]].dist <= nextCellDist[lane])
+          {
+            active &= ~(1 << lane);
+            continue;
+          }
+
+          if(distToNext[lane].x <= nextCellDist[lane])
+          {
+            whichGridCell.x += (thisRay.direction.x < 0.f)?-1:1;
+            distToNext[lane].x += betweenCells[lane].x;
+          }
+          if(distToNext[lane].y <= nextCellDist[lane])
+          {
+            whichGridCell.y += (thisRay.direction.z < 0.f)?-1:1;
+            distToNext[lane].y += betweenCells[lane].y;
+          }
+          if(!inGrid(whichGridCell)) active &= ~(1 << lane);
+        }
+      }
+    #else
+      for(int lane = 0; lane < count; ++lane) walkGrid(rays[which[lane]], cells[which[lane]], closest[which[lane]], stats);
+    #endif
+  }
+
+  CPURenderer::rayRates CPURenderer::benchmark(const camera& cam, const settings& config) const
+  {
+    const int nLanes = packetSize();
+    const cl::int2 cameraCell = positionToCell(fGridSize, cam.position);
+    const bool cameraInGrid = (cameraCell.x >= 0 && cameraCell.y >= 0 && cameraCell.x < fGridSize.max.x && cameraCell.y < fGridSize.max.y);
+
+    //Primary rays in the same blocks of pixels that renderTile() puts in a packet
+    int blockWidth = 1, blockHeight = 1;
+    ::packetFootprint(nLanes, blockWidth, blockHeight);
+    std::vector<ray> primaries;
+    std::vector<cl::int2> primaryCells;
+    size_t seed = 1;
+    for(int blockY = 0; blockY < config.height; blockY += blockHeight)
+    {
+      for(int blockX = 0; blockX < config.width; blockX += blockWidth)
+      {
+        for(int y = blockY; y < std::min(blockY + blockHeight, config.height); ++y)
+        {
+          for(int x = blockX; x < std::min(blockX + blockWidth, config.width); ++x)
+          {
+            primaries.push_back(generateRay(cam, cl::int2{x, y}, config.width, config.height, &seed));
+            primaryCells.push_back(entryCell(primaries.back(), cameraCell, cameraInGrid));
+          }
+        }
+      }
+    }
+
+    //Walk the grid with every ray and return how long it took in s.  Keeps the fastest of a few tries.
+    const auto time = [this, nLanes](const std::vector<ray>& rays, const std::vector<cl::int2>& startCells, const bool packets,
+                                     std::vector<closestHit>& hits, std::vector<cl::int2>& endCells)
+                      {
+                        constexpr int nTries = 3;
+                        traversalStats stats = {0, 0, 0, 0};
+                        int which[maxPacketSize];
+                        for(int lane = 0; lane < maxPacketSize; ++lane) which[lane] = lane;
+
+                        double best = std::numeric_limits<double>::max();
+                        for(int attempt = 0; attempt < nTries; ++attempt)
+                        {
+                          hits.resize(rays.size());
+                          endCells = startCells;
+                          const auto start = std::chrono::steady_clock::now();
+                          for(size_t first = 0; first < rays.size(); first += nLanes)
+                          {
+                            const int count = std::min<size_t>(nLanes, rays.size() - first);
+                            for(int lane = 0; lane < count; ++lane) hits[first + lane] = startHit(rays[first + lane]);
+                            if(packets && count > 1) walkGridPacket(rays.data() + first, endCells.data() + first, hits.data() + first, which, count, stats);
+                            else for(int lane = 0; lane < count; ++lane) walkGrid(rays[first + lane], endCells[first + lane], hits[first + lane], stats);
+                          }
+                          best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                        }
+                        return best;
+                      };
+
+    rayRates rates = {0., 0., 0., 0., 0};
+    const auto countMismatches = [](const std::vector<closestHit>& lhs, const std::vector<closestHit>& rhs)
+                                 {
+                                   int mismatches = 0;
+                                   for(size_t whichRay = 0; whichRay < lhs.size(); ++whichRay) mismatches += (lhs[whichRay].box != rhs[whichRay].box);
+                                   return mismatches;
+                                 };
+
+    std::vector<closestHit> singleHits, packetHits;
+    std::vector<cl::int2> singleCells, packetCells;
+    rates.primarySingle = primaries.size() / time(primaries, primaryCells, false, singleHits, singleCells) * 1.e-6;
+    rates.primaryPacket = primaries.size() / time(primaries, primaryCells, true, packetHits, packetCells) * 1.e-6;
+    rates.mismatches = countMismatches(singleHits, packetHits);
+
+    //Bounce every primary ray that hit something in a cosine-weighted random direction like a diffuse surface.
+    //Neighbors still start close together, but they go in unrelated directions.
+    std::vector<ray> diffuse;
+    std::vector<cl::int2> diffuseCells;
+    for(size_t whichRay = 0; whichRay < primaries.size(); ++whichRay)
+    {
+      if(singleHits[whichRay].box < 0 && !singleHits[whichRay].ground) continue;
+
+      ray bounced = primaries[whichRay];
+      cl::float3 normal;
+      finishHit(bounced, singleHits[whichRay], normal);
+
+      const float theta = random(&seed), phi = 2.f*M_PI*random(&seed);
+      const cl::float3 localXAxis = normalize((std::fabs(normal.x) > 0.1f)?cl::float3{normal.z, 0.f, -normal.x}
+                                                                          :cl::float3{0.f, -normal.z, normal.y});
+      const cl::float3 localYAxis = normal.cross(localXAxis);
+      bounced.direction = localXAxis*theta*std::cos(phi) + localYAxis*theta*std::sin(phi) + normal*std::sqrt(1.f-theta*theta);
+
+      diffuse.push_back(bounced);
+      diffuseCells.push_back(singleCells[whichRay]);
+    }
+
+    if(!diffuse.empty())
+    {
+      rates.diffuseSingle = diffuse.size() / time(diffuse, diffuseCells, false, singleHits, singleCells) * 1.e-6;
+      rates.diffusePacket = diffuse.size() / time(diffuse, diffuseCells, true, packetHits, packetCells) * 1.e-6;
+      rates.mismatches += countMismatches(singleHits, packetHits);
+    }
+
+    return rates;
+  }
+
+  void CPURenderer::nearestBox(const int* boxes, const int count, const ray& thisRay, const cl::float3 invDir, const float limit,
+                               float& closestDist, int& closestBox, traversalStats& stats) const
+  {
+    stats.nBoxTests += count;
+    float best = limit;
+    int bestBox = -1, which = 0;
+
+    //Same slab test as aabbBounds_intersect() on a whole SIMD register of boxes at once.  Each lane
+    //keeps the closest box it's seen, and the lanes are compared at the end.
+    #if defined(__AVX2__)
+      if(count >= 8)
+      {
+        const __m256 posX = _mm256_set1_ps(thisRay.position.x), posY = _mm256_set1_ps(thisRay.position.y), posZ = _mm256_set1_ps(thisRay.position.z),
+                     invX = _mm256_set1_ps(invDir.x), invY = _mm256_set1_ps(invDir.y), invZ = _mm256_set1_ps(invDir.z),
+                     zero = _mm256_setzero_ps();
+        __m256 laneBest = _mm256_set1_ps(limit);
+        __m256i laneBox = _mm256_set1_epi32(-1);
+
+        for(; which + 8 <= count; which += 8)
+        {
+          const __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(boxes + which));
+          const __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_i32gather_ps(fMin[0].data(), ids, 4), posX), invX),
+                       tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_i32gather_ps(fMax[0].data(), ids, 4), posX), invX),
+                       ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_i32gather_ps(fMin[1].data(), ids, 4), posY), invY),
+                       ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_i32gather_ps(fMax[1].data(), ids, 4), posY), invY),
+                       tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_i32gather_ps(fMin[2].data(), ids, 4), posZ), invZ),
+                       tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_i32gather_ps(fMax[2].data(), ids, 4), posZ), invZ);
+          const __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)), _mm256_min_ps(tz0, tz1)),
+                       tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_max_ps(tz0, tz1));
+
+          //(tmin > 0)?tmin:tmax when the ray starts inside a box
+          const __m256 dist = _mm256_blendv_ps(tmax, tmin, _mm256_cmp_ps(tmin, zero, _CMP_GT_OQ));
+          const __m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(tmax, _mm256_max_ps(tmin, zero), _CMP_GE_OQ),
+                                                         _mm256_cmp_ps(dist, zero, _CMP_GT_OQ)),
+                                           _mm256_cmp_ps(dist, laneBest, _CMP_LT_OQ));
+          laneBest = _mm256_blendv_ps(laneBest, dist, hit);
+          laneBox = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(laneBox), _mm256_castsi256_ps(ids), hit));
+        }
+
+        alignas(32) float dists[8];
+        alignas(32) int ids[8];
+        _mm256_store_ps(dists, laneBest);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(ids), laneBox);
+        for(int lane = 0; lane < 8; ++lane)
+        {
+          if(ids[lane] >= 0 && dists[lane] < best)
+          {
+            best = dists[lane];
+            bestBox = ids[lane];
+          }
+        }
+      }
+    #elif defined(__SSE2__)
+      if(count >= 4)
+      {
+        const __m128 posX = _mm_set1_ps(thisRay.position.x), posY = _mm_set1_ps(thisRay.position.y), posZ = _mm_set1_ps(thisRay.position.z),
+                     invX = _mm_set1_ps(invDir.x), invY = _mm_set1_ps(invDir.y), invZ = _mm_set1_ps(invDir.z),
+                     zero = _mm_setzero_ps();
+        __m128 laneBest = _mm_set1_ps(limit);
+        __m128i laneBox = _mm_set1_epi32(-1);
+
+        //SSE2 has no gather or blend.  Load each box by hand and blend with masks.
+        const auto gather = [boxes](const std::vector<float>& array, const int first)
+                            {
+                              return _mm_setr_ps(array[boxes[first]], array[boxes[first + 1]], array[boxes[first + 2]], array[boxes[first + 3]]);
+                            };
+        const auto select = [](const __m128 mask, const __m128 ifTrue, const __m128 ifFalse)
+                            {
+                              return _mm_or_ps(_mm_and_ps(mask, ifTrue), _mm_andnot_ps(mask, ifFalse));
+                            };
+
+        for(; which + 4 <= count; which += 4)
+        {
+          const __m128i ids = _mm_loadu_si128(reinterpret_cast<const __m128i*>(boxes + which));
+          const __m128 tx0 = _mm_mul_ps(_mm_sub_ps(gather(fMin[0], which), posX), invX),
+                       tx1 = _mm_mul_ps(_mm_sub_ps(gather(fMax[0], which), posX), invX),
+                       ty0 = _mm_mul_ps(_mm_sub_ps(gather(fMin[1], which), posY), invY),
+                       ty1 = _mm_mul_ps(_mm_sub_ps(gather(fMax[1], which), posY), invY),
+                       tz0 = _mm_mul_ps(_mm_sub_ps(gather(fMin[2], which), posZ), invZ),
+                       tz1 = _mm_mul_ps(_mm_sub_ps(gather(fMax[2], which), posZ), invZ);
+          const __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_min_ps(tz0, tz1)),
+                       tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_max_ps(tz0, tz1));
+
+          const __m128 dist = select(_mm_cmpgt_ps(tmin, zero), tmin, tmax);
+          const __m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(tmax, _mm_max_ps(tmin, zero)), _mm_cmpgt_ps(dist, zero)),
+                                        _mm_cmplt_ps(dist, laneBest));
+          laneBest = select(hit, dist, laneBest);
+          laneBox = _mm_castps_si128(select(hit, _mm_castsi128_ps(ids), _mm_castsi128_ps(laneBox)));
+        }
+
+        alignas(16) float dists[4];
+        alignas(16) int ids[4];
+        _mm_store_ps(dists, laneBest);
+        _mm_store_si128(reinterpret_cast<__m128i*>(ids), laneBox);
+        for(int lane = 0; lane < 4; ++lane)
+        {
+          if(ids[lane] >= 0 && dists[lane] < best)
+          {
+            best = dists[lane];
+            bestBox = ids[lane];
+          }
+        }
+      }
+    #endif
+
+    //Whatever didn't fill a whole register
+    for(; which < count; ++which)
+    {
+      const float dist = aabbBounds_intersect(fBounds[boxes[which]], thisRay.position, invDir);
+      if(dist > 0 && dist < best)
+      {
+        best = dist;
+        bestBox = boxes[which];
+      }
+    }
+
+    if(bestBox >= 0)
+    {
+      closestDist = best;
+      closestBox = bestBox;
+    }
+  }
+
+  bool CPURenderer::scatterAndShade(ray& thisRay, cl::float3& maskColor, size_t& seed, const cl::float3 normal, const cl::float3 texCoords,
+                                    const bool wantFull, const float gamma) const
+  {
+    const float theta = random(&seed), phi = 2.f*M_PI*random(&seed);
+
+    const cl::float3 localXAxis = normalize((std::fabs(normal.x) > 0.1f)?cl::float3{normal.z, 0.f, -normal.x}
+                                                                        :cl::float3{0.f, -normal.z, normal.y});
+    const cl::float3 localYAxis = normal.cross(localXAxis);
+
+    const cl::float4 texColor = sampleTexture(texCoords, wantFull);
+    const cl::float3 color{std::pow(texColor.x, gamma), std::pow(texColor.y, gamma), std::pow(texColor.z, gamma)};
+
+    const bool isSpecular = (random(&seed) < texColor.w);
+
+    const cl::float3 randomDir = localXAxis*theta*std::cos(phi) + localYAxis*theta*std::sin(phi) + normal*std::sqrt(1.f-theta*theta),
+                     reflectDir = thisRay.direction - normal*2.f*dot(thisRay.direction, normal);
+    thisRay.direction = isSpecular?reflectDir:randomDir;
+
+    maskColor = maskColor * color * dot(thisRay.direction, normal);
+
+    return isSpecular;
+  }
+
+  cl::float3 CPURenderer::sampleSky(const ray& thisRay, const cl::float3 maskColor, const bool wantFull) const
+  {
+    int diffuseLevel = 0;
+    while((fSkyMapSize >> diffuseLevel) > skyDiffuseSize) ++diffuseLevel;
+
+    //Mip levels are packed to the right of the full-size map.  Don't filter in texels from the next level.
+    const int size = fSkyMapSize >> (wantFull?0:diffuseLevel);
+    const cl::float2 encoded = octahedral_encode(thisRay.direction);
+    const float texelX = std::min(std::max(encoded.x * size, 0.5f), size - 0.5f),
+                texelY = std::min(std::max(encoded.y * size, 0.5f), size - 0.5f);
+    cl::float4 skyColor = sampleSkyMap((float)(2*fSkyMapSize - 2*size) + texelX, texelY);
+
+    cl::float3 light{skyColor.x, skyColor.y, skyColor.z};
+    if(sphere_intersect(fSun, thisRay) > 0) light = light + (fSunEmission - light)*skyColor.w; //mix()
+    return maskColor * light;
+  }
+
+  cl::float4 CPURenderer::sampleTexture(const cl::float3 texCoords, const bool wantFull) const
+  {
+    const int id = (int)texCoords.z;
+    if(id < 0 || id >= (int)fTextures.size() || fTextures[id].full.empty()) return placeholderColor;
+
+    if(wantFull) return ::sampleRepeat(fTextures[id].full.data(), fTextureWidth, fTextureHeight, texCoords.x, texCoords.y);
+    return ::sampleRepeat(fTextures[id].coarse.data(), fTextureWidth/TextureStreamer::coarseFactor, fTextureHeight/TextureStreamer::coarseFactor,
+                          texCoords.x, texCoords.y);
+  }
+
+  //CLK_FILTER_LINEAR with CLK_ADDRESS_CLAMP_TO_EDGE and coordinates in texels
+  cl::float4 CPURenderer::sampleSkyMap(const float x, const float y) const
+  {
+    const int width = 2*fSkyMapSize, height = fSkyMapSize;
+    const float u = x - 0.5f, v = y - 0.5f;
+    const float colFloor = std::floor(u), rowFloor = std::floor(v);
+    const float a = u - colFloor, b = v - rowFloor;
+    const auto clampCol = [width](const int col) { return std::min(std::max(col, 0), width - 1); };
+    const auto clampRow = [height](const int row) { return std::min(std::max(row, 0), height - 1); };
+    const int col0 = clampCol((int)colFloor), col1 = clampCol((int)colFloor + 1), row0 = clampRow((int)rowFloor), row1 = clampRow((int)rowFloor + 1);
+
+    cl::float4 result;
+    for(int channel = 0; channel < 4; ++channel)
+    {
+      const auto at = [this, width, channel](const int col, const int row) { return fSkyMap[4*(col + row*width) + channel]; };
+      result.data.s[channel] = (1.f - a)*(1.f - b)*at(col0, row0) + a*(1.f - b)*at(col1, row0) + (1.f - a)*b*at(col0, row1) + a*b*at(col1, row1);
+    }
+    return result;
+  }
+}
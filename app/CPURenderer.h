@@ -0,0 +1,172 @@
+//File: CPURenderer.h
+//Brief: A CPURenderer path traces a Geometry on the host with the same serial/ functions
+//       that the pathTrace kernel uses.  Every thread renders tiles from its own queue and
+//       steals tiles from the other threads' queues when it runs out, so a thread that
+//       drew the alleys doesn't leave the rest of the cores idle.  Box tests in each grid
+//       cell run 8 boxes at a time with AVX2 or 4 at a time with SSE.  Neighboring pixels'
+//       rays can also walk the grid together as a packet that tests each box against 8
+//       rays with AVX2 or 4 rays with SSE.  It's a fallback for machines without a usable
+//       OpenCL device and a reference to check GPU output against.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_CPURENDERER_H
+#define APP_CPURENDERER_H
+
+//app includes
+#include "app/Geometry.h"
+
+//serial includes
+#include "serial/camera.h"
+
+//c++ includes
+#include <vector>
+
+namespace app
+{
+  class CPURenderer
+  {
+    public:
+      //Settings that the pathTrace kernel gets from its build options and arguments
+      struct settings
+      {
+        int width = 800;
+        int height = 600;
+        int nBounces = 4;
+        int nFrames = 64; //Number of times skyline-render would launch the kernel
+        int samplesPerFrame = 1;
+        float gamma = 2.2f;
+        int tileSize = 16; //Pixels on each side of a tile
+        bool packets = true; //Trace packetSize() neighboring pixels together
+      };
+
+      //Rays per second that walk the grid with 1 thread.  See benchmark().
+      struct rayRates
+      {
+        double primarySingle; //Mrays/s
+        double primaryPacket;
+        double diffuseSingle;
+        double diffusePacket;
+        int mismatches; //Rays whose closest box depends on whether they were traced in a packet
+      };
+
+      //Most rays that any packet holds
+      static constexpr int maxPacketSize = 8;
+
+      //Copies everything it needs from geom, so geom can change while this renders.  Call
+      //geom.prepare() or geom.sendToGPU() first.  Decodes every texture before returning.
+      //nThreads = 0 uses every core.
+      explicit CPURenderer(Geometry& geom, const int nThreads = 0);
+
+      //Render the scene from cam.  Returns RGBA pixels with the bottom row first, gamma corrected
+      //like the kernel writes them.
+      std::vector<float> render(const camera& cam, const settings& config);
+
+      //Traversal work from the last call to render()
+      inline const traversalStats& stats() const { return fStats; }
+
+      inline int nThreads() const { return fNThreads; }
+
+      //Rays that walk the grid together on this machine: 8 with AVX2, 4 with SSE2, and
+      //1 without either.
+      int packetSize() const;
+
+      //Time how fast packets and single rays walk the grid with 1 thread.  Primary rays come
+      //from cam at config.width x config.height, and diffuse rays bounce off of whatever
+      //they hit in random directions.  Neither does any shading.
+      rayRates benchmark(const camera& cam, const settings& config) const;
+
+    private:
+      int fNThreads;
+      traversalStats fStats;
+
+      //Scene in the host's order
+      std::vector<aabb> fBoxes;
+      std::vector<material> fMaterials;
+      grid fGridSize;
+      std::vector<gridCell> fGridCells;
+      std::vector<int> fGridIndices;
+      sphere fSky;
+      sphere fSun;
+      cl::float3 fSunEmission;
+      cl::float2 fGroundTexNorm;
+
+      //Box corners for box tests.  fBounds is for 1 box at a time, and the structure of arrays
+      //below is for loading many boxes into SIMD registers at once.
+      std::vector<aabbBounds> fBounds;
+      std::vector<float> fMin[3];
+      std::vector<float> fMax[3];
+
+      //Same layout as Geometry::hostSkyMap()
+      std::vector<float> fSkyMap;
+      int fSkyMapSize;
+
+      //Every texture decoded once up front.  Empty if it couldn't be loaded.
+      struct texture
+      {
+        std::vector<unsigned char> full;
+        std::vector<unsigned char> coarse;
+      };
+      std::vector<texture> fTextures;
+      int fTextureWidth;
+      int fTextureHeight;
+
+      //Closest thing a ray has hit so far
+      struct closestHit
+      {
+        float dist;
+        int box; //-1 for no box
+        bool ground;
+      };
+
+      //Render 1 tile of pixels into pixels
+      void renderTile(const camera& cam, const settings& config, const int whichTile, std::vector<float>& pixels, traversalStats& stats) const;
+
+      //Grid cell where a ray from the camera starts walking the grid
+      cl::int2 entryCell(const ray& thisRay, const cl::int2 cameraCell, const bool cameraInGrid) const;
+
+      //Same as intersectScene() in kernels/skyline.cl without __local tiles.  Returns texture coordinates
+      //and moves thisRay to where it hit.
+      cl::float3 intersect(ray& thisRay, cl::float3& normal, cl::int2& whichGridCell, traversalStats& stats) const;
+
+      //intersect() for the count rays whose indices are in which.  They walk the grid together.
+      void intersectPacket(ray* rays, cl::float3* normals, cl::int2* cells, cl::float3* texCoords, const int* which, const int count,
+                           traversalStats& stats) const;
+
+      //The sky and the ground, which every ray tests before the grid
+      closestHit startHit(const ray& thisRay) const;
+
+      //Move thisRay to closest and return its texture coordinates and normal
+      cl::float3 finishHit(ray& thisRay, const closestHit& closest, cl::float3& normal) const;
+
+      //Find the closest box that 1 ray hits starting from whichGridCell
+      void walkGrid(const ray& thisRay, cl::int2& whichGridCell, closestHit& closest, traversalStats& stats) const;
+
+      //Rest of walkGrid() from whichGridCell on.  Packets finish rays that diverge with this.
+      void walkCells(const ray& thisRay, const cl::float3 invDir, cl::int2& whichGridCell, cl::float2 distToNext,
+                     const cl::float2 betweenCells, closestHit& closest, traversalStats& stats) const;
+
+      //walkGrid() for the count rays whose indices are in which.  Each step tests the cell that the most
+      //rays are in against all of them at once.  Once every ray is in a different cell, the rest
+      //finish 1 at a time.
+      void walkGridPacket(const ray* rays, cl::int2* cells, closestHit* closest, const int* which, const int count,
+                          traversalStats& stats) const;
+
+      //Find the closest of count boxes that a ray hits closer than limit.  Updates closestDist and
+      //closestBox if it finds one.
+      void nearestBox(const int* boxes, const int count, const ray& thisRay, const cl::float3 invDir, const float limit,
+                      float& closestDist, int& closestBox, traversalStats& stats) const;
+
+      //Same as scatterAndShade() in kernels/skyline.cl.  Returns whether thisRay was reflected specularly.
+      bool scatterAndShade(ray& thisRay, cl::float3& maskColor, size_t& seed, const cl::float3 normal, const cl::float3 texCoords,
+                           const bool wantFull, const float gamma) const;
+
+      //Same as sampleSky() in kernels/skyline.cl
+      cl::float3 sampleSky(const ray& thisRay, const cl::float3 maskColor, const bool wantFull) const;
+
+      //Bilinear lookups that match the kernel's samplers
+      cl::float4 sampleTexture(const cl::float3 texCoords, const bool wantFull) const;
+      cl::float4 sampleSkyMap(const float x, const float y) const;
+  };
+}
+
+#endif //APP_CPURENDERER_H
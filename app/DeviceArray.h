@@ -0,0 +1,174 @@
+//File: DeviceArray.h
+//Brief: A DeviceArray is an OpenCL buffer with spare capacity and a host copy of what's
+//       in it.  upload() compares new contents to that copy and only writes the ranges
+//       that changed.  The buffer is only reallocated when the array outgrows it, so
+//       small edits to a big scene don't send the whole scene to the GPU again.  Writes
+//       don't block.  The host copy is what they read from, so upload() waits for the
+//       last upload's writes before it changes the host copy, and a DeviceArray waits
+//       for them before it's destroyed or replaced.  patch() skips the
+//       comparison for callers that already know which elements changed.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_DEVICEARRAY_H
+#define APP_DEVICEARRAY_H
+
+//OpenCL includes
+#define __CL_ENABLE_EXCEPTIONS //OpenCL c++ API now throws exceptions
+#include <CL/cl.hpp>
+
+//c++ includes
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <algorithm>
+
+namespace app
+{
+  template <class T>
+  class DeviceArray
+  {
+    public:
+      //Unchanged runs shorter than this between 2 changed ranges get uploaded with them
+      //so that scattered edits don't turn into thousands of tiny writes.
+      static constexpr size_t mergeGap = 64;
+
+      DeviceArray(): fCapacity(0) {}
+
+      //Writes that haven't finished yet read from fHost, so fHost has to outlive them
+      ~DeviceArray() { wait(); }
+      DeviceArray(DeviceArray&& other) = default;
+      DeviceArray& operator =(DeviceArray&& other)
+      {
+        wait();
+        fBuffer = std::move(other.fBuffer);
+        fHost = std::move(other.fHost);
+        fCapacity = other.fCapacity;
+        fWrites = std::move(other.fWrites);
+        other.fCapacity = 0;
+        return *this;
+      }
+
+      //Make the buffer hold [begin, end).  Returns the number of elements written.  Writes
+      //wait for waitFor if it's not null.
+      size_t upload(cl::Context& ctx, cl::CommandQueue& queue, const T* begin, const T* end, const std::vector<cl::Event>* waitFor = nullptr)
+      {
+        const size_t size = end - begin;
+        wait();
+
+        //OpenCL buffers can't be empty, so there's always room for at least 1 element
+        if(size > fCapacity || !fBuffer())
+        {
+          fCapacity = std::max<size_t>(1, size + size/2);
+          fBuffer = cl::Buffer(ctx, CL_MEM_READ_ONLY, fCapacity * sizeof(T));
+          fHost.resize(size);
+          write(queue, begin, 0, size, waitFor);
+          return size;
+        }
+
+        //Anything past the old size is new
+        const size_t oldSize = fHost.size();
+        fHost.resize(size);
+
+        size_t nWritten = 0, first = 0;
+        bool inRange = false;
+        size_t lastChanged = 0;
+        for(size_t which = 0; which < size; ++which)
+        {
+          const bool changed = (which >= oldSize) || memcmp(&fHost[which], begin + which, sizeof(T));
+          if(!changed) continue;
+
+          if(inRange && which - lastChanged > mergeGap)
+          {
+            write(queue, begin, first, lastChanged + 1, waitFor);
+            nWritten += lastChanged + 1 - first;
+            inRange = false;
+          }
+          if(!inRange) first = which;
+          inRange = true;
+          lastChanged = which;
+        }
+        if(inRange)
+        {
+          write(queue, begin, first, lastChanged + 1, waitFor);
+          nWritten += lastChanged + 1 - first;
+        }
+
+        return nWritten;
+      }
+
+      //Set a few elements that the caller knows changed without comparing the rest.  Each change is
+      //an index and its new value.  Indices past host().size() are ignored.
+      void patch(cl::CommandQueue& queue, std::vector<std::pair<size_t, T>> changes)
+      {
+        wait();
+
+        std::sort(changes.begin(), changes.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+        changes.erase(std::remove_if(changes.begin(), changes.end(), [this](const auto& change) { return change.first >= fHost.size(); }), changes.end());
+        for(const auto& change: changes) fHost[change.first] = change.second;
+
+        //Elements between changes in the same range are already on the device
+        for(size_t first = 0; first < changes.size();)
+        {
+          size_t last = first;
+          while(last + 1 < changes.size() && changes[last + 1].first - changes[last].first <= mergeGap) ++last;
+          send(queue, changes[first].first, changes[last].first + 1, nullptr);
+          first = last + 1;
+        }
+      }
+
+      //Drop the buffer.  buffer() refers to nothing until the next upload().
+      void reset()
+      {
+        wait();
+        fBuffer = cl::Buffer();
+        fHost.clear();
+        fCapacity = 0;
+      }
+
+      inline const cl::Buffer& buffer() const { return fBuffer; }
+
+      //Whether every write from the last upload() has finished.  Doesn't block.
+      bool uploaded() const
+      {
+        return std::all_of(fWrites.begin(), fWrites.end(), [](const cl::Event& write)
+                                                           {
+                                                             return write.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE;
+                                                           });
+      }
+
+      //What the first host().size() elements of the buffer hold as of the last upload()
+      inline const std::vector<T>& host() const { return fHost; }
+      inline size_t capacity() const { return fCapacity; }
+
+    private:
+      cl::Buffer fBuffer;
+      std::vector<T> fHost;
+      size_t fCapacity; //Elements that fit in fBuffer
+      std::vector<cl::Event> fWrites; //Writes still reading from fHost
+
+      //Block until every write from the last upload() or patch() finishes
+      void wait()
+      {
+        if(!fWrites.empty()) cl::WaitForEvents(fWrites);
+        fWrites.clear();
+      }
+
+      //Copy [first, last) of the new contents into fHost and send them to the device.  Elements
+      //that a merged range skipped over are the same on both sides.
+      void write(cl::CommandQueue& queue, const T* contents, const size_t first, const size_t last, const std::vector<cl::Event>* waitFor)
+      {
+        if(first == last) return;
+        std::copy(contents + first, contents + last, fHost.begin() + first);
+        send(queue, first, last, waitFor);
+      }
+
+      //Send [first, last) of fHost to the device
+      void send(cl::CommandQueue& queue, const size_t first, const size_t last, const std::vector<cl::Event>* waitFor)
+      {
+        fWrites.emplace_back();
+        queue.enqueueWriteBuffer(fBuffer, CL_FALSE, first * sizeof(T), (last - first) * sizeof(T), fHost.data() + first, waitFor, &fWrites.back());
+      }
+  };
+}
+
+#endif //APP_DEVICEARRAY_H
@@ -8,6 +8,8 @@
 //app includes
 #include "app/GUI.h"
 #include "app/Geometry.h"
+#include "app/KernelReloader.h"
+#include "app/ABTest.h"
 
 //camera includes
 #include "camera/CameraController.h"
@@ -25,6 +27,7 @@
 
 //c++ includes
 #include <algorithm>
+#include <iostream>
 #include <experimental/filesystem>
 
 namespace fs = std::experimental::filesystem;
@@ -173,7 +176,7 @@ namespace app
     }
   }
 
-  void drawMetrics(const ImGuiIO& io)
+  void drawMetrics(const ImGuiIO& io, const float kernelTime, const traversalStats& stats)
   {
     static bool isOpen = false;
 
@@ -189,21 +192,45 @@ namespace app
       static float runningAvg = 0.;
       static std::array<float, 30> timeBuffer{0};
 
+      //Average time spent in the path tracing kernel on the device
+      static float runningKernelAvg = 0.;
+      static std::array<float, 30> kernelBuffer{0};
+
       ++nFrames;
 
       //Average over 10 frames
       constexpr int samplesPerUpdate = 10;
       runningAvg += io.DeltaTime * 1000.; //in ms
+      runningKernelAvg += kernelTime;
       if(nFrames % samplesPerUpdate == 0)
       {
         std::rotate(timeBuffer.begin(), timeBuffer.begin() + 1, timeBuffer.end());
         timeBuffer[0] = runningAvg / (float)samplesPerUpdate;
         runningAvg = 0.;
+
+        std::rotate(kernelBuffer.begin(), kernelBuffer.begin() + 1, kernelBuffer.end());
+        kernelBuffer[0] = runningKernelAvg / (float)samplesPerUpdate;
+        runningKernelAvg = 0.;
       }
 
       ImGui::PlotLines("", timeBuffer.data(), timeBuffer.size(), 0,
                        ("Average Frame Time: " + std::to_string(timeBuffer[0]) + " ms (~" + std::to_string((int)(io.Framerate)) + " FPS)").c_str(),
                        0., 2.*timeBuffer[0], ImVec2(0, 80));
+
+      //Kernel time doesn't include waiting on the GUI or vsync.  Use it to compare kernel changes.
+      ImGui::PlotLines("##kernel", kernelBuffer.data(), kernelBuffer.size(), 0,
+                       ("Average Kernel Time: " + std::to_string(kernelBuffer[0]) + " ms").c_str(),
+                       0., 2.*kernelBuffer[0], ImVec2(0, 80));
+
+      //Grid traversal work from the last frame
+      if(ImGui::CollapsingHeader("Grid Traversal"))
+      {
+        const float nTests = stats.nBoxTests + stats.nMailboxHits;
+        ImGui::Text("Rays: %u", stats.nRays);
+        ImGui::Text("Box tests per ray: %.2f", (stats.nRays > 0)?stats.nBoxTests/(float)stats.nRays:0.f);
+        ImGui::Text("Duplicate tests avoided: %u (%.1f%%)", stats.nMailboxHits, (nTests > 0)?100.f*stats.nMailboxHits/nTests:0.f);
+        ImGui::Text("Tiles in __local memory: %u", stats.nLocalTiles);
+      }
       
       ImGui::End();
     }
@@ -294,7 +321,7 @@ namespace app
         app::Geometry newFile;
         try
         {
-          newFile.load(fileName);
+          newFile.load(fileName, true);
           app = std::move(newFile);
           showOpen = false;
           ImGui::End();
@@ -335,20 +362,32 @@ namespace app
       }
 
       //Allow the user to enter a file name in the current directory.
-      static std::string fileName;
-      if(ImGui::InputText("Save As", &fileName, ImGuiInputTextFlags_EnterReturnsTrue))
+      static std::string fileName, saveError;
+      if(app.loading()) ImGui::Text("Still loading boxes (%.0f%%).  Wait for them before saving.", 100.f*app.loadProgress());
+      else if(ImGui::InputText("Save As", &fileName, ImGuiInputTextFlags_EnterReturnsTrue))
       {
+        //Keep this window open when saving fails so that the user can try somewhere else
+        saveError.clear();
         try
         {
-          app.write(pwd / fileName);
+          //Binary scene files load much faster than YAML for big cities
+          if(fs::path(fileName).extension() == ".skyline") app.writeScene(pwd / fileName);
+          else app.write(pwd / fileName);
         }
         catch(const YAML::Exception& e)
         {
-          //TODO: Warn the user that serialization failed?
+          saveError = "Failed to write " + fileName + ": " + e.what();
+        }
+        catch(const Geometry::exception& e)
+        {
+          const std::string why = e.what();
+          saveError = "Failed to write " + fileName + ": " + why.substr(0, why.find("\n\n")); //Leave out the usage message
         }
 
-        showSave = false;
+        if(saveError.empty()) showSave = false;
+        else std::cerr << saveError << "\n";
       }
+      if(!saveError.empty()) ImGui::TextColored(ImVec4(1.f, 0.3f, 0.3f, 1.f), "%s", saveError.c_str());
 
       //Show a directory tree rooted in pwd.
       //Only used for selecting a new pwd.
@@ -378,12 +417,94 @@ namespace app
       if(ImGui::InputInt("Bounces per Frame", &engine.nBounces(), ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
       if(ImGui::InputInt("Latency", &engine.latency(), ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
       if(ImGui::InputInt("Samples per Frame", &engine.nSamples(), ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
+      if(ImGui::InputFloat("Gamma", &engine.gamma(), 0.1f, 0.5f, "%.2f", ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
+      if(engine.gamma() < 0.1f) engine.gamma() = 0.1f;
+      if(ImGui::Combo("Textures", &engine.textures(), "Streamed\0Coarse Only\0")) changed = true;
+
+      //Each combination of these settings builds its own kernel the first time it's used
+      ImGui::Checkbox("Specialize Kernel", &engine.specialize());
+      ImGui::SameLine();
+      ImGui::TextDisabled("(build a kernel for these bounces and samples)");
+
+      //Changing how work is divided doesn't change the image, so it doesn't reset iterations
+      ImGui::InputInt("Tile Size", &engine.tileSize(), 0, 0, ImGuiInputTextFlags_EnterReturnsTrue);
+      ImGui::SameLine();
+      ImGui::TextDisabled("(rounded down to a power of 2)");
+      ImGui::Checkbox("Share Primary Ray Cells in __local Memory", &engine.localTiles());
+      ImGui::Checkbox("Persistent Threads", &engine.persistent());
+      if(ImGui::InputInt("Tiles per Frame", &engine.tilesPerFrame(), 0, 0, ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
+      if(engine.tilesPerFrame() < 0) engine.tilesPerFrame() = 0;
+      ImGui::SameLine();
+      ImGui::TextDisabled("(0 for the whole image)");
       ImGui::End();
     }
 
     return changed;
   }
 
+  void drawKernels(KernelReloader& reloader, ABTest& test)
+  {
+    static bool isOpen = false;
+    const bool clicked = ImGui::MenuItem("kernels");
+    if(!isOpen) isOpen = clicked;
+
+    if(isOpen)
+    {
+      ImGui::Begin("kernels", &isOpen);
+      const auto status = reloader.getStatus();
+      ImGui::Text("Watching kernels/*.cl and serial/* in %s", status.directory.c_str());
+      ImGui::Text("Reloads: %d", status.nReloads);
+      if(status.building)
+      {
+        ImGui::SameLine();
+        ImGui::TextDisabled("(building...)");
+      }
+      if(ImGui::Button("Reload Now")) reloader.reload();
+
+      if(!status.log.empty())
+      {
+        ImGui::TextColored(ImVec4(1.f, 0.3f, 0.3f, 1.f), "The last reload failed.  Still using the last program that built.");
+        ImGui::BeginChild("Build Log", ImVec2(0, 300), true, ImGuiWindowFlags_HorizontalScrollbar);
+        ImGui::TextUnformatted(status.log.c_str());
+        ImGui::EndChild();
+      }
+
+      //Alternate 2 variants frame by frame.  Good for trying out a #define in the kernel.
+      if(ImGui::CollapsingHeader("A/B Test"))
+      {
+        bool restart = false;
+        if(ImGui::Checkbox("Alternate A and B", &test.enabled))
+        {
+          restart = true;
+          if(test.enabled) test.error.clear();
+        }
+        if(ImGui::InputText("A Options", &test.options[0], ImGuiInputTextFlags_EnterReturnsTrue)) restart = true;
+        if(ImGui::InputText("B Options", &test.options[1], ImGuiInputTextFlags_EnterReturnsTrue)) restart = true;
+        ImGui::SameLine();
+        ImGui::TextDisabled("(added to the engine's options)");
+        if(restart || ImGui::Button("Reset Times")) test.reset();
+
+        if(!test.error.empty()) ImGui::TextColored(ImVec4(1.f, 0.3f, 0.3f, 1.f), "%s", test.error.c_str());
+
+        ImGui::Columns(3);
+        ImGui::Text("Variant"); ImGui::NextColumn();
+        ImGui::Text("Frames"); ImGui::NextColumn();
+        ImGui::Text("Average Kernel Time"); ImGui::NextColumn();
+        for(int which = 0; which < 2; ++which)
+        {
+          ImGui::Text("%c", "AB"[which]); ImGui::NextColumn();
+          ImGui::Text("%d", test.nFrames[which]); ImGui::NextColumn();
+          ImGui::Text("%.3f ms", test.average(which)); ImGui::NextColumn();
+        }
+        ImGui::Columns(1);
+
+        if(test.average(0) > 0.f) ImGui::Text("B takes %.1f%% of A's time", 100.f * test.average(1) / test.average(0));
+      }
+
+      ImGui::End();
+    }
+  }
+
   bool drawGrid(app::Geometry& geom) /*, const eng::WithCamera& view)*/
   {
     static bool isOpen = false;
@@ -397,17 +518,44 @@ namespace app
       //TODO: It's actually really hard to get the kernel code for calculating the camera's grid cell into OpenCL.  Who would have thought?
       /*const auto cameraCell = positionToCell(geom.gridSize(),  view.fCamController->model().exactPosition());
       ImGui::LabelText("Camera Cell:", "{%d, %d}", cameraCell.x, cameraCell.y);*/
-      if(ImGui::InputInt2("Number of Grid Cells", geom.gridSize().max.data.s, ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
+      if(ImGui::InputInt2("Number of Grid Cells", geom.requestedGridCells().data.s, ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
 
       //Setting a number of grid cells < 1 is disastrous for the grid generation stage.
-      if(geom.gridSize().max.x < 1) geom.gridSize().max.x = 1;
-      if(geom.gridSize().max.y < 1) geom.gridSize().max.y = 1;
+      if(geom.requestedGridCells().x < 1) geom.requestedGridCells().x = 1;
+      if(geom.requestedGridCells().y < 1) geom.requestedGridCells().y = 1;
+
+      //Boxes that would be in more grid cells than this are tested by every ray instead
+      if(ImGui::InputInt("Max Cells per Box", &geom.largeBoxThreshold(), 1, 10, ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
+      if(geom.largeBoxThreshold() < 0) geom.largeBoxThreshold() = 0;
+      ImGui::SameLine();
+      ImGui::TextDisabled("(0 to put every box in the grid)");
+
+      //The grid below keeps rendering until a new one is built and uploaded
+      if(geom.rebuilding())
+      {
+        ImGui::ProgressBar(geom.rebuildProgress(), ImVec2(-1.f, 0.f), geom.uploadingRebuild()?"Uploading new grid":"Building new grid");
+      }
+
+      //How much memory the grid uses
+      ImGui::Text("Large boxes: %d", geom.nLargeBoxes());
+      ImGui::Text("Grid cells: %lu cells (%.1f kB), %lu with boxes inline", geom.nGridCells(), geom.nGridCells() * sizeof(gridCell) / 1024.f,
+                  geom.nInlineCells());
+      ImGui::Text("Index buffer: %lu indices (%.1f kB)", geom.nGridIndices(), geom.nGridIndices() * sizeof(int) / 1024.f);
+      ImGui::Text("Boxes: %lu boxes (%.1f kB)", geom.nBoxes(), geom.nBoxes() * sizeof(aabbBounds) / 1024.f);
       ImGui::End();
     }
 
     return changed;
   }
 
+  void drawLoading(const app::Geometry& geom)
+  {
+    if(!geom.loading()) return;
+
+    ImGui::Text("Loading %lu boxes", geom.nBoxes());
+    ImGui::ProgressBar(geom.loadProgress(), ImVec2(120.f, 0.f));
+  }
+
   bool drawBackground(app::Geometry& geom)
   {
     static bool isOpen = false;
@@ -442,16 +590,16 @@ namespace app
     return changed;
   }
 
-  bool editBox(std::unique_ptr<Geometry::selected>& selection, const Geometry& geometry)
+  bool editBox(std::unique_ptr<Geometry::selected>& selection, Geometry& geometry)
   {
     //If I call editBox at all, that means that selection is not nullptr and so the GUI should open.
-    bool isOpen = true, changed = false;
+    bool isOpen = true, changed = false, moved = false;
 
     //Draw a box editor window.
     ImGui::Begin("Box Editor", &isOpen);
     ImGui::InputText("name", &selection->name, ImGuiInputTextFlags_EnterReturnsTrue);
-    if(ImGui::InputFloat3("center", selection->box.center.data.s, ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
-    if(ImGui::InputFloat3("size", selection->box.width.data.s, ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
+    if(ImGui::InputFloat3("center", selection->box.center.data.s, ImGuiInputTextFlags_EnterReturnsTrue)) moved = true;
+    if(ImGui::InputFloat3("size", selection->box.width.data.s, ImGuiInputTextFlags_EnterReturnsTrue)) moved = true;
     if(ImGui::InputFloat3("texture normalization", selection->box.texNorm.data.s, ImGuiInputTextFlags_EnterReturnsTrue)) changed = true;
 
     //Material chooser and editor
@@ -473,6 +621,21 @@ namespace app
 
     //TODO: Material editor here?
 
+    //Only boxes that moved need a new grid
+    if(moved || changed) geometry.boxChanged(selection->index, moved);
+    changed = changed || moved;
+
+    //Buildings shouldn't run into each other.  The grid is from before this edit, so it still has
+    //this box where it used to be.
+    const auto overlaps = geometry.query().overlapping(selection->box, selection->index);
+    if(!overlaps.empty())
+    {
+      constexpr size_t maxListed = 8;
+      ImGui::TextColored(ImVec4(1.f, 0.3f, 0.3f, 1.f), "Overlaps %zu other boxes:", overlaps.size());
+      for(size_t which = 0; which < std::min(overlaps.size(), maxListed); ++which) ImGui::BulletText("%s", geometry.boxName(overlaps[which]).c_str());
+      if(overlaps.size() > maxListed) ImGui::BulletText("...");
+    }
+
     //Grid acceleration structure information for this box
     ImGui::Text("Grid Cells with this Box:");
     for(const auto& cell: selection->gridCells) ImGui::Text("{%d, %d}", cell.x, cell.y);
@@ -483,4 +646,55 @@ namespace app
 
     return changed;
   }
+
+  bool editBoxes(std::vector<std::unique_ptr<Geometry::selected>>& selections, Geometry& geometry)
+  {
+    bool isOpen = true, changed = false;
+
+    ImGui::Begin("Multi-Box Editor", &isOpen);
+    ImGui::Text("%zu boxes selected", selections.size());
+
+    //Move every center by the same offset so that the boxes keep their layout
+    static cl::float3 offset = {0.f, 0.f, 0.f};
+    ImGui::InputFloat3("offset", offset.data.s);
+    if(ImGui::Button("Move"))
+    {
+      for(auto& selection: selections)
+      {
+        selection->box.center += offset;
+        geometry.boxChanged(selection->index, true);
+      }
+      changed = true;
+    }
+
+    //Give every box the same material
+    if(ImGui::ListBoxHeader("Material"))
+    {
+      for(const auto& material: geometry.listMaterials())
+      {
+        const bool allHaveIt = std::all_of(selections.begin(), selections.end(),
+                                           [&material](const auto& selection) { return selection->box.material == material.second; });
+        if(ImGui::Selectable(material.first.c_str(), allHaveIt))
+        {
+          for(auto& selection: selections)
+          {
+            selection->box.material = material.second;
+            geometry.boxChanged(selection->index, false);
+          }
+          changed = true;
+        }
+      }
+      ImGui::ListBoxFooter();
+    }
+
+    constexpr size_t maxListed = 8;
+    for(size_t which = 0; which < std::min(selections.size(), maxListed); ++which) ImGui::BulletText("%s", selections[which]->name.c_str());
+    if(selections.size() > maxListed) ImGui::BulletText("...");
+
+    ImGui::End();
+
+    if(!isOpen) selections.clear();
+
+    return changed;
+  }
 }
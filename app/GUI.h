@@ -21,6 +21,9 @@ namespace eng
 
 namespace app
 {
+  class KernelReloader;
+  struct ABTest;
+
   //Control the camera by emulating GLFW's callbacks with Dear ImGui.
   bool handleCamera(eng::WithCamera& view, const ImGuiIO& io);
 
@@ -28,8 +31,10 @@ namespace app
   void drawCameras(Geometry& app, eng::WithCamera& view);
 
   //Draw a window displaying application metrics like framerate and time to
-  //complete the path tracing kernel(s).
-  void drawMetrics(const ImGuiIO& io);
+  //complete the path tracing kernel(s).  kernelTime is how long the last path
+  //tracing kernel took on the device in ms.  stats are the last path tracing
+  //kernel's grid traversal counters.
+  void drawMetrics(const ImGuiIO& io, const float kernelTime, const traversalStats& stats);
 
   //Show help information about controlling the camera and navigating the GUI.
   void drawHelp();
@@ -44,20 +49,33 @@ namespace app
   //to be updated.
   bool drawEngine(eng::WithRandomSeeds& engine);
 
+  //Show a window for kernel hot reloading and A/B timing of 2 kernel variants.
+  //Shows the build log when the last reload failed.
+  void drawKernels(KernelReloader& reloader, ABTest& test);
+
   //Show a window displaying details of the grid acceleration structure like
   //the camera's current grid cell and the grid cell of the most recently selected
   //object.  Returns true if grid configuration changed.
   bool drawGrid(app::Geometry& app); /*, const eng::WithCamera& view);*/
 
+  //Show how much of a file is still loading in the background in the main menu bar.
+  //Draws nothing once everything is loaded.
+  void drawLoading(const app::Geometry& geom);
+
   //Show a window for controlling the skybox and the ground.  Returns true
   //if any of these changed.
   bool drawBackground(app::Geometry& geom);
 
   //Pop up a GUI to edit the parameters of an aabb and its asscoiated metadata.
   //Returns true if something about selection changed that needs to be uploaded
-  //to the GPU.  reset()ing selection de-selects that box.  That should happen
-  //when the editor window drawn here is closed.
-  bool editBox(std::unique_ptr<Geometry::selected>& selection, const Geometry& geometry);
+  //to the GPU and tells geometry about it.  reset()ing selection de-selects that
+  //box.  That should happen when the editor window drawn here is closed.
+  bool editBox(std::unique_ptr<Geometry::selected>& selection, Geometry& geometry);
+
+  //Pop up a GUI to move several boxes at once and give them all the same material.
+  //Returns true if something changed that needs to be uploaded to the GPU and tells
+  //geometry which boxes changed.  Closing the window clears selections.
+  bool editBoxes(std::vector<std::unique_ptr<Geometry::selected>>& selections, Geometry& geometry);
 }
 
 #endif //APP_GUI_H
@@ -11,6 +11,10 @@
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <cstring>
+#include <unordered_map>
+#include <numeric>
 
 //OpenCL includes
 #define __CL_ENABLE_EXCEPTIONS //OpenCL c++ API now throws exceptions
@@ -18,11 +22,15 @@
 
 //app includes
 #include "app/Geometry.h"
+#include "app/SceneFile.h"
 
 //serial includes
 #include "serial/aabb.cpp"
 #include "serial/sphere.cpp"
+#include "serial/octahedral.cpp"
+#include "serial/gridCell.cpp"
 #include "serial/groundPlane.cpp"
+#include "serial/grid.cpp"
 
 //camera includes
 #include "algebra/YAMLIntegration.h"
@@ -61,16 +69,86 @@
 //Helper functions to make code more readable
 namespace
 {
-  unsigned char findOrCreate(const std::string& toFind, std::vector<std::string>& existingNames)
+  //Read a pixel from a rectangular RGBA sky texture with bilinear filtering.  Wraps around in x and
+  //clamps in y like the texture sampler that used to read it on the GPU.
+  cl::float4 sampleRectangle(const float* pixels, const int width, const int height, const float x, const float y)
   {
-    auto found = std::find(existingNames.begin(), existingNames.end(), toFind);
-    if(found == existingNames.end())
+    const int left = std::floor(x), top = std::floor(y);
+    const float fracX = x - left, fracY = y - top;
+
+    cl::float4 result = {0.f, 0.f, 0.f, 0.f};
+    for(int row = 0; row < 2; ++row)
     {
-      existingNames.push_back(toFind);
-      found = std::prev(existingNames.end());
+      const int clampedRow = std::min(std::max(top + row, 0), height - 1);
+      for(int col = 0; col < 2; ++col)
+      {
+        const int wrappedCol = ((left + col) % width + width) % width;
+        const float weight = (col?fracX:1.f - fracX) * (row?fracY:1.f - fracY);
+        const float* pixel = pixels + 4*(wrappedCol + clampedRow*width);
+        result = result + cl::float4{pixel[0], pixel[1], pixel[2], pixel[3]} * weight;
+      }
     }
 
-    return std::distance(existingNames.begin(), found);
+    return result;
+  }
+
+  //Convert a rectangular sky texture into an octahedral map with mip levels.  Level 0 is a size x size
+  //square on the left, and each smaller level is packed to the right of the level before it.  So, the
+  //result is 2*size x size RGBA floats.  The device looks up the sky by ray direction without any trig
+  //functions this way, and diffuse bounces can read from a smaller level.
+  std::vector<float> buildSkyMap(const float* pixels, const int width, const int height, const int size)
+  {
+    const int rowLength = 2*size;
+    std::vector<float> skyMap(4 * rowLength * size, 0.f);
+    const sphere unitSphere = {{0.f, 0.f, 0.f}, 1.f};
+
+    //Level 0: resample the rectangular texture in the direction of each texel
+    for(int row = 0; row < size; ++row)
+    {
+      for(int col = 0; col < size; ++col)
+      {
+        const auto dir = octahedral_decode(cl::float2{(col + 0.5f)/size, (row + 0.5f)/size});
+        const auto texCoords = sphere_tex_coords(unitSphere, dir);
+        const auto color = sampleRectangle(pixels, width, height, texCoords.x * width - 0.5f, texCoords.y * height - 0.5f);
+        std::copy(color.data.s, color.data.s + 4, skyMap.begin() + 4*(col + row*rowLength));
+      }
+    }
+
+    //Smaller levels: average 2x2 blocks of the level before
+    for(int prevSize = size, prevOffset = 0; prevSize > 1; prevOffset += prevSize, prevSize /= 2)
+    {
+      const int levelSize = prevSize/2, levelOffset = prevOffset + prevSize;
+      for(int row = 0; row < levelSize; ++row)
+      {
+        for(int col = 0; col < levelSize; ++col)
+        {
+          for(int channel = 0; channel < 4; ++channel)
+          {
+            float sum = 0.f;
+            for(int subRow = 0; subRow < 2; ++subRow)
+            {
+              for(int subCol = 0; subCol < 2; ++subCol)
+              {
+                sum += skyMap[4*(prevOffset + 2*col + subCol + (2*row + subRow)*rowLength) + channel];
+              }
+            }
+            skyMap[4*(levelOffset + col + row*rowLength) + channel] = sum/4.f;
+          }
+        }
+      }
+    }
+
+    return skyMap;
+  }
+
+  //indices has the index of every name in existingNames so that looking up a name doesn't
+  //compare it to every other name
+  unsigned char findOrCreate(const std::string& toFind, std::vector<std::string>& existingNames, std::unordered_map<std::string, int>& indices)
+  {
+    const auto found = indices.emplace(toFind, existingNames.size());
+    if(found.second) existingNames.push_back(toFind);
+
+    return found.first->second;
   }
 
   //List the corners of an aabb
@@ -88,46 +166,46 @@ namespace
            };
   }
 
-  //Construct a vector of the minimum component in each dimension of two vectors
-  cl::float3 vecMin(const cl::float3 lhs, const cl::float3 rhs)
-  {
-    cl::float3 result;
-    result.x = std::min(lhs.x, rhs.x);
-    result.y = std::min(lhs.y, rhs.y);
-    result.z = std::min(lhs.z, rhs.z);
-
-    return result;
-  }
-
-  //Construct a vector of the maximum component in each dimension of two vectors
-  cl::float3 vecMax(const cl::float3 lhs, const cl::float3 rhs)
+  //Distance from the origin to the farthest corner of any box
+  float farthestCorner(const std::vector<aabb>& boxes)
   {
-    cl::float3 result;
-    result.x = std::max(lhs.x, rhs.x);
-    result.y = std::max(lhs.y, rhs.y);
-    result.z = std::max(lhs.z, rhs.z);
+    float radius = 0;
+    for(const auto& box: boxes)
+    {
+      for(const auto& corner: corners(box)) radius = std::max(radius, corner.mag());
+    }
 
-    return result;
+    return radius;
   }
 }
 
 namespace app
 {
   //TODO: Move this overload of load() and USAGE to individual applications when Geometry -> Geometry.
-  YAML::Node Geometry::load(const int argc, const char** argv)
+  YAML::Node Geometry::load(const int argc, const char** argv, const bool stream)
   {
     //argv[0] is always the path to this application.  So, the number of command line arguments is really argc - 1, and
     //I'm going to ignore argv[0].
     if(argc != 2) throw exception("Got " + std::to_string(argc-1) + " command line arguments, but expected exactly 1");
     if(!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) throw exception("");
 
-    return load(argv[1]);
+    return load(argv[1], stream);
   }
 
   //TODO: Only print usage information in version that takes argc and argv.
   //      Let exceptions propagate in this version.
-  YAML::Node Geometry::load(const std::string& fileName)
+  YAML::Node Geometry::load(const std::string& fileName, const bool stream)
   {
+    //Binary scene files skip yaml-cpp entirely
+    for(const auto& candidate: {fileName, std::string(INSTALL_DIR) + "/include/examples/" + fileName})
+    {
+      if(SceneFile::isSceneFile(candidate))
+      {
+        loadScene(candidate);
+        return YAML::Node();
+      }
+    }
+
     //The document into which I will try to load a YAML file
     YAML::Node document;
 
@@ -135,15 +213,18 @@ namespace app
     {
       //Try to load the configuration file from the current directory.  If that fails, try to load it
       //from the installation directory of this library as an example.
-      YAML::Node document;
-      try
-      {
-        document = YAML::LoadFile(fileName);
-      }
-      catch(YAML::Exception& /*e*/)
-      {
-        document = YAML::LoadFile(std::string(INSTALL_DIR) + "/include/examples/" + fileName);
-      }
+      std::ifstream file(fileName);
+      if(!file) file.open(std::string(INSTALL_DIR) + "/include/examples/" + fileName);
+      if(!file) throw exception("Failed to open a geometry file named " + fileName);
+      std::stringstream text;
+      text << file.rdbuf();
+
+      //Boxes are converted on other threads when the geometry map is simple enough to split up.
+      //yaml-cpp only parses everything else here.
+      auto loader = std::make_unique<StreamingLoader>(text.str());
+      const bool streamed = loader->canStream();
+      document = YAML::Load(streamed?loader->rest():text.str());
+      std::unordered_map<std::string, int> textureIndices; //Index of each name in textureNames
 
       //Read the color of the sun
       auto sun = document["sun"];
@@ -152,11 +233,13 @@ namespace app
       fSun.center = sun["center"].as<cl::float3>(cl::float3{0.f, 1.f, 0.f});
       fSun.radius = sun["radius"].as<float>(0.1);
 
-      //The sky texture and ground textures must be loaded before
-      //any other textures.
-      ::findOrCreate(document["sky"].as<std::string>(), textureNames);
+      //The sky is converted to an octahedral map right away.  stbi_loadf() undoes gamma correction
+      //for LDR files, and HDR files are already linear.
       skyTextureFile = document["sky"].as<std::string>();
-      ::findOrCreate(document["ground"]["file"].as<std::string>(), textureNames);
+      loadSky();
+
+      //The ground texture must be loaded before any other textures.
+      ::findOrCreate(document["ground"]["file"].as<std::string>(), textureNames, textureIndices);
       groundTextureFile = document["ground"]["file"].as<std::string>();
       fGroundTexNorm = document["ground"]["texNorm"].as<cl::float2>(cl::float2{1.f, 1.f});
 
@@ -176,84 +259,55 @@ namespace app
         //TODO: As an alternative, read color and generate a texture of pure color.
         fMaterials.push_back(material{mat.second["emission"].as<cl::float3>(cl::float3()).data,
                              {
-                               ::findOrCreate(mat.second["left"].as<std::string>(), textureNames),
-                               ::findOrCreate(mat.second["right"].as<std::string>(), textureNames),
-                               ::findOrCreate(mat.second["top"].as<std::string>(), textureNames),
-                               ::findOrCreate(mat.second["bottom"].as<std::string>(), textureNames),
-                               ::findOrCreate(mat.second["front"].as<std::string>(), textureNames),
-                               ::findOrCreate(mat.second["back"].as<std::string>(), textureNames),
+                               ::findOrCreate(mat.second["left"].as<std::string>(), textureNames, textureIndices),
+                               ::findOrCreate(mat.second["right"].as<std::string>(), textureNames, textureIndices),
+                               ::findOrCreate(mat.second["top"].as<std::string>(), textureNames, textureIndices),
+                               ::findOrCreate(mat.second["bottom"].as<std::string>(), textureNames, textureIndices),
+                               ::findOrCreate(mat.second["front"].as<std::string>(), textureNames, textureIndices),
+                               ::findOrCreate(mat.second["back"].as<std::string>(), textureNames, textureIndices),
                                0,
                                0
                              }});
       }
 
-      //TODO: This would be a great time to fill out metadata like box names for some GUI.
-      const auto& boxMap = document["geometry"];
-      for(const auto& box: boxMap)
+      //Start converting boxes now that I know about every material.  Wait for the first chunk so
+      //that there's something to render.
+      std::unordered_map<std::string, int> materials(nameToMaterialIndex.begin(), nameToMaterialIndex.end());
+      if(streamed)
       {
-        boxNames.push_back(box.first.as<std::string>());
-        const auto material = nameToMaterialIndex.find(box.second["material"].as<std::string>());
-        if(material == nameToMaterialIndex.end()) throw exception("Failed to look up a material named " + box.second["material"].as<std::string>()
-                                                             + " for a box named " + box.first.as<std::string>());
-
-        aabb newBox;
-        newBox.width = box.second["width"].as<cl::float3>().data;
-        newBox.center = box.second["center"].as<cl::float3>().data;
-        newBox.texNorm = box.second["texNorm"].as<cl::float3>(newBox.width).data;
-        newBox.material = material->second;
-
-        fBoxes.push_back(newBox);
+        fLoader = std::move(loader);
+        fLoader->start(std::move(materials));
+        fLoader->waitForNext();
+        loadMore();
+        if(!stream) finishLoading();
       }
 
-      fFloorY = 0;  //The sky dome is always centered at (0, 0, 0)
-
-      //Load textures
-      //TODO: oneCell has to be updated to use a kernel compatible with textures. 
-      const unsigned int buildingFormat = GL_RGBA;
-      int channels = 4;
-      int width, height;
-
-      //I have to load a texture to get its size before allocating memory on the GPU.
-      //Or, I could get a constant size for textures somewhere else.
-      auto pixels = stbi_load(textureNames[0].c_str(), &width, &height, &channels, STBI_rgb_alpha);
-      if(!pixels)
-      {
-        std::cerr << "Couldn't find " << textureNames[0] << ", so trying to load "
-                  << std::string(INSTALL_DIR) + "/include/examples/" + textureNames[0] << " instead...\n";
-        pixels = stbi_load((std::string(INSTALL_DIR) + "/include/examples/" + textureNames[0]).c_str(), &width, &height, &channels, STBI_rgb_alpha);
-      }
-      if(!pixels) throw exception("Failed to load a texture from " + textureNames[0]);
-      #ifndef NDEBUG
-      std::cout << "First image has a size of " << width << " x " << height << ".\n";
-      #endif
-
-      fTextures.reset(new gl::TextureArray<GL_RGBA32F, GL_UNSIGNED_BYTE>(width, height, textureNames.size()));
-      fTextures->insert(0, buildingFormat, pixels);
-      stbi_image_free(pixels);
-
-      for(size_t whichFile = 1; whichFile < textureNames.size(); ++whichFile)
+      //TODO: This would be a great time to fill out metadata like box names for some GUI.
+      const auto& boxMap = document["geometry"];
+      if(!streamed) for(const auto& box: boxMap)
       {
-        pixels = stbi_load(textureNames[whichFile].c_str(), &width, &height, &channels, STBI_rgb_alpha);
-
-        //If we failed to load pixels, try to load from the examples that ship with skyline.
-        //TODO: Look for texture search directories in the YAML file.
-        if(!pixels)
+        boxNames.push_back(box.first.as<std::string>());
+        try
         {
-          std::cerr << "Couldn't find " << textureNames[whichFile] << ", so trying to load "
-                    << std::string(INSTALL_DIR) + "/include/examples/" + textureNames[whichFile] << " instead...\n";
-          pixels = stbi_load((std::string(INSTALL_DIR) + "/include/examples/" + textureNames[whichFile]).c_str(), &width, &height, &channels, STBI_rgb_alpha);
+          fBoxes.push_back(StreamingLoader::convert(boxNames.back(), box.second, materials));
         }
-        if(!pixels) throw exception("Failed to load a texture from " + textureNames[whichFile]);
-        if(!fTextures->checkDimensions(width, height))
+        catch(const std::runtime_error& e) //Including YAML::Exception
         {
-          throw exception(textureNames[whichFile] + " has different dimensions of " + std::to_string(width) + " x " + std::to_string(height) + " from the first texture in this file.  "
-                          "All textures must have the same dimensions.");
+          throw exception(e.what());
         }
-
-        fTextures->insert(whichFile, buildingFormat, pixels);
-        stbi_image_free(pixels);
       }
 
+      fFloorY = 0;  //The sky dome is always centered at (0, 0, 0)
+
+      //Textures are decoded on demand by fTextures.  So, I only need to know how big
+      //they'll be on the GPU and how many of them can be there at once.
+      //TODO: oneCell has to be updated to use a kernel compatible with textures.
+      const auto& textureConfig = document["textures"];
+      fTextureSize = textureConfig["size"].as<cl::int2>(cl::int2{1024, 512});
+      fTexturesResident = cl::int2{textureConfig["resident"].as<int>(std::min<int>(textureNames.size(), 64)),
+                                   textureConfig["coarse"].as<int>(std::min<int>(textureNames.size(), 512))};
+      makeTextures();
+
       const auto& cameraMap = document["cameras"];
       for(const auto& camera: cameraMap)
       {
@@ -261,6 +315,8 @@ namespace app
       }
 
       fGridSize.max = document["grid"].as<cl::int2>(cl::int2{1, 1});
+      fRequestedCells = fGridSize.max;
+      fLargeBoxThreshold = document["largeBoxCells"].as<int>(16); //0 turns off the list of large boxes
     }
     catch(const YAML::Exception& e)
     {
@@ -272,6 +328,10 @@ namespace app
 
   YAML::Node Geometry::write(const std::string& fileName)
   {
+    //Boxes that are still streaming in would be left out of the file.  finishLoading() would
+    //invalidate the caller's selections, so let the caller decide when to wait.
+    if(loading()) throw exception("Not writing " + fileName + " because boxes are still loading.");
+
     //"Invert" the mapping in nameToMaterialIndex
     std::vector<std::string> materialIndexToName(nameToMaterialIndex.size());
     for(const auto& name: nameToMaterialIndex) materialIndexToName[name.second] = name.first;
@@ -283,6 +343,9 @@ namespace app
     newFile["sky"] = skyTextureFile;
     newFile["ground"]["file"] = groundTextureFile;
     newFile["ground"]["texNorm"] = fGroundTexNorm;
+    newFile["textures"]["size"] = fTextureSize;
+    newFile["textures"]["resident"] = fTexturesResident.x;
+    newFile["textures"]["coarse"] = fTexturesResident.y;
     auto sun = newFile["sun"];
     sun["color"] = fSunEmission;
     sun["center"] = fSun.center;
@@ -337,7 +400,8 @@ namespace app
     }
 
     //Save grid state
-    newFile["grid"] = fGridSize.max;
+    newFile["grid"] = fRequestedCells;
+    newFile["largeBoxCells"] = fLargeBoxThreshold;
 
     //Write to a YAML file.
     std::ofstream output(fileName);
@@ -346,12 +410,239 @@ namespace app
     return newFile;
   }
 
+  bool Geometry::loadMore()
+  {
+    if(!fLoader) return false;
+
+    //Every chunk I take rebuilds the grid and uploads everything again.  Wait until there are as
+    //many chunks ready as I already have so that loading a city only does that O(log(chunks)) times.
+    if(fLoader->nReady() == 0 || (fLoader->nTaken() + fLoader->nReady() < fLoader->nChunks() && fLoader->nReady() < fLoader->nTaken())) return false;
+
+    try
+    {
+      fLoader->take(fBoxes, boxNames);
+    }
+    catch(const std::runtime_error& e)
+    {
+      fLoader.reset(); //Keep the boxes I already have
+      throw exception(e.what());
+    }
+
+    fBoxesMoved = true;
+    if(fLoader->allTaken()) fLoader.reset();
+    return true;
+  }
+
+  void Geometry::finishLoading()
+  {
+    if(!fLoader) return;
+
+    fBoxesMoved = true;
+    try
+    {
+      fLoader->finish(fBoxes, boxNames);
+    }
+    catch(const std::runtime_error& e)
+    {
+      fLoader.reset();
+      throw exception(e.what());
+    }
+    fLoader.reset();
+  }
+
+  void Geometry::loadScene(const std::string& fileName)
+  {
+    try
+    {
+      SceneFile file(fileName);
+      const auto scene = file.scene();
+
+      //Boxes and the grid are already in the device's order, so the host uses that order too
+      fBoxes = file.read<aabb>(SceneFile::BOXES);
+      fMaterials = file.read<material>(SceneFile::MATERIALS);
+      fGridCells = file.read<gridCell>(SceneFile::GRID_CELLS);
+      fBoxIndices = file.read<int>(SceneFile::GRID_INDICES);
+      fFromScene = true;
+      fGridSize = scene.gridSize;
+      fRequestedCells = fGridSize.max;
+      fLargeBoxThreshold = scene.largeBoxThreshold;
+
+      boxNames = file.strings(SceneFile::BOX_NAMES);
+      textureNames = file.strings(SceneFile::TEXTURE_NAMES);
+      const auto materialNames = file.strings(SceneFile::MATERIAL_NAMES);
+      for(size_t whichMaterial = 0; whichMaterial < materialNames.size(); ++whichMaterial) nameToMaterialIndex[materialNames[whichMaterial]] = whichMaterial;
+
+      //A bad file would make the kernel read out of bounds instead of failing here.  These checks are
+      //much faster than parsing.
+      if(boxNames.size() != fBoxes.size() || materialNames.size() != fMaterials.size() || textureNames.empty())
+      {
+        throw exception(fileName + " doesn't have a name for every box and material and a ground texture.");
+      }
+      for(const auto& box: fBoxes)
+      {
+        if(box.material < 0 || box.material >= (int)fMaterials.size()) throw exception(fileName + " has a box with a material that doesn't exist.");
+      }
+      for(const auto& mat: fMaterials)
+      {
+        if(*std::max_element(mat.textures.data.s, mat.textures.data.s + 6) >= textureNames.size()) throw exception(fileName + " has a material with a texture that doesn't exist.");
+      }
+      if(std::any_of(fBoxIndices.begin(), fBoxIndices.end(), [this](const int box) { return box < 0 || box >= (int)fBoxes.size(); })
+         || fGridSize.max.x < 1 || fGridSize.max.y < 1 || fGridCells.size() != (size_t)grid_nCells(fGridSize)
+         || fGridSize.largeBoxes.x < 0 || fGridSize.largeBoxes.x > fGridSize.largeBoxes.y || fGridSize.largeBoxes.y > (int)fBoxIndices.size())
+      {
+        throw exception(fileName + "'s grid doesn't match its boxes.");
+      }
+      for(const auto& cell: fGridCells)
+      {
+        //Boxes in lists were already checked with the rest of fBoxIndices
+        const int count = gridCell_count(cell);
+        bool valid = gridCell_nShared(cell) <= count;
+        if(gridCell_isInline(cell))
+        {
+          for(int which = 0; which < count; ++which) valid &= (gridCell_volume(cell, fBoxIndices.data(), which) < (int)fBoxes.size());
+        }
+        else valid &= ((size_t)cell.first + count <= fBoxIndices.size());
+
+        if(!valid) throw exception(fileName + " has a grid cell that refers to boxes that don't exist.");
+      }
+
+      groundTextureFile = textureNames.front();
+      fGroundTexNorm = scene.groundTexNorm;
+      skyTextureFile = file.strings(SceneFile::SKY_FILE).at(0);
+      loadSky();
+
+      fSunEmission = scene.sunEmission;
+      fSun.center = scene.sunCenter;
+      fSun.radius = scene.sunRadius;
+      fSky.center = cl::float3{0.f, 0.f, 0.f};
+      fSky.radius = scene.horizon;
+      fFloorY = 0;
+
+      const auto cameraNames = file.strings(SceneFile::CAMERA_NAMES);
+      const auto states = file.read<camera>(SceneFile::CAMERAS);
+      if(cameraNames.size() != states.size()) throw exception(fileName + " doesn't have a name for every camera.");
+      for(size_t whichCamera = 0; whichCamera < cameraNames.size(); ++whichCamera)
+      {
+        const auto& state = states[whichCamera];
+        cameras.emplace_back(cameraNames[whichCamera], eng::CameraModel(cl::float3{state.position.x, state.position.y, state.position.z}, state.focalPos, state.size));
+      }
+
+      fTextureSize = scene.textureSize;
+      fTexturesResident = scene.texturesResident;
+      makeTextures();
+    }
+    catch(const SceneFile::exception& e)
+    {
+      throw exception(e.what());
+    }
+    catch(const std::out_of_range& e)
+    {
+      throw exception(fileName + " doesn't say which sky texture to use.");
+    }
+  }
+
+  void Geometry::writeScene(const std::string& fileName)
+  {
+    if(loading()) throw exception("Not writing " + fileName + " because boxes are still loading."); //Same as write()
+
+    //The file has the grid in it.  A scene file that was just loaded or the grid that kernels are
+    //reading might already be up to date.  Otherwise, build a grid just for this file so that the
+    //grid kernels are reading and one that's being built in the background stay the same.
+    if(fFromScene) prepare();
+    const bool current = fFromScene || (layoutIsCurrent() && !fRebuild);
+
+    grid size = fGridSize;
+    std::vector<gridCell> cells;
+    std::vector<int> indices, deviceToHost, hostToDevice;
+    float radius = fBoxesRadius;
+    if(!current)
+    {
+      std::tie(size, cells, indices) = buildGrid(fBoxes, fRequestedCells, fLargeBoxThreshold);
+      deviceToHost = layoutBoxes(fBoxes.size(), size, cells, indices);
+      hostToDevice.resize(deviceToHost.size());
+      for(size_t whichBox = 0; whichBox < deviceToHost.size(); ++whichBox) hostToDevice[deviceToHost[whichBox]] = whichBox;
+      radius = ::farthestCorner(fBoxes);
+    }
+    const auto& layout = current?fDeviceToHost:deviceToHost;
+    const auto [devBoxes, devBoxIndices, devCells] = deviceArrays(fBoxes, layout, current?fHostToDevice:hostToDevice,
+                                                                  current?fBoxIndices:indices, current?fGridCells:cells);
+
+    std::vector<std::string> devNames(fBoxes.size());
+    for(size_t whichBox = 0; whichBox < layout.size(); ++whichBox) devNames[whichBox] = boxNames[layout[whichBox]];
+
+    //Same as placeSun()
+    const float skyRadius = std::max(fSky.radius, radius);
+    cl::float3 sunCenter = fSun.center;
+    sunCenter *= skyRadius / fSun.center.mag();
+
+    std::vector<std::string> materialIndexToName(nameToMaterialIndex.size());
+    for(const auto& name: nameToMaterialIndex) materialIndexToName[name.second] = name.first;
+
+    std::vector<std::string> cameraNames;
+    std::vector<camera> states;
+    for(const auto& inMemory: cameras)
+    {
+      cameraNames.push_back(inMemory.first);
+      states.push_back(inMemory.second.state());
+    }
+
+    SceneFile::writer file;
+    file.add(SceneFile::BOXES, devBoxes);
+    file.add(SceneFile::MATERIALS, fMaterials);
+    file.add(SceneFile::GRID_CELLS, devCells);
+    file.add(SceneFile::GRID_INDICES, devBoxIndices);
+    file.add(SceneFile::CAMERAS, states);
+    file.add(SceneFile::BOX_NAMES, devNames);
+    file.add(SceneFile::MATERIAL_NAMES, materialIndexToName);
+    file.add(SceneFile::TEXTURE_NAMES, textureNames);
+    file.add(SceneFile::CAMERA_NAMES, cameraNames);
+    file.add(SceneFile::SKY_FILE, std::vector<std::string>{skyTextureFile});
+
+    const SceneFile::settings scene = {size, fLargeBoxThreshold, fSunEmission.data, sunCenter.data, fSun.radius, skyRadius,
+                                       fGroundTexNorm.data, fTextureSize.data, fTexturesResident.data};
+    try
+    {
+      file.write(fileName, scene);
+    }
+    catch(const SceneFile::exception& e)
+    {
+      throw exception(e.what());
+    }
+  }
+
+  void Geometry::loadSky()
+  {
+    int width, height, channels;
+    auto pixels = stbi_loadf(skyTextureFile.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if(!pixels) pixels = stbi_loadf((std::string(INSTALL_DIR) + "/include/examples/" + skyTextureFile).c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if(!pixels) throw exception("Failed to load a sky texture from " + skyTextureFile);
+
+    //Texel density of an octahedral map that's as tall as the rectangular texture is about the same
+    fSkyMapSize = 1;
+    while(fSkyMapSize < height && fSkyMapSize < 4096) fSkyMapSize *= 2;
+    fSkyMap = ::buildSkyMap(pixels, width, height, fSkyMapSize);
+    stbi_image_free(pixels);
+    fDevSkyMap = cl::Image2D(); //Upload the new sky in sendToGPU()
+  }
+
+  void Geometry::makeTextures()
+  {
+    if(fTextureSize.x < (int)TextureStreamer::coarseFactor || fTextureSize.y < (int)TextureStreamer::coarseFactor)
+    {
+      throw exception("Textures must be at least " + std::to_string(TextureStreamer::coarseFactor) + " pixels on each side, but got "
+                      + std::to_string(fTextureSize.x) + " x " + std::to_string(fTextureSize.y));
+    }
+    if(fTexturesResident.x < 1 || fTexturesResident.y < 1) throw exception("There must be room for at least 1 texture on the GPU.");
+
+    fTextures.reset(new TextureStreamer(textureNames, fTextureSize.x, fTextureSize.y, fTexturesResident.x, fTexturesResident.y, fInterop));
+  }
+
   Geometry::exception::exception(const std::string& why): std::runtime_error(why + "\n\n" + USAGE)
   {
   }
 
   //Calculate the (x, z) limits for a grid acceleration structure
-  std::pair<cl::float3, cl::float3> Geometry::calcGridLimits(const std::vector<aabb>& boxes) const
+  std::pair<cl::float3, cl::float3> Geometry::calcGridLimits(const std::vector<aabb>& boxes)
   {
     cl::float3 min = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()}, max = -min;
 
@@ -359,8 +650,8 @@ namespace app
     {
       for(const auto corner: ::corners(box))
       {
-        min = ::vecMin(min, corner);
-        max = ::vecMax(max, corner);
+        min = cl::min(min, corner);
+        max = cl::max(max, corner);
       }
     }
 
@@ -369,51 +660,46 @@ namespace app
     return std::make_pair(min - epsilon, max + epsilon);
   }
 
-  //Group a collection of boxes into 2D gridCells.  Returns the grid's size, the gridCells, and
-  //the indices into the box collection that are sorted to be compatible with the container of
-  //gridCells.
-  //TODO: When I'm ready for a grid optimizer, I need to split this up into:
-  //      1) Get grid min/max and origin
-  //      2) Decide number of grid cells along each axis
-  //      3) Put boxes into grid cells
-  std::tuple<grid, std::vector<gridCell>, std::vector<int>> Geometry::buildGrid(const std::vector<aabb>& boxes, const cl::int2 nCells)
+  //Put each of boxes into the cells of size that it overlaps.  Boxes in more than largeThreshold
+  //cells go into largeBoxes instead.  min is the corner of the grid from calcGridLimits().
+  std::vector<std::set<int>> Geometry::fillGrid(const std::vector<aabb>& boxes, const grid& size, const cl::float3 min, const int largeThreshold,
+                                                std::vector<int>& largeBoxes, std::atomic<float>* progress)
   {
-    grid size;
-    std::vector<int> boxIndices;
-
-    //First, choose size: origin, max, and cellSize.  I could choose origin and max * cellSize
-    //by looking at a 2D bounding area for boxes.  cellSize should be optimized somehow to maximize
-    //performance.  Maybe I could start with a minimum or maximum number of boxes per cell.
-    //Eventually, this could be a good opportunity for real-time optimization.
-    auto [min, max] = calcGridLimits(boxes);
-
-    size.origin = {min.x, min.z};
-    size.max = {nCells.x, nCells.y};
-    size.cellSize = {(max.x - min.x)/size.max.x, (max.z - min.z)/size.max.y};
-
-    //Next, group boxes into cells.  The std::set<> makes sure each box can be in each cell only once.
-    //TODO: Do I even need a std::set<> anymore?  I should now loop over each cell once
-    std::vector<std::set<int>> boxesInEachCell(size.max.x * size.max.y);
+    std::vector<std::set<int>> boxesInEachCell(grid_nCells(size));
+    largeBoxes.clear();
     for(int whichBox = 0; whichBox < (int)boxes.size(); ++whichBox)
     {
+      //Putting boxes into cells takes most of the time
+      if(progress && whichBox % 4096 == 0) *progress = 0.8f * whichBox / boxes.size();
+
       //TODO: New algorithm for placing whichBox in cell(s).  Beware: it will end badly with boxes that aren't aligned
       //      with the x and z axes!
       cl::float3 boxMin = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()},
-                 boxMax = {std::numeric_limits<float>::min(), std::numeric_limits<float>::min(), std::numeric_limits<float>::min()};
+                 boxMax = {std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
       for(const auto corner: corners(boxes[whichBox]))
       {
-        boxMin = ::vecMin(boxMin, corner);
-        boxMax = ::vecMax(boxMax, corner);
+        boxMin = cl::min(boxMin, corner);
+        boxMax = cl::max(boxMax, corner);
       }
 
       const cl::float3 distToBoxMin = boxMin - min,
                        distToBoxMax = boxMax - min;
+
+      //A plaza or a highway could be in hundreds of cells.  It's cheaper to test it once per ray
+      //than to copy its index into every one of those cells and maybe test it in each of them.
+      const int xBegin = distToBoxMin.x/size.cellSize.x, xEnd = std::ceil(distToBoxMax.x/size.cellSize.x),
+                yBegin = distToBoxMin.z/size.cellSize.y, yEnd = std::ceil(distToBoxMax.z/size.cellSize.y);
+      if(largeThreshold > 0 && (xEnd - xBegin) * (yEnd - yBegin) > largeThreshold)
+      {
+        largeBoxes.push_back(whichBox);
+        continue;
+      }
       
-      for(int xCell = distToBoxMin.x/size.cellSize.x; xCell < distToBoxMax.x/size.cellSize.x; ++xCell)
+      for(int xCell = xBegin; xCell < xEnd; ++xCell)
       {
-        for(int yCell = distToBoxMin.z/size.cellSize.y; yCell < distToBoxMax.z/size.cellSize.y; ++yCell)
+        for(int yCell = yBegin; yCell < yEnd; ++yCell)
         {
-          const int whichCell = xCell + yCell*size.max.x; //See comments about size.max.y above
+          const int whichCell = grid_cellIndex(size, cl::int2{xCell, yCell});
 
           //Check for logic errors only in debug builds
           assert(xCell < size.max.x && "Got a corner outside of size.max.x!  Grid construction failed.");
@@ -426,20 +712,144 @@ namespace app
       }
     }
 
+    return boxesInEachCell;
+  }
+
+  //Group a collection of boxes into 2D gridCells.  Returns the grid's size, the gridCells, and
+  //the indices into the box collection that are sorted to be compatible with the container of
+  //gridCells.
+  //TODO: When I'm ready for a grid optimizer, I need to split this up into:
+  //      1) Get grid min/max and origin
+  //      2) Decide number of grid cells along each axis
+  //      3) Put boxes into grid cells
+  std::tuple<grid, std::vector<gridCell>, std::vector<int>> Geometry::buildGrid(const std::vector<aabb>& boxes, const cl::int2 nCells,
+                                                                                const int largeThreshold, std::atomic<float>* progress)
+  {
+    grid size;
+    std::vector<int> boxIndices;
+    std::vector<int> largeBoxes; //Boxes that would be in more than largeThreshold cells
+
+    //First, choose size: origin, max, and cellSize.  I could choose origin and max * cellSize
+    //by looking at a 2D bounding area for boxes.  cellSize should be optimized somehow to maximize
+    //performance.  Maybe I could start with a minimum or maximum number of boxes per cell.
+    //Eventually, this could be a good opportunity for real-time optimization.
+    auto [min, max] = calcGridLimits(boxes);
+
+    size.origin = {min.x, min.z};
+
+    //Next, group boxes into cells.  The std::set<> makes sure each box can be in each cell only once.
+    //TODO: Do I even need a std::set<> anymore?  I should now loop over each cell once
+    //Cells are stored in the order from grid_cellIndex() which has some padding.
+    //A gridCell can only count GRIDCELL_MAX_COUNT boxes, and the default 1x1 grid runs out
+    //after a few city blocks.  Split every cell in 4 until the fullest cell fits.
+    std::vector<std::set<int>> boxesInEachCell;
+    size_t lastFullest = std::numeric_limits<size_t>::max();
+    for(cl::int2 cellsNow = nCells;; cellsNow = cl::int2{cellsNow.x * 2, cellsNow.y * 2})
+    {
+      size.max = cellsNow;
+      size.cellSize = {(max.x - min.x)/size.max.x, (max.z - min.z)/size.max.y};
+      boxesInEachCell = fillGrid(boxes, size, min, largeThreshold, largeBoxes, progress);
+
+      size_t fullest = 0;
+      for(const auto& cell: boxesInEachCell) fullest = std::max(fullest, cell.size());
+      if(fullest <= GRIDCELL_MAX_COUNT) break;
+
+      //Boxes that all overlap the same spot won't ever fit.  Splitting cells further would just run out of memory.
+      if(fullest >= lastFullest || cellsNow.x * 2 > maxCellsPerSide || cellsNow.y * 2 > maxCellsPerSide)
+      {
+        throw exception("A grid cell has " + std::to_string(fullest) + " boxes even with " + std::to_string(cellsNow.x) + "x"
+                        + std::to_string(cellsNow.y) + " cells, but a cell can only have " + std::to_string(GRIDCELL_MAX_COUNT)
+                        + ".  Are lots of boxes on top of each other?");
+      }
+      lastFullest = fullest;
+    }
+
+    //Boxes that are in more than one cell can be intersected more than once by the same ray.
+    //The device remembers intersections with these boxes, so put them first in each cell.
+    std::vector<int> nCellsPerBox(boxes.size(), 0);
+    for(const auto& cell: boxesInEachCell)
+    {
+      for(const auto whichBox: cell) ++nCellsPerBox[whichBox];
+    }
+
+    //Large boxes go first in the list of indices.
+    boxIndices = largeBoxes;
+    size.largeBoxes = {0, (int)largeBoxes.size()};
+
     //Then, put boxes into contiguous memory.  Create a record of where this memory is in
-    //each gridCell so that I can find it later on the GPU.
+    //each gridCell so that I can find it later on the GPU.  Cells with 1 or 2 boxes keep
+    //them in the gridCell itself and don't need any indices at all.
     std::vector<gridCell> cells(boxesInEachCell.size());
     for(size_t whichCell = 0; whichCell < boxesInEachCell.size(); ++whichCell)
     {
-      cells[whichCell].begin = boxIndices.size();
-      boxIndices.insert(boxIndices.end(), boxesInEachCell[whichCell].begin(), boxesInEachCell[whichCell].end());
-      cells[whichCell].end = boxIndices.size();
+      const auto& inCell = boxesInEachCell[whichCell];
+      if(inCell.size() == 1 || inCell.size() == 2)
+      {
+        cells[whichCell] = gridCell_inline(*inCell.begin(), (inCell.size() == 2)?*std::next(inCell.begin()):-1);
+        continue;
+      }
+
+      const int begin = boxIndices.size();
+      boxIndices.insert(boxIndices.end(), inCell.begin(), inCell.end());
+
+      const auto firstUnshared = std::stable_partition(boxIndices.begin() + begin, boxIndices.end(),
+                                                       [&nCellsPerBox](const int whichBox) { return nCellsPerBox[whichBox] > 1; });
+      cells[whichCell] = gridCell_list(begin, inCell.size(), std::distance(boxIndices.begin() + begin, firstUnshared));
     }
 
     return std::make_tuple(size, cells, boxIndices);
   }
 
-  void Geometry::sendToGPU(cl::Context& ctx)
+  //Order boxes on the device by the first time the grid refers to them.  Large boxes come first,
+  //and the rest of the grid is already in Morton order.  Boxes stored directly in gridCells
+  //count too.  So, boxes in nearby cells end up nearby
+  //in memory.
+  std::vector<int> Geometry::layoutBoxes(const size_t nBoxes, const grid& size, const std::vector<gridCell>& cells, const std::vector<int>& indices)
+  {
+    std::vector<int> deviceToHost;
+    deviceToHost.reserve(nBoxes);
+    std::vector<bool> placed(nBoxes, false);
+
+    const auto place = [&placed, &deviceToHost](const int whichBox)
+                       {
+                         if(!placed[whichBox])
+                         {
+                           placed[whichBox] = true;
+                           deviceToHost.push_back(whichBox);
+                         }
+                       };
+
+    for(int whichIndex = size.largeBoxes.x; whichIndex < size.largeBoxes.y; ++whichIndex) place(indices[whichIndex]);
+    for(const auto& cell: cells)
+    {
+      for(int which = 0; which < gridCell_count(cell); ++which) place(gridCell_volume(cell, indices.data(), which));
+    }
+
+    //Boxes outside the grid shouldn't happen, but make sure every box gets uploaded anyway
+    for(size_t whichBox = 0; whichBox < nBoxes; ++whichBox)
+    {
+      if(!placed[whichBox]) deviceToHost.push_back(whichBox);
+    }
+
+    return deviceToHost;
+  }
+
+  bool Geometry::layoutIsCurrent() const
+  {
+    //Editing materials, the sun, or the sky doesn't move any boxes, so those edits don't rebuild
+    //the grid.  A grid that's being built in the background for boxes that haven't moved since
+    //will be swapped in by updateRebuild(), so it doesn't make the grid on the device stale.
+    return !fFromScene && !fBoxesMoved && fBoxes.size() == front().boxes.host().size() && fDeviceToHost.size() == fBoxes.size()
+           && fRequestedCells.x == fPreparedGrid.x && fRequestedCells.y == fPreparedGrid.y && fLargeBoxThreshold == fPreparedThreshold;
+  }
+
+  void Geometry::prepare()
+  {
+    if(!layoutIsCurrent()) rebuildNow();
+    placeSun();
+  }
+
+  void Geometry::rebuildNow()
   {
     //Update fSky and fGroundTexNorm to include all buildings.
     //If this ever becomes slow, I can think of lots of ways to speed it up.
@@ -448,11 +858,39 @@ namespace app
     //this loop would be limited by I/O into L2 cache if I tried to do SIMD
     //math.
     //TODO: Keep the apparent size of the sun the same when fSky grows?
-    for(const auto& box: fBoxes)
+    fBoxesRadius = ::farthestCorner(fBoxes);
+
+    //A grid that's still being built in the background is for older boxes.  It would replace
+    //this one when it's done.
+    fRebuild.reset();
+    fRebuildAgain = false;
+
+    //A scene file that hasn't been uploaded yet already has a grid for exactly these boxes
+    if(!fFromScene) std::tie(fGridSize, fGridCells, fBoxIndices) = buildGrid(fBoxes, fRequestedCells, fLargeBoxThreshold); //TODO: Provide number of grid cells which could come from a user interface
+    fQuery = GridQuery(fBoxes, fGridSize, fGridCells, fBoxIndices);
+    fPreparedGrid = fRequestedCells;
+    fPreparedThreshold = fLargeBoxThreshold;
+
+    //Boxes on the device are in a different order from fBoxes so that boxes in nearby
+    //cells are nearby in memory.  fBoxes and fBoxIndices stay in the host's order so
+    //that select() and write() don't have to know about this.  A scene file is already in the
+    //order that the next sendToGPU() uploads.
+    if(fFromScene)
     {
-      const auto corners = ::corners(box);
-      for(const auto& corner: corners) fSky.radius = std::max(fSky.radius, corner.mag());
+      fDeviceToHost.resize(fBoxes.size());
+      std::iota(fDeviceToHost.begin(), fDeviceToHost.end(), 0);
     }
+    else fDeviceToHost = layoutBoxes(fBoxes.size(), fGridSize, fGridCells, fBoxIndices);
+    fHostToDevice.resize(fDeviceToHost.size());
+    for(size_t whichBox = 0; whichBox < fDeviceToHost.size(); ++whichBox) fHostToDevice[fDeviceToHost[whichBox]] = whichBox;
+    fLayoutChanged = true;
+    fBoxesMoved = false;
+    fChangedBoxes.clear(); //Uploading the whole layout covers them
+  }
+
+  void Geometry::placeSun()
+  {
+    fSky.radius = std::max(fSky.radius, fBoxesRadius);
 
     //Force the ground plane to cover the equator of fSky
     //TODO: Do I want to stretch the ground plane like this automatically?
@@ -461,19 +899,232 @@ namespace app
     //Force the sun to have a center on fSky
     const auto sunDir = fSun.center.norm();
     fSun.center = sunDir * fSky.radius;
+  }
+
+  bool Geometry::rebuildMatches() const
+  {
+    //Boxes that changed without moving don't change the grid.  updateRebuild() uploads them again.
+    const auto& job = *fRebuild;
+    return !fBoxesMoved && job.boxes.size() == fBoxes.size() && job.requestedCells.x == fRequestedCells.x
+           && job.requestedCells.y == fRequestedCells.y && job.threshold == fLargeBoxThreshold;
+  }
 
-    std::tie(fGridSize, fGridCells, fBoxIndices) = buildGrid(fBoxes, fGridSize.max); //TODO: Provide number of grid cells which could come from a user interface
+  void Geometry::boxChanged(const int whichBox, const bool moved)
+  {
+    if(moved) fBoxesMoved = true;
+    else
+    {
+      fChangedBoxes.push_back(whichBox);
+      if(fRebuild) fRebuild->touched.push_back(whichBox); //The worker already copied the old version
+    }
+  }
+
+  void Geometry::patchBoxes(cl::CommandQueue& queue, deviceGrid& target, const std::vector<int>& changed)
+  {
+    std::vector<std::pair<size_t, aabb>> devBoxes;
+    for(const int whichBox: changed)
+    {
+      //Boxes that aren't on the device yet get uploaded with the next grid
+      if(whichBox < (int)fHostToDevice.size()) devBoxes.emplace_back(fHostToDevice[whichBox], fBoxes[whichBox]);
+    }
+    target.boxes.patch(queue, std::move(devBoxes));
+  }
+
+  void Geometry::rebuildInBackground()
+  {
+    //A worker that's already building a grid for exactly these boxes will finish soon enough.
+    //Otherwise, build another grid as soon as it's done.
+    if(fRebuild)
+    {
+      if(!rebuildMatches()) fRebuildAgain = true;
+      return;
+    }
+
+    fRebuild = std::make_unique<rebuild>();
+    fRebuild->boxes = fBoxes;
+    fRebuild->requestedCells = fRequestedCells;
+    fRebuild->threshold = fLargeBoxThreshold;
+    fBoxesMoved = false;
+
+    //The worker only touches its own rebuild, so it doesn't care whether this Geometry gets moved
+    fRebuild->worker = std::thread([job = fRebuild.get()]
+                                   {
+                                     try
+                                     {
+                                       std::tie(job->size, job->cells, job->indices) = buildGrid(job->boxes, job->requestedCells, job->threshold, &job->progress);
+                                     }
+                                     catch(const exception&)
+                                     {
+                                       job->error = std::current_exception();
+                                       job->done = true;
+                                       return;
+                                     }
+                                     job->query = GridQuery(job->boxes, job->size, job->cells, job->indices);
+                                     job->progress = 0.9f;
+
+                                     job->deviceToHost = layoutBoxes(job->boxes.size(), job->size, job->cells, job->indices);
+                                     job->hostToDevice.resize(job->deviceToHost.size());
+                                     for(size_t whichBox = 0; whichBox < job->deviceToHost.size(); ++whichBox) job->hostToDevice[job->deviceToHost[whichBox]] = whichBox;
+                                     std::tie(job->devBoxes, job->devIndices, job->devCells) = deviceArrays(job->boxes, job->deviceToHost, job->hostToDevice,
+                                                                                                            job->indices, job->cells);
+                                     job->radius = ::farthestCorner(job->boxes);
+
+                                     job->progress = 1.f;
+                                     job->done = true;
+                                   });
+  }
+
+  bool Geometry::updateRebuild(cl::Context& ctx, cl::CommandQueue& queue)
+  {
+    if(!fRebuild || !fRebuild->done) return false;
+    auto& job = *fRebuild;
+
+    //The render thread can't catch what the worker throws
+    if(job.error)
+    {
+      const auto error = job.error;
+      fRebuild.reset();
+      fRebuildAgain = false;
+      fBoxesMoved = true; //The device still has the last grid
+      std::rethrow_exception(error);
+    }
+
+    //Boxes changed while the worker was busy.  Its grid would be missing those changes, so start over.
+    if(fRebuildAgain || !rebuildMatches())
+    {
+      fRebuild.reset();
+      fRebuildAgain = false;
+      rebuildInBackground();
+      return false;
+    }
+
+    deviceGrid& back = fDevGrids[1 - fFront];
+    if(!job.uploading)
+    {
+      //Fill the spare set on its own queue so that kernels on queue don't wait for it.  Kernels that were
+      //enqueued before the last swap might still be reading it.
+      if(!fUploadQueue()) fUploadQueue = cl::CommandQueue(ctx, queue.getInfo<CL_QUEUE_DEVICE>());
+      std::vector<cl::Event> waitFor;
+      if(fBackReleased()) waitFor.push_back(fBackReleased);
+
+      uploadArrays(ctx, fUploadQueue, back, job.devBoxes.data(), job.devBoxes.data() + job.devBoxes.size(), job.devIndices.data(),
+                   job.devIndices.data() + job.devIndices.size(), job.devCells.data(), job.devCells.data() + job.devCells.size(),
+                   waitFor.empty()?nullptr:&waitFor);
+      fUploadQueue.flush();
+      job.uploading = true;
+      return false;
+    }
+    if(!back.uploaded()) return false;
+
+    //Swap at a frame boundary.  Everything on the host that refers to the device's order of boxes
+    //changes at the same time.
+    fFront = 1 - fFront;
+    fGridSize = job.size;
+    fGridCells = std::move(job.cells);
+    fBoxIndices = std::move(job.indices);
+    fQuery = std::move(job.query);
+    fDeviceToHost = std::move(job.deviceToHost);
+    fHostToDevice = std::move(job.hostToDevice);
+    fBoxesRadius = job.radius;
+    fPreparedGrid = job.requestedCells;
+    fPreparedThreshold = job.threshold;
+    fLayoutChanged = false;
+    patchBoxes(queue, fDevGrids[fFront], job.touched);
+    fRebuild.reset();
+    placeSun();
+
+    //Everything enqueued so far might read the set that's now spare
+    queue.enqueueMarkerWithWaitList(nullptr, &fBackReleased);
+    return true;
+  }
 
+  std::tuple<std::vector<aabb>, std::vector<int>, std::vector<gridCell>> Geometry::deviceArrays(const std::vector<aabb>& boxes,
+                                                                                                const std::vector<int>& deviceToHost,
+                                                                                                const std::vector<int>& hostToDevice,
+                                                                                                const std::vector<int>& indices,
+                                                                                                const std::vector<gridCell>& cells)
+  {
+    std::vector<aabb> devBoxes(boxes.size());
+    for(size_t whichBox = 0; whichBox < deviceToHost.size(); ++whichBox) devBoxes[whichBox] = boxes[deviceToHost[whichBox]];
+
+    std::vector<int> devBoxIndices(indices.size());
+    std::transform(indices.begin(), indices.end(), devBoxIndices.begin(), [&hostToDevice](const int whichBox) { return hostToDevice[whichBox]; });
+
+    //Boxes stored directly in gridCells need the device's order too
+    std::vector<gridCell> devCells(cells);
+    for(auto& cell: devCells)
+    {
+      if(!gridCell_isInline(cell)) continue;
+      const int second = (gridCell_count(cell) > 1)?hostToDevice[gridCell_volume(cell, nullptr, 1)]:-1;
+      cell = gridCell_inline(hostToDevice[gridCell_volume(cell, nullptr, 0)], second);
+    }
+
+    return std::make_tuple(devBoxes, devBoxIndices, devCells);
+  }
+
+  void Geometry::sendToGPU(cl::Context& ctx, cl::CommandQueue& queue, const bool background)
+  {
+    //Building a grid for a big city takes a while.  Keep rendering the last grid while a worker
+    //builds the new one unless there is no last grid.
+    if(!layoutIsCurrent())
+    {
+      if(background && !fFromScene && front().boxes.buffer()()) rebuildInBackground();
+      else rebuildNow();
+    }
+    placeSun();
+
+    if(fFromScene)
+    {
+      //A scene file that was just loaded is already in the device's order.  Upload it as it is
+      //instead of rearranging another copy of it.
+      uploadArrays(ctx, queue, fDevGrids[fFront], fBoxes.data(), fBoxes.data() + fBoxes.size(), fBoxIndices.data(),
+                   fBoxIndices.data() + fBoxIndices.size(), fGridCells.data(), fGridCells.data() + fGridCells.size());
+      fFromScene = false;
+    }
+    else if(fLayoutChanged)
+    {
+      const auto [devBoxes, devBoxIndices, devCells] = deviceArrays();
+      uploadArrays(ctx, queue, fDevGrids[fFront], devBoxes.data(), devBoxes.data() + devBoxes.size(), devBoxIndices.data(),
+                   devBoxIndices.data() + devBoxIndices.size(), devCells.data(), devCells.data() + devCells.size());
+    }
+    else if(!fChangedBoxes.empty()) patchBoxes(queue, fDevGrids[fFront], fChangedBoxes);
+    fLayoutChanged = false;
+    fChangedBoxes.clear();
+
+    fDevMaterials.upload(ctx, queue, fMaterials.data(), fMaterials.data() + fMaterials.size());
+    if(!fDevSkyMap()) fDevSkyMap = cl::Image2D(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_FLOAT),
+                                                2*fSkyMapSize, fSkyMapSize, 0, fSkyMap.data());
+
+    fTextures->sendToGPU(ctx);
+  }
+
+  void Geometry::uploadArrays(cl::Context& ctx, cl::CommandQueue& queue, deviceGrid& target, const aabb* boxesBegin, const aabb* boxesEnd,
+                              const int* indicesBegin, const int* indicesEnd, const gridCell* cellsBegin, const gridCell* cellsEnd,
+                              const std::vector<cl::Event>* waitFor)
+  {
     //Synchronize GPU data with the CPU
-    //fGridSize = size;
-    fDevBoxes = cl::Buffer(ctx, fBoxes.begin(), fBoxes.end(), false);
-    fDevMaterials = cl::Buffer(ctx, fMaterials.begin(), fMaterials.end(), false);
-    fDevGridIndices = cl::Buffer(ctx, fBoxIndices.begin(), fBoxIndices.end(), false);
-    fDevGridCells = cl::Buffer(ctx, fGridCells.begin(), fGridCells.end(), false);
+    target.boxes.upload(ctx, queue, boxesBegin, boxesEnd, waitFor);
+
+    //The device intersects boxes as min and max corners.  The host keeps editing fBoxes.
+    std::vector<aabbBounds> bounds(boxesEnd - boxesBegin);
+    std::transform(boxesBegin, boxesEnd, bounds.begin(), aabb_bounds);
+    target.bounds.upload(ctx, queue, bounds.data(), bounds.data() + bounds.size(), waitFor);
+
+    target.indices.upload(ctx, queue, indicesBegin, indicesEnd, waitFor);
+
+    //Scenes with few enough boxes can use kernels that read half as much memory per index
+    if((size_t)(boxesEnd - boxesBegin) <= (size_t)std::numeric_limits<cl_ushort>::max() + 1)
+    {
+      const std::vector<cl_ushort> devBoxIndices16(indicesBegin, indicesEnd);
+      target.indices16.upload(ctx, queue, devBoxIndices16.data(), devBoxIndices16.data() + devBoxIndices16.size(), waitFor);
+    }
+    else target.indices16.reset();
+    target.cells.upload(ctx, queue, cellsBegin, cellsEnd, waitFor);
+  }
 
-    glBindTexture(GL_TEXTURE_2D_ARRAY, fTextures->name);
-    fDevTextures = cl::ImageGL(ctx, CL_MEM_READ_ONLY, GL_TEXTURE_2D_ARRAY, 0, fTextures->name);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  size_t Geometry::nInlineCells() const
+  {
+    return std::count_if(fGridCells.begin(), fGridCells.end(), gridCell_isInline);
   }
 
   //Returning std::unique_ptr<> because I couldn't get std::optional<> to do what I want.
@@ -491,9 +1142,12 @@ namespace app
     else if(skyDist > 0) closest = std::min(groundDist, skyDist);
     else closest = groundDist;
 
-    //Find the closest box that is closer than sky/ground if any.
+    //Find the closest box that is closer than sky/ground if any.  The grid is from the last
+    //time I prepare()d, so it doesn't know about boxes that were added since then.
     size_t found = fBoxes.size();
-    for(size_t whichBox = 0; whichBox != fBoxes.size(); ++whichBox)
+    const int hit = fQuery.closest(fromCamera, closest);
+    if(hit >= 0) found = hit;
+    for(size_t whichBox = fQuery.nBoxes(); whichBox < fBoxes.size(); ++whichBox)
     {
       const auto dist = aabb_intersect(&fBoxes[whichBox], fromCamera);
       if(dist > 0 && dist < closest)
@@ -512,26 +1166,17 @@ namespace app
       fBoxes.push_back(aabb{cl::float3{0.1, 0.1, 0.1},
                             cl::float3{intersection.x, fFloorY, intersection.z},
                             cl::float3{0.1, 0.1, 0.1},
-                            fBoxes.empty()?SKY_TEXTURE:fBoxes.back().material});
+                            fBoxes.empty()?0:fBoxes.back().material});
+      fBoxesMoved = true;
     }
 
-    //Look up the grid index of this box
-    std::vector<cl::int2> cellsWithThisBox;
-    for(int xCell = 0; xCell < fGridSize.max.x; ++xCell)
-    {
-      for(int yCell = 0; yCell < fGridSize.max.y; ++yCell)
-      {
-        const int whichCell = xCell + yCell * fGridSize.max.x;
-        const auto begin = fBoxIndices.begin() + fGridCells[whichCell].begin,
-                   end = fBoxIndices.begin() + fGridCells[whichCell].end;
-
-
-        if(std::find(begin, end, found) != end) cellsWithThisBox.push_back({xCell, yCell});
-      }
-    }
+    return select((int)found);
+  }
 
+  std::unique_ptr<Geometry::selected> Geometry::select(const int whichBox)
+  {
     //TODO: return a transaction instead
-    return std::make_unique<selected>(selected{fBoxes[found], fMaterials[fBoxes[found].material], boxNames[found],
-                                               cellsWithThisBox});
+    return std::make_unique<selected>(selected{fBoxes[whichBox], fMaterials[fBoxes[whichBox].material], boxNames[whichBox],
+                                               fQuery.cellsOf(whichBox), whichBox});
   }
 }
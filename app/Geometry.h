@@ -11,7 +11,11 @@
 //c++ includes
 #include <exception>
 #include <vector>
+#include <set>
 #include <tuple>
+#include <array>
+#include <thread>
+#include <atomic>
 
 //OpenCL c++ API includes
 #include <CL/cl.hpp>
@@ -23,14 +27,19 @@
 #include "serial/material.h"
 #include "serial/aabb.h"
 #include "serial/sphere.h"
+#include "serial/octahedral.h"
 #include "serial/grid.h"
 #include "serial/gridCell.h"
+#include "serial/traversalStats.h"
 
 //camera includes
 #include "camera/CameraModel.h"
 
-//gl includes
-#include "gl/TextureArray.cpp"
+//app includes
+#include "app/TextureStreamer.h"
+#include "app/GridQuery.h"
+#include "app/StreamingLoader.h"
+#include "app/DeviceArray.h"
 
 //yaml-cpp includes
 #include "yaml-cpp/yaml.h"
@@ -45,29 +54,73 @@ namespace app
       //TODO: Initialize with default.yaml geometry
       Geometry() = default;
 
-      //Serialization and de-serialization
-      YAML::Node load(const int argc, const char** argv);
-      YAML::Node load(const std::string& fileName);
+      //interop is false when there's no OpenGL context, like in skyline-render.  Then textures
+      //live in plain OpenCL images.
+      explicit Geometry(const bool interop): fInterop(interop) {}
 
+      //Serialization and de-serialization.  load() reads binary SceneFiles too and returns an
+      //empty YAML::Node for them.  With stream, load() returns as soon as the first boxes are
+      //ready and keeps loading the rest of a YAML file in the background.  Take them with
+      //loadMore() or finishLoading().
+      YAML::Node load(const int argc, const char** argv, const bool stream = false);
+      YAML::Node load(const std::string& fileName, const bool stream = false);
+
+      //Add boxes that finished loading in the background since the last call.  Returns true
+      //if there are new boxes to send to the GPU.  References from select() are invalid after that.
+      bool loadMore();
+
+      //Wait for all of the boxes that are still loading and add them
+      void finishLoading();
+
+      inline bool loading() const { return fLoader != nullptr; }
+      inline float loadProgress() const { return fLoader?fLoader->progress():1.f; }
+
+      //write() and writeScene() throw an exception instead of leaving out boxes that are still loading
       YAML::Node write(const std::string& fileName);
 
+      //Write a binary SceneFile with a grid for the boxes as they are now.  Doesn't change the
+      //grid that kernels read or one that's being built in the background.
+      void writeScene(const std::string& fileName);
+
       //User perspectives on the current scene
       std::vector<std::pair<std::string, eng::CameraModel>> cameras;
 
       //Application handles to data on the GPU
-      inline const cl::Buffer& materials() const { return fDevMaterials; }
-      inline const cl::Buffer& boxes() const { return fDevBoxes; }
+      inline const cl::Buffer& materials() const { return fDevMaterials.buffer(); }
+      inline const cl::Buffer& boxes() const { return front().boxes.buffer(); }
+      inline const cl::Buffer& bounds() const { return front().bounds.buffer(); }
       inline sphere& sky() { return fSky; }
+      inline const cl::Image2D& skyMap() const { return fDevSkyMap; }
       inline sphere& sun() { return fSun; }
       inline cl::float2& groundTexNorm() { return fGroundTexNorm; }
       inline const std::string& groundFile() const { return groundTextureFile; }
       inline const std::string& skyFile() const { return skyTextureFile; }
       inline cl::float3& sunEmission() { return fSunEmission; }
-      inline const cl::ImageGL& textures() const { return fDevTextures; }
+      inline TextureStreamer& textures() { return *fTextures; }
       inline size_t nBoxes() const { return fBoxes.size(); }
-      inline grid& gridSize() { return fGridSize; }
-      inline const cl::Buffer& gridCells() const { return fDevGridCells; }
-      inline const cl::Buffer& gridIndices() const { return fDevGridIndices; }
+      inline int deviceToHost(const int deviceBox) const { return fDeviceToHost[deviceBox]; } //Index in fBoxes of a box on the device
+      inline const grid& gridSize() const { return fGridSize; } //The grid that kernels are reading right now
+      inline cl::int2& requestedGridCells() { return fRequestedCells; } //Grid cells for the next grid that's built
+      inline const cl::Buffer& gridCells() const { return front().cells.buffer(); }
+      inline const cl::Buffer& gridIndices() const { return front().indices.buffer(); }
+      inline const cl::Buffer& gridIndices16() const { return front().indices16.buffer(); } //Only if shortIndices()
+      inline bool shortIndices() const { return front().indices16.buffer()() != nullptr; } //Whether box indices fit in 16 bits
+      inline int& largeBoxThreshold() { return fLargeBoxThreshold; }
+      inline size_t nGridIndices() const { return fBoxIndices.size(); }
+      inline int nLargeBoxes() const { return fGridSize.largeBoxes.y - fGridSize.largeBoxes.x; }
+      inline size_t nGridCells() const { return fGridCells.size(); } //Including padding from grid_nCells()
+      size_t nInlineCells() const; //gridCells that store their boxes directly
+
+      //Group a collection of boxes into 2D gridCells.  Returns the grid's size, the gridCells, and
+      //the indices into the box collection that are sorted to be compatible with the container of
+      //gridCells.
+      //Boxes that would be in more than largeThreshold cells go into a separate list at the beginning of the
+      //box indices instead.  The grid has more than nCells cells if a cell would have more than
+      //GRIDCELL_MAX_COUNT boxes.  Throws an exception if it still doesn't fit with maxCellsPerSide.
+      //Static so that it can run on a worker thread.  Reports how far along it is in progress if that's not null.
+      static std::tuple<grid, std::vector<gridCell>, std::vector<int>> buildGrid(const std::vector<aabb>& boxes, const cl::int2 nCells,
+                                                                                 const int largeThreshold, std::atomic<float>* progress = nullptr);
+      static constexpr int maxCellsPerSide = 1024;
 
       //Custom exception class to explain why the command line couldn't be parsed.
       //TODO: Derive from app::exception?
@@ -85,10 +138,45 @@ namespace app
         material& mat;
         std::string& name;
         std::vector<cl::int2> gridCells;
+        int index; //In the host's order
       };
 
-      //Upload host-side state to the GPU
-      void sendToGPU(cl::Context& ctx);
+      //Update the sky, the sun, and the grid on the host after boxes change.  sendToGPU()
+      //calls this first.  Rendering on the CPU only needs this.  Doesn't rebuild the grid
+      //unless boxes or grid settings changed since the last upload.
+      void prepare();
+
+      //Upload host-side state to the GPU.  Only the parts of each array that changed since
+      //the last call are written, and writes are enqueued on queue without blocking.  Device
+      //buffers are only reallocated when they run out of room, so buffers from before this
+      //call are only still valid if nBoxes() and the grid didn't grow.  With background,
+      //a grid that has to be rebuilt is built on a worker thread instead, and kernels keep
+      //reading the last grid until updateRebuild() swaps in the new one.
+      void sendToGPU(cl::Context& ctx, cl::CommandQueue& queue, const bool background = false);
+
+      //Call once per frame before enqueueing kernels.  Uploads a grid that finished building in
+      //the background into the spare set of device buffers on a separate queue, and swaps the 2
+      //sets once the upload is done.  Returns true on the frame when kernels start reading a new
+      //grid.  Device indices like deviceToHost() change then too.  Throws an exception if the
+      //worker couldn't build a grid, and kernels keep reading the last one.
+      bool updateRebuild(cl::Context& ctx, cl::CommandQueue& queue);
+
+      inline bool rebuilding() const { return fRebuild != nullptr; }
+      inline float rebuildProgress() const { return fRebuild?fRebuild->progress.load():1.f; }
+      inline bool uploadingRebuild() const { return fRebuild && fRebuild->uploading; }
+
+      //Host-side copies of what sendToGPU() uploads for rendering on the CPU.  Boxes and grid
+      //indices are in the host's order, not the device's.
+      inline const std::vector<aabb>& hostBoxes() const { return fBoxes; }
+      inline const std::vector<material>& hostMaterials() const { return fMaterials; }
+      inline const std::vector<gridCell>& hostGridCells() const { return fGridCells; }
+      inline const std::vector<int>& hostGridIndices() const { return fBoxIndices; }
+      inline const std::vector<float>& hostSkyMap() const { return fSkyMap; }
+      inline int skyMapSize() const { return fSkyMapSize; }
+
+      //Spatial queries over the grid from the last prepare().  Box indices are in the host's order.
+      inline const GridQuery& query() const { return fQuery; }
+      inline const std::string& boxName(const int whichBox) const { return boxNames[whichBox]; }
 
       //TODO: Check whether the mouse is over the sun
       //bool isOverSun(const ray fromCamera);
@@ -97,6 +185,14 @@ namespace app
       //no such box, create a new one where this ray intersects fSkybox.
       std::unique_ptr<selected> select(const ray fromCamera);
 
+      //Select a box that's already in this Geometry by its index in the host's order
+      std::unique_ptr<selected> select(const int whichBox);
+
+      //Call after editing a box through select().  moved means its center or size changed, so
+      //the grid has to be rebuilt.  Other edits just upload that box again.  Boxes that no one
+      //reports are assumed to be the same as they were on the device.
+      void boxChanged(const int whichBox, const bool moved);
+
       //Read-only access to list of materials.  Useful for a GUI
       //to select a new material.
       //TODO: I'll need some other interface to add a new material.
@@ -111,15 +207,64 @@ namespace app
       std::vector<material> fMaterials;
       std::vector<aabb> fBoxes; //Buildings
       sphere fSky; //A dome over the city on which to render the sky
+      std::vector<float> fSkyMap; //RGBA octahedral map of the sky with mip levels packed to the right of the full-size map.
+                                  //It's twice as wide as it is tall.  See buildSkyMap() in Geometry.cpp.
+      int fSkyMapSize; //Height of fSkyMap in pixels.  Always a power of 2.
       sphere fSun; //The sun positioned in the sky
       grid fGridSize; //Parameters for the grid acceleration structure
       cl::float3 fSunEmission; //Color of light emitted by the sun
       cl::float2 fGroundTexNorm; //Convert a position on the ground to
                                  //texture coordinates.  Should be the
                                  //size of the ground.
-      std::unique_ptr<gl::TextureArray<GL_RGBA32F, GL_UNSIGNED_BYTE>> fTextures;
+      std::unique_ptr<TextureStreamer> fTextures; //Decodes textures when the kernel asks for them
       std::vector<gridCell> fGridCells; //Grid cells contain the boxes in fBoxes through a mapping defined in fBoxIndices.
       std::vector<int> fBoxIndices; //List of boxes in each of fGridCells.  These are indices into fBoxes.
+      int fLargeBoxThreshold; //Boxes that would be in more than this many grid cells are tested once per ray instead
+      cl::int2 fRequestedCells; //fGridSize.max for the next grid.  fGridSize is the grid on the device until then.
+      std::vector<int> fDeviceToHost; //Index in fBoxes of each box on the device.  Boxes are in a different order on the device.
+      std::vector<int> fHostToDevice; //Index on the device of each box in fBoxes
+      GridQuery fQuery; //Finds boxes on the host with the grid.  Rebuilt with the grid in prepare().
+      bool fLayoutChanged = true; //Whether prepare() rebuilt the grid since boxes and the grid were last uploaded
+      cl::int2 fPreparedGrid = cl::int2{0, 0}; //Grid cells and fLargeBoxThreshold when prepare() last built the grid
+      int fPreparedThreshold = -1;
+      float fBoxesRadius = 0; //Distance from the origin to the farthest corner of any box as of the last grid build
+      bool fBoxesMoved = true; //Whether any box moved, appeared, or disappeared since the last grid build started
+      std::vector<int> fChangedBoxes; //Boxes in the host's order that changed without moving since they were last uploaded
+
+      //A grid that's being built on a worker thread for a copy of fBoxes.  Everything here
+      //replaces the matching member of Geometry when updateRebuild() swaps it in.
+      struct rebuild
+      {
+        std::vector<aabb> boxes; //Copy of fBoxes in the host's order
+        cl::int2 requestedCells;
+        int threshold;
+
+        //Filled in by worker
+        grid size;
+        std::vector<gridCell> cells;
+        std::vector<int> indices;
+        GridQuery query;
+        std::vector<int> deviceToHost;
+        std::vector<int> hostToDevice;
+        float radius;
+        std::vector<aabb> devBoxes;
+        std::vector<int> devIndices;
+        std::vector<gridCell> devCells;
+        std::exception_ptr error; //What buildGrid() threw if it failed
+        std::vector<int> touched; //Boxes that changed without moving after boxes was copied.  Only used by the render thread.
+
+        std::atomic<float> progress{0.f};
+        std::atomic<bool> done{false};
+        bool uploading = false; //Whether the spare device buffers are being filled.  Only used by the render thread.
+        std::thread worker;
+
+        ~rebuild() { if(worker.joinable()) worker.join(); }
+      };
+      std::unique_ptr<rebuild> fRebuild;
+      bool fRebuildAgain = false; //Boxes changed since fRebuild copied them.  Start over when it's done.
+      std::unique_ptr<StreamingLoader> fLoader; //Converts boxes from a YAML file in the background until they're all taken
+      bool fFromScene = false; //Boxes and the grid were just read from a scene file in the device's order.  prepare() keeps
+                               //that grid and order, and the next sendToGPU() uploads them as they are.
 
       //Metadata with references to GPU-ready data
       std::string skyTextureFile;
@@ -127,28 +272,96 @@ namespace app
       std::map<std::string, int> nameToMaterialIndex;
       std::vector<std::string> boxNames; //I chose to use parallel arrays because I need fBoxes to be tightly packed
                                          //for upload to the GPU.
-      std::vector<std::string> textureNames; //Names of files where I got textures that are now on the GPU.  Index in this array is index in
-                                             //the texture array on the GPU.
+      std::vector<std::string> textureNames; //Names of files where I get textures.  Index in this array is the texture id that
+                                             //materials refer to.  See fTextures for where that texture is on the GPU.
+      cl::int2 fTextureSize; //Textures are resampled to this size on the GPU
+      cl::int2 fTexturesResident; //Number of full-size and coarse textures that fit on the GPU at once
 
       //Data to help create new boxes
       float fFloorY; //Height of the bottom of fSkybox in global coordinates
 
-      //Data on the GPU
-      cl::Buffer fDevMaterials;
-      cl::Buffer fDevBoxes;
-      cl::ImageGL fDevTextures;
-      cl::Buffer fDevGridCells;
-      cl::Buffer fDevGridIndices; //N.B.: fGridIndices are necessary so that each gridCell can refer to a contiguous range of elements
-                               //      and multiple gridCells can refer to a given box.
+      bool fInterop = true; //Whether textures are shared with OpenGL
+
+      //Data on the GPU.  Each DeviceArray keeps a host copy of what it uploaded so that
+      //sendToGPU() only writes what changed.
+      DeviceArray<material> fDevMaterials;
+      cl::Image2D fDevSkyMap;
+
+      //Everything on the GPU that has to match the grid.  There are 2 sets so that a grid built
+      //in the background can be uploaded while kernels read the other one.
+      struct deviceGrid
+      {
+        DeviceArray<aabb> boxes; //In the device's order
+        DeviceArray<aabbBounds> bounds; //boxes converted to a faster format for intersection tests
+        DeviceArray<gridCell> cells;
+        DeviceArray<int> indices; //N.B.: fGridIndices are necessary so that each gridCell can refer to a contiguous range of elements
+                                  //      and multiple gridCells can refer to a given box.
+        DeviceArray<cl_ushort> indices16; //indices as cl_ushort for kernels built with -DBOX_INDEX_16
+
+        inline bool uploaded() const { return boxes.uploaded() && bounds.uploaded() && cells.uploaded() && indices.uploaded() && indices16.uploaded(); }
+      };
+      std::array<deviceGrid, 2> fDevGrids;
+      int fFront = 0; //Index in fDevGrids of the set that kernels read
+      inline const deviceGrid& front() const { return fDevGrids[fFront]; }
+      cl::CommandQueue fUploadQueue; //Fills the spare set in fDevGrids without holding up kernels
+      cl::Event fBackReleased; //Kernels that might read the spare set are done after this
 
       //Helper functions
-      //Group a collection of boxes into 2D gridCells.  Returns the grid's size, the gridCells, and
-      //the indices into the box collection that are sorted to be compatible with the container of
-      //gridCells.
-      std::tuple<grid, std::vector<gridCell>, std::vector<int>> buildGrid(const std::vector<aabb>& boxes, const cl::int2 nCells);
+      //Put each of boxes into the cells of size that it overlaps.  Boxes in more than largeThreshold cells
+      //go into largeBoxes instead.
+      static std::vector<std::set<int>> fillGrid(const std::vector<aabb>& boxes, const grid& size, const cl::float3 min, const int largeThreshold,
+                                                 std::vector<int>& largeBoxes, std::atomic<float>* progress);
+
+      //Choose the order of nBoxes boxes on the device.  Returns the index of each box on the device in
+      //the host's order.
+      static std::vector<int> layoutBoxes(const size_t nBoxes, const grid& size, const std::vector<gridCell>& cells, const std::vector<int>& indices);
+
+      //Copies of boxes, indices, and cells in the device's order
+      static std::tuple<std::vector<aabb>, std::vector<int>, std::vector<gridCell>> deviceArrays(const std::vector<aabb>& boxes,
+                                                                                                 const std::vector<int>& deviceToHost,
+                                                                                                 const std::vector<int>& hostToDevice,
+                                                                                                 const std::vector<int>& indices,
+                                                                                                 const std::vector<gridCell>& cells);
+      inline std::tuple<std::vector<aabb>, std::vector<int>, std::vector<gridCell>> deviceArrays() const
+      {
+        return deviceArrays(fBoxes, fDeviceToHost, fHostToDevice, fBoxIndices, fGridCells);
+      }
+
+      //Upload boxes and the grid that are already in the device's order into target.  Writes
+      //wait for waitFor if it's not null.
+      void uploadArrays(cl::Context& ctx, cl::CommandQueue& queue, deviceGrid& target, const aabb* boxesBegin, const aabb* boxesEnd,
+                        const int* indicesBegin, const int* indicesEnd, const gridCell* cellsBegin, const gridCell* cellsEnd,
+                        const std::vector<cl::Event>* waitFor = nullptr);
+
+      //Whether the grid on the device is for fBoxes, fRequestedCells, and fLargeBoxThreshold
+      bool layoutIsCurrent() const;
+
+      //Build the grid and the device's order of boxes right now
+      void rebuildNow();
+
+      //Start building a grid on a worker thread unless one is already being built for the same boxes
+      void rebuildInBackground();
+
+      //Whether fRebuild was started with the same boxes and settings as this Geometry has now
+      bool rebuildMatches() const;
+
+      //Upload boxes in the host's order that changed without moving to target
+      void patchBoxes(cl::CommandQueue& queue, deviceGrid& target, const std::vector<int>& changed);
+
+      //Grow the sky to cover every box and put the sun on it
+      void placeSun();
+
+      //Read a SceneFile instead of YAML
+      void loadScene(const std::string& fileName);
+
+      //Build fSkyMap from skyTextureFile
+      void loadSky();
+
+      //Make fTextures from textureNames, fTextureSize, and fTexturesResident
+      void makeTextures();
 
       //Calculate the boundaries of a geometry of boxes.
-      std::pair<cl::float3, cl::float3> calcGridLimits(const std::vector<aabb>& boxes) const;
+      static std::pair<cl::float3, cl::float3> calcGridLimits(const std::vector<aabb>& boxes);
   };
 }
 
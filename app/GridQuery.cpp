@@ -0,0 +1,194 @@
+//File: GridQuery.cpp
+//Brief: A GridQuery answers questions about where boxes are on the host with the same
+//       grid that the kernel traverses.  Rays walk the grid cell by cell like
+//       intersectScene() does.  Regions loop over the cells they cover and report each
+//       box in the first of those cells that it's in.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//app includes
+#include "app/GridQuery.h"
+
+//c++ includes
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+namespace app
+{
+  GridQuery::GridQuery(const std::vector<aabb>& boxes, const grid& size, const std::vector<gridCell>& cells,
+                       const std::vector<int>& indices): fSize(size), fBounds(boxes.size()), fCells(cells), fIndices(indices),
+                                                         fLargeBoxes(indices.begin() + size.largeBoxes.x, indices.begin() + size.largeBoxes.y),
+                                                         fCellRanges(boxes.size(), cl::int4{0, 0, 0, 0})
+  {
+    std::transform(boxes.begin(), boxes.end(), fBounds.begin(), aabb_bounds);
+
+    //Read the reverse index back out of the grid itself so that it always agrees with buildGrid()
+    std::vector<bool> inAnyCell(boxes.size(), false);
+    for(int xCell = 0; xCell < fSize.max.x; ++xCell)
+    {
+      for(int yCell = 0; yCell < fSize.max.y; ++yCell)
+      {
+        const gridCell cell = fCells[grid_cellIndex(fSize, cl::int2{xCell, yCell})];
+        for(int which = 0; which < gridCell_count(cell); ++which)
+        {
+          const int box = gridCell_volume(cell, fIndices.data(), which);
+          cl::int4& range = fCellRanges[box];
+          if(!inAnyCell[box]) range = cl::int4{xCell, yCell, xCell + 1, yCell + 1};
+          else range = cl::int4{std::min(range.x, xCell), std::min(range.y, yCell), std::max(range.z, xCell + 1), std::max(range.w, yCell + 1)};
+          inAnyCell[box] = true;
+        }
+      }
+    }
+  }
+
+  int GridQuery::closest(const ray& thisRay, float& dist) const
+  {
+    const cl::float3 invDir{1.f/thisRay.direction.x, 1.f/thisRay.direction.y, 1.f/thisRay.direction.z};
+    int found = -1;
+    const auto test = [this, &thisRay, &invDir, &dist, &found](const int box)
+                      {
+                        const float boxDist = aabbBounds_intersect(fBounds[box], thisRay.position, invDir);
+                        if(boxDist > 0 && boxDist < dist)
+                        {
+                          dist = boxDist;
+                          found = box;
+                        }
+                      };
+
+    for(const int box: fLargeBoxes) test(box);
+
+    //Find where thisRay enters the grid
+    cl::int2 whichCell = positionToCell(fSize, thisRay.position);
+    const auto inGrid = [this](const cl::int2 cell) { return cell.x >= 0 && cell.y >= 0 && cell.x < fSize.max.x && cell.y < fSize.max.y; };
+    if(!inGrid(whichCell))
+    {
+      const float distToGrid = grid_intersect(fSize, thisRay);
+      if(distToGrid <= 0 || distToGrid >= dist) return found;
+      whichCell = positionToCell(fSize, thisRay.position + thisRay.direction * (distToGrid + 0.001f));
+    }
+
+    //Same walk as intersectScene() in kernels/skyline.cl
+    cl::float2 distToNext = distToCellEdge(fSize, thisRay, whichCell);
+    const cl::float2 betweenCells = distBetweenCells(fSize, thisRay);
+    while(inGrid(whichCell))
+    {
+      const gridCell cell = fCells[grid_cellIndex(fSize, whichCell)];
+      for(int which = 0; which < gridCell_count(cell); ++which) test(gridCell_volume(cell, fIndices.data(), which));
+
+      const float nextCellDist = std::min(distToNext.x, distToNext.y);
+      if(dist <= nextCellDist) break;
+
+      if(distToNext.x <= nextCellDist)
+      {
+        whichCell.x += (thisRay.direction.x < 0.f)?-1:1;
+        distToNext.x += betweenCells.x;
+      }
+      if(distToNext.y <= nextCellDist)
+      {
+        whichCell.y += (thisRay.direction.z < 0.f)?-1:1;
+        distToNext.y += betweenCells.y;
+      }
+    }
+
+    return found;
+  }
+
+  std::vector<int> GridQuery::inRectangle(const cl::float2 min, const cl::float2 max) const
+  {
+    cl::int2 first, last;
+    const auto test = [this, min, max](const int box)
+                      {
+                        const aabbBounds& bounds = fBounds[box];
+                        return bounds.max.x >= min.x && bounds.min.x <= max.x && bounds.max.z >= min.y && bounds.min.z <= max.y;
+                      };
+    if(!cellRange(min, max, first, last)) return inCells(cl::int2{0, 0}, cl::int2{-1, -1}, test);
+    return inCells(first, last, test);
+  }
+
+  std::vector<int> GridQuery::inRadius(const cl::float2 center, const float radius) const
+  {
+    cl::int2 first, last;
+    const auto test = [this, center, radius](const int box)
+                      {
+                        //Distance from center to the closest point in the box's footprint
+                        const aabbBounds& bounds = fBounds[box];
+                        const float dx = std::max({bounds.min.x - center.x, 0.f, center.x - bounds.max.x}),
+                                    dz = std::max({bounds.min.z - center.y, 0.f, center.y - bounds.max.z});
+                        return dx*dx + dz*dz <= radius*radius;
+                      };
+    if(!cellRange(center - cl::float2{radius, radius}, center + cl::float2{radius, radius}, first, last))
+    {
+      return inCells(cl::int2{0, 0}, cl::int2{-1, -1}, test);
+    }
+    return inCells(first, last, test);
+  }
+
+  std::vector<int> GridQuery::overlapping(const aabb& candidate, const int ignore) const
+  {
+    const aabbBounds bounds = aabb_bounds(candidate);
+    cl::int2 first, last;
+    const auto test = [this, &bounds, ignore](const int box)
+                      {
+                        const aabbBounds& other = fBounds[box];
+                        return box != ignore && bounds.min.x < other.max.x && bounds.max.x > other.min.x
+                                             && bounds.min.y < other.max.y && bounds.max.y > other.min.y
+                                             && bounds.min.z < other.max.z && bounds.max.z > other.min.z;
+                      };
+    if(!cellRange(cl::float2{bounds.min.x, bounds.min.z}, cl::float2{bounds.max.x, bounds.max.z}, first, last))
+    {
+      return inCells(cl::int2{0, 0}, cl::int2{-1, -1}, test);
+    }
+    return inCells(first, last, test);
+  }
+
+  std::vector<cl::int2> GridQuery::cellsOf(const int box) const
+  {
+    std::vector<cl::int2> cells;
+    if(box < 0 || box >= (int)fCellRanges.size()) return cells;
+
+    const cl::int4& range = fCellRanges[box];
+    for(int xCell = range.x; xCell < range.z; ++xCell)
+    {
+      for(int yCell = range.y; yCell < range.w; ++yCell) cells.push_back(cl::int2{xCell, yCell});
+    }
+    return cells;
+  }
+
+  template <class TEST>
+  std::vector<int> GridQuery::inCells(const cl::int2 first, const cl::int2 last, const TEST& test) const
+  {
+    std::vector<int> found;
+    for(const int box: fLargeBoxes)
+    {
+      if(test(box)) found.push_back(box);
+    }
+
+    for(int xCell = first.x; xCell <= last.x; ++xCell)
+    {
+      for(int yCell = first.y; yCell <= last.y; ++yCell)
+      {
+        const gridCell cell = fCells[grid_cellIndex(fSize, cl::int2{xCell, yCell})];
+        for(int which = 0; which < gridCell_count(cell); ++which)
+        {
+          //A box that's in several of these cells belongs to the first one in both x and y
+          const int box = gridCell_volume(cell, fIndices.data(), which);
+          const cl::int4& range = fCellRanges[box];
+          if(std::max(range.x, first.x) == xCell && std::max(range.y, first.y) == yCell && test(box)) found.push_back(box);
+        }
+      }
+    }
+
+    return found;
+  }
+
+  bool GridQuery::cellRange(const cl::float2 min, const cl::float2 max, cl::int2& first, cl::int2& last) const
+  {
+    const float firstX = std::floor((min.x - fSize.origin.x)/fSize.cellSize.x), lastX = std::floor((max.x - fSize.origin.x)/fSize.cellSize.x),
+                firstY = std::floor((min.y - fSize.origin.y)/fSize.cellSize.y), lastY = std::floor((max.y - fSize.origin.y)/fSize.cellSize.y);
+    if(lastX < 0 || lastY < 0 || firstX >= fSize.max.x || firstY >= fSize.max.y || fBounds.empty()) return false;
+
+    first = cl::int2{(int)std::max(firstX, 0.f), (int)std::max(firstY, 0.f)};
+    last = cl::int2{(int)std::min<float>(lastX, fSize.max.x - 1), (int)std::min<float>(lastY, fSize.max.y - 1)};
+    return true;
+  }
+}
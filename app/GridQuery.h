@@ -0,0 +1,85 @@
+//File: GridQuery.h
+//Brief: A GridQuery answers questions about where boxes are on the host with the same
+//       grid that the kernel traverses: the closest box along a ray, boxes in a
+//       rectangle or a circle on the ground, and boxes that a candidate box would
+//       overlap.  It also keeps the range of grid cells that each box is in, so
+//       nothing has to search every cell for a box.  Only visits the cells a query
+//       touches, so picking and region selection don't scale with the number of
+//       boxes in a city.  Geometry rebuilds its GridQuery whenever it rebuilds the
+//       grid.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_GRIDQUERY_H
+#define APP_GRIDQUERY_H
+
+//serial includes
+#define NOT_ON_DEVICE
+#include "serial/vector.h"
+#include "serial/ray.h"
+#include "serial/material.h"
+#include "serial/aabb.h"
+#include "serial/grid.h"
+#include "serial/gridCell.h"
+
+//c++ includes
+#include <vector>
+
+namespace app
+{
+  class GridQuery
+  {
+    public:
+      //No boxes at all
+      GridQuery() = default;
+
+      //boxes, cells, and indices come from Geometry::buildGrid() for the same boxes.  Copies
+      //what it needs.
+      GridQuery(const std::vector<aabb>& boxes, const grid& size, const std::vector<gridCell>& cells, const std::vector<int>& indices);
+
+      //Index of the closest box that thisRay hits closer than dist, or -1 if there isn't one.
+      //Sets dist to the distance to that box when it finds one.
+      int closest(const ray& thisRay, float& dist) const;
+
+      //Boxes whose footprints on the ground overlap the rectangle from min to max.  x and y
+      //are global x and z.
+      std::vector<int> inRectangle(const cl::float2 min, const cl::float2 max) const;
+
+      //Boxes whose footprints on the ground are within radius of center.  x and y are global
+      //x and z.
+      std::vector<int> inRadius(const cl::float2 center, const float radius) const;
+
+      //Boxes that candidate would overlap.  Boxes that only share a face with it don't count.
+      //Leave out ignore, like the box that candidate will replace.
+      std::vector<int> overlapping(const aabb& candidate, const int ignore = -1) const;
+
+      //Grid cells that a box is in.  Empty for boxes in the list of large boxes or that
+      //were added since this GridQuery was built.
+      std::vector<cl::int2> cellsOf(const int box) const;
+
+      inline size_t nBoxes() const { return fBounds.size(); }
+
+    private:
+      grid fSize;
+      std::vector<aabbBounds> fBounds; //In the same order as the boxes it was built from
+      std::vector<gridCell> fCells;
+      std::vector<int> fIndices;
+      std::vector<int> fLargeBoxes;
+
+      //Reverse index: first and one past the last grid cell in x and y that each box is in.
+      //buildGrid() puts a box in every cell of a rectangle, so this is all I need.  Boxes
+      //that aren't in any cell have an empty range.
+      std::vector<cl::int4> fCellRanges;
+
+      //Call found(box) once for each box in any cell from first to last inclusive that
+      //passes test(box).  Large boxes count too.  Uses fCellRanges to report each box
+      //once without remembering which boxes it already saw.
+      template <class TEST>
+      std::vector<int> inCells(const cl::int2 first, const cl::int2 last, const TEST& test) const;
+
+      //Grid cells that cover from min to max, clamped to the grid.  Returns false if they
+      //miss the grid entirely.
+      bool cellRange(const cl::float2 min, const cl::float2 max, cl::int2& first, cl::int2& last) const;
+  };
+}
+
+#endif //APP_GRIDQUERY_H
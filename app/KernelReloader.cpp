@@ -0,0 +1,155 @@
+//File: KernelReloader.cpp
+//Brief: A KernelReloader watches the kernel sources in a directory and
+//       rebuilds the program on a background thread when one of them
+//       changes.  The render thread keeps using the last program that
+//       built until the new one has built every variant it's using, so
+//       a typo in a kernel never stops the render loop.  Build logs are
+//       kept for the GUI.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//OpenCL includes
+#define __CL_ENABLE_EXCEPTIONS //OpenCL c++ API now throws exceptions
+#include <CL/cl.hpp>
+
+//app includes
+#include "app/KernelReloader.h"
+#include "app/LoadIntoCL.h"
+
+//c++ includes
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
+
+namespace app
+{
+  KernelReloader::KernelReloader(cl::Context& ctx, const cl::Device& device, const std::string& directory, const std::string& kernelFile,
+                                 const std::vector<std::string>& includes, const std::string& kernelName): fContext(ctx), fDevice(device),
+                                                                                                           fDirectory(directory), fKernelFile(kernelFile),
+                                                                                                           fIncludes(includes), fKernelName(kernelName),
+                                                                                                           fVariants(std::make_shared<KernelVariants>(ctx, device, readSource(kernelFile, includes, directory), kernelName)),
+                                                                                                           fReloads(0), fStop(false), fForce(false),
+                                                                                                           fBuilding(false), fWatcher(&KernelReloader::watch, this)
+  {
+  }
+
+  KernelReloader::~KernelReloader()
+  {
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fStop = true;
+    }
+    fWakeUp.notify_all();
+    fWatcher.join();
+  }
+
+  std::shared_ptr<KernelVariants> KernelReloader::variants() const
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fVariants;
+  }
+
+  void KernelReloader::setOptions(const std::vector<std::string>& options)
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fOptions = options;
+  }
+
+  void KernelReloader::reload()
+  {
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fForce = true;
+    }
+    fWakeUp.notify_all();
+  }
+
+  KernelReloader::status KernelReloader::getStatus() const
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    return status{fDirectory, fReloads, fBuilding, fLog};
+  }
+
+  void KernelReloader::watch()
+  {
+    long built = lastModified();
+
+    std::unique_lock<std::mutex> lock(fMutex);
+    while(!fStop)
+    {
+      fWakeUp.wait_for(lock, std::chrono::milliseconds(checkPeriod), [this] { return fStop || fForce; });
+      if(fStop) break;
+
+      //Checking the files doesn't need the lock
+      lock.unlock();
+      const long modified = lastModified();
+      lock.lock();
+
+      if(modified == built && !fForce) continue;
+      fForce = false;
+      built = modified;
+      const auto options = fOptions;
+
+      //Building takes seconds, so let the render thread keep going in the meantime.  Only this
+      //thread touches next until it's swapped in.
+      fBuilding = true;
+      lock.unlock();
+
+      std::shared_ptr<KernelVariants> next;
+      std::string log;
+      try
+      {
+        next = std::make_shared<KernelVariants>(fContext, fDevice, readSource(fKernelFile, fIncludes, fDirectory), fKernelName);
+        for(const auto& option: options) next->get(option);
+      }
+      catch(const KernelVariants::buildError& e)
+      {
+        log = e.what();
+      }
+      catch(const cl::Error& e)
+      {
+        log = "Got OpenCL error " + std::to_string(e.err()) + ": " + e.what() + "\n";
+      }
+
+      lock.lock();
+      fBuilding = false;
+      if(log.empty())
+      {
+        fVariants = next;
+        fLog.clear();
+        ++fReloads;
+        std::cout << "Reloaded " << fKernelFile << " from " << fDirectory << "\n";
+      }
+      else
+      {
+        fLog = log;
+        std::cerr << "Reloading " << fKernelFile << " failed, so I'm keeping the last program that built:\n" << log;
+      }
+    }
+  }
+
+  long KernelReloader::lastModified() const
+  {
+    long latest = 0;
+    std::error_code err; //A file that an editor is in the middle of saving might disappear while I look at it
+
+    for(const auto& subdir: {"kernels", "serial"})
+    {
+      const fs::path dir = fs::path(fDirectory) / subdir;
+      if(!fs::is_directory(dir, err)) continue;
+
+      for(const auto& entry: fs::directory_iterator(dir, err))
+      {
+        if(std::string(subdir) == "kernels" && entry.path().extension() != ".cl") continue;
+
+        const auto time = fs::last_write_time(entry.path(), err);
+        if(err) continue;
+        latest = std::max<long>(latest, std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count());
+      }
+    }
+
+    return latest;
+  }
+}
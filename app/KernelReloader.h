@@ -0,0 +1,91 @@
+//File: KernelReloader.h
+//Brief: A KernelReloader watches the kernel sources in a directory and
+//       rebuilds the program on a background thread when one of them
+//       changes.  The render thread keeps using the last program that
+//       built until the new one has built every variant it's using, so
+//       a typo in a kernel never stops the render loop.  Build logs are
+//       kept for the GUI.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_KERNELRELOADER_H
+#define APP_KERNELRELOADER_H
+
+//app includes
+#include "app/KernelVariants.h"
+
+//c++ includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+namespace app
+{
+  class KernelReloader
+  {
+    public:
+      //kernelFile and includes are relative to directory like app::readSource() wants them.  Reads
+      //the source once before returning, so variants() is ready to use.
+      KernelReloader(cl::Context& ctx, const cl::Device& device, const std::string& directory, const std::string& kernelFile,
+                     const std::vector<std::string>& includes, const std::string& kernelName);
+
+      //Stops watching and waits for a build in progress to finish
+      ~KernelReloader();
+
+      //The newest program that built.  The render thread should hold on to what this returns
+      //for as long as it uses a variant from it.
+      std::shared_ptr<KernelVariants> variants() const;
+
+      //Build options that the render thread is using right now.  A new program has to build all
+      //of them before it replaces the old one.
+      void setOptions(const std::vector<std::string>& options);
+
+      //Rebuild on the next check even if no file changed
+      void reload();
+
+      //What the GUI shows about reloading
+      struct status
+      {
+        std::string directory; //Where sources are read from
+        int nReloads; //Programs swapped in since startup
+        bool building; //Whether the background thread is building right now
+        std::string log; //Build log from the last reload that failed.  Empty once a reload succeeds.
+      };
+      status getStatus() const;
+
+    private:
+      //How often to check the sources for changes in ms
+      static constexpr int checkPeriod = 500;
+
+      cl::Context& fContext;
+      cl::Device fDevice;
+      const std::string fDirectory;
+      const std::string fKernelFile;
+      const std::vector<std::string> fIncludes;
+      const std::string fKernelName;
+
+      //Shared with the background thread.  Protected by fMutex.
+      mutable std::mutex fMutex;
+      std::condition_variable fWakeUp;
+      std::shared_ptr<KernelVariants> fVariants;
+      std::vector<std::string> fOptions;
+      std::string fLog;
+      int fReloads;
+      bool fStop;
+      bool fForce;
+
+      std::atomic<bool> fBuilding;
+      std::thread fWatcher; //Started last so that everything above is ready for it
+
+      //Background thread's loop
+      void watch();
+
+      //Latest modification time of any file in kernels/*.cl or serial/*
+      long lastModified() const;
+  };
+}
+
+#endif //APP_KERNELRELOADER_H
@@ -0,0 +1,192 @@
+//File: KernelVariants.cpp
+//Brief: KernelVariants builds the same kernel source with different -D options
+//       the first time each set of options is needed and keeps the variants it
+//       used most recently.  Settings that are fixed at compile time let the OpenCL compiler
+//       fold constants and unroll loops over them, and switching back to settings
+//       I already used doesn't cost another build.  Program binaries are
+//       cached on disk so that the next run with the same source, options,
+//       device, and driver doesn't compile anything.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//OpenCL includes
+#define __CL_ENABLE_EXCEPTIONS //OpenCL c++ API now throws exceptions
+#include <CL/cl.hpp>
+
+//app includes
+#include "app/KernelVariants.h"
+
+//c++ includes
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstdlib> //std::getenv(), mkstemp()
+#include <cstdio> //std::rename()
+#include <algorithm>
+#include <experimental/filesystem>
+
+//POSIX includes
+#include <unistd.h> //write(), close(), unlink()
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+  //64-bit FNV-1a hash.  Only needs to tell versions of the kernel source apart, not resist attacks.
+  uint64_t fnv1a(const std::string& bytes, uint64_t hash = 14695981039346656037ull)
+  {
+    for(const unsigned char byte: bytes)
+    {
+      hash ^= byte;
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+}
+
+namespace app
+{
+  KernelVariants::KernelVariants(cl::Context& ctx, const cl::Device& device, const std::string& source,
+                                 const std::string& kernelName): fContext(ctx), fDevice(device), fSource(source), fKernelName(kernelName),
+                                                                                                 fDeviceKey(device.getInfo<CL_DEVICE_NAME>() + " " + device.getInfo<CL_DRIVER_VERSION>())
+  {
+  }
+
+  const KernelVariants::variant& KernelVariants::get(const std::string& options)
+  {
+    const auto found = fVariants.find(options);
+    if(found != fVariants.end())
+    {
+      fLastUsed[options] = ++fNGets;
+      return found->second;
+    }
+
+    variant built;
+    const auto fileName = cacheFile(options);
+    if(!fileName.empty() && loadBinary(fileName, options, built.program)) return finish(options, built, "cached ");
+
+    built.program = cl::Program(fContext, fSource);
+    try
+    {
+      built.program.build({fDevice}, options.c_str());
+    }
+    catch(const cl::Error& e)
+    {
+      const auto status = built.program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(fDevice);
+      if(status == CL_BUILD_ERROR)
+      {
+        throw buildError("The program for device " + fDevice.getInfo<CL_DEVICE_NAME>() + " with options \"" + options
+                         + "\" failed because:\n" + built.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(fDevice) + "\n");
+      }
+      throw buildError("Got unrecognized error when building OpenCL program with options \"" + options + "\": "
+                       + std::to_string(e.err()) + ": " + e.what() + "\n");
+    }
+
+    if(!fileName.empty()) saveBinary(fileName, built.program);
+    return finish(options, built, "");
+  }
+
+  const KernelVariants::variant& KernelVariants::finish(const std::string& options, variant& built, const std::string& how)
+  {
+    built.kernel = cl::Kernel(built.program, fKernelName.c_str());
+    built.maxWorkGroupSize = built.kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(fDevice);
+    built.localMemSize = built.kernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(fDevice);
+
+    #ifndef NDEBUG
+    std::cout << "Built " << how << "kernel variant " << fVariants.size() << " with options \"" << options << "\"\n";
+    #endif //NDEBUG
+
+    //Every gamma or bounce count I try while specializing is another variant.  Don't keep all of them.
+    if(fVariants.size() >= maxVariants)
+    {
+      const auto oldest = std::min_element(fVariants.begin(), fVariants.end(), [this](const auto& lhs, const auto& rhs)
+                                                                               {
+                                                                                 return fLastUsed[lhs.first] < fLastUsed[rhs.first];
+                                                                               });
+      fLastUsed.erase(oldest->first);
+      fVariants.erase(oldest);
+    }
+
+    fLastUsed[options] = ++fNGets;
+    return fVariants.emplace(options, built).first->second;
+  }
+
+  std::string KernelVariants::cacheFile(const std::string& options) const
+  {
+    const char* home = std::getenv("HOME");
+    if(!home) return "";
+
+    //Separate the pieces so that moving text from one to the next changes the hash
+    uint64_t hash = fnv1a(fSource);
+    hash = fnv1a(std::string(1, '\0') + options, hash);
+    hash = fnv1a(std::string(1, '\0') + fKernelName, hash);
+    hash = fnv1a(std::string(1, '\0') + fDeviceKey, hash);
+
+    std::stringstream name;
+    name << std::string(home) << "/.skyline/kernels/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+    return name.str();
+  }
+
+  bool KernelVariants::loadBinary(const std::string& fileName, const std::string& options, cl::Program& program) const
+  {
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file) return false;
+    const std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(binary.empty()) return false;
+
+    //The driver might reject a binary that it wrote itself, like after an update that didn't
+    //change its version string.  Then fall back to building from source.
+    try
+    {
+      program = cl::Program(fContext, {fDevice}, {{binary.data(), binary.size()}});
+      program.build({fDevice}, options.c_str());
+      return true;
+    }
+    catch(const cl::Error& e)
+    {
+      std::cerr << "Couldn't use cached kernel binary " << fileName << " because of error " << e.err() << ": " << e.what()
+                << "\nBuilding from source instead.\n";
+      std::error_code ignored;
+      fs::remove(fileName, ignored);
+      return false;
+    }
+  }
+
+  void KernelVariants::saveBinary(const std::string& fileName, const cl::Program& program) const
+  {
+    try
+    {
+      //The program is only built for fDevice, so there's exactly 1 binary
+      const auto sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+      if(sizes.size() != 1 || sizes.front() == 0) return;
+      std::vector<unsigned char> binary(sizes.front());
+      unsigned char* binaries[] = {binary.data()};
+      if(clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binaries), binaries, nullptr) != CL_SUCCESS) return;
+
+      //Write to a temporary file first so that another builder never reads half of a binary.  Every
+      //process gets its own temporary file so that 2 builders saving the same variant don't mix
+      //their writes.  rename() replaces fileName in one step.
+      fs::create_directories(fs::path(fileName).parent_path());
+      std::vector<char> tempName(fileName.begin(), fileName.end());
+      const std::string suffix = ".XXXXXX";
+      tempName.insert(tempName.end(), suffix.begin(), suffix.end());
+      tempName.push_back('\0');
+      const int fd = mkstemp(tempName.data());
+      if(fd < 0) return;
+
+      size_t written = 0;
+      while(written < binary.size())
+      {
+        const ssize_t result = write(fd, binary.data() + written, binary.size() - written);
+        if(result <= 0) break;
+        written += result;
+      }
+      if(close(fd) != 0 || written != binary.size() || std::rename(tempName.data(), fileName.c_str()) != 0) unlink(tempName.data());
+    }
+    catch(const std::exception& e) //Not being able to save the binary isn't worth crashing over
+    {
+      std::cerr << "Couldn't save kernel binary to " << fileName << " because:\n" << e.what() << "\n";
+    }
+  }
+}
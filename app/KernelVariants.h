@@ -0,0 +1,87 @@
+//File: KernelVariants.h
+//Brief: KernelVariants builds the same kernel source with different -D options
+//       the first time each set of options is needed and keeps the variants it
+//       used most recently.  Settings that are fixed at compile time let the OpenCL compiler
+//       fold constants and unroll loops over them, and switching back to settings
+//       I already used doesn't cost another build.  Program binaries are
+//       cached on disk so that the next run with the same source, options,
+//       device, and driver doesn't compile anything.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_KERNELVARIANTS_H
+#define APP_KERNELVARIANTS_H
+
+//OpenCL c++ API includes
+#include <CL/cl.hpp>
+
+//c++ includes
+#include <string>
+#include <map>
+#include <stdexcept>
+
+namespace app
+{
+  class KernelVariants
+  {
+    public:
+      //A kernel built with one set of options
+      struct variant
+      {
+        cl::Program program;
+        cl::Kernel kernel;
+        size_t maxWorkGroupSize; //CL_KERNEL_WORK_GROUP_SIZE on this device
+        size_t localMemSize; //__local memory the kernel uses before any cl::Local() arguments
+      };
+
+      //Thrown when a variant doesn't build.  what() includes the build log.
+      class buildError: public std::runtime_error
+      {
+        public:
+          buildError(const std::string& why): std::runtime_error(why) {}
+      };
+
+      //source is a whole program like app::readSource() returns.  kernelName is the kernel
+      //each variant provides.
+      KernelVariants(cl::Context& ctx, const cl::Device& device, const std::string& source, const std::string& kernelName);
+
+      //Get the variant built with options.  Builds it the first time it's needed.  References
+      //stay valid until maxVariants other variants have been built.
+      const variant& get(const std::string& options);
+
+      //Number of variants kept right now
+      inline size_t size() const { return fVariants.size(); }
+
+      //Building a new variant when this many are kept drops the one that was used longest ago.
+      //Its binary stays in the cache on disk, so getting it again doesn't compile anything.
+      static constexpr size_t maxVariants = 16;
+
+    private:
+      cl::Context& fContext;
+      cl::Device fDevice;
+      const std::string fSource;
+      const std::string fKernelName;
+
+      const std::string fDeviceKey; //Identifies this device and driver in binary cache keys
+
+      std::map<std::string, variant> fVariants; //Indexed by build options
+      std::map<std::string, size_t> fLastUsed; //Value of fNGets when each of fVariants was last returned
+      size_t fNGets = 0; //Calls to get() so far
+
+      //Look up what the kernel in built.program needs and keep it.  how describes where the
+      //program came from for debugging output.
+      const variant& finish(const std::string& options, variant& built, const std::string& how);
+
+      //Where the binary for a variant built with options is cached.  The file name is a hash
+      //of everything that goes into the binary, so a stale binary just never gets found.
+      //Empty if there's no home directory.
+      std::string cacheFile(const std::string& options) const;
+
+      //Try to build program from a cached binary.  Returns false if there's no usable binary.
+      bool loadBinary(const std::string& fileName, const std::string& options, cl::Program& program) const;
+
+      //Cache program's binary for this device.  Failing to save it isn't an error.
+      void saveBinary(const std::string& fileName, const cl::Program& program) const;
+  };
+}
+
+#endif //APP_KERNELVARIANTS_H
@@ -1,9 +1,10 @@
 //File: LoadIntoCL.cpp
-//Brief: Functions to simplify loading headers into an OpenCL kernel.
+//Brief: Functions to simplify loading headers into an OpenCL kernel.  Functions
+//       that don't need a window are in LoadIntoCLNoGL.cpp so that skyline-render
+//       doesn't have to link against GLFW.
 //Author: Andrew Olivier aolivier@ur.rochester.edu
 
 //c++ includes
-#include <fstream>
 #include <algorithm>
 
 #ifndef NDEBUG
@@ -26,27 +27,6 @@
 
 namespace app
 {
-  //Put together an OpenCL Program from a kernel that uses 0 or
-  //more include files.
-  cl::Program constructSource(cl::Context& ctx, const std::string kernelName, const std::initializer_list<std::string> includes)
-  {
-    std::string source;
-    std::istreambuf_iterator<char> end;
-
-    for(const auto& file: includes)
-    {
-      std::ifstream fileStream(std::string(INSTALL_DIR) + "/include/" + file);
-      std::istreambuf_iterator<char> begin(fileStream);
-      source.append(begin, end);
-    }
-
-    std::ifstream fileStream(std::string(INSTALL_DIR) + "/include/" + kernelName);
-    std::istreambuf_iterator<char> begin(fileStream);
-    source.append(begin, end);
-
-    return cl::Program(ctx, source);
-  }
-
   //Choose the best OpenCL-capable GPU for rendering.
   std::pair<cl::Context, cl::Device> chooseDevice(GLFWwindow* window)
   { 
@@ -5,8 +5,13 @@
 #ifndef APP_LOADINTOCL_H
 #define APP_LOADINTOCL_H
 
+//OpenCL includes
+#include <CL/cl.h>
+
 //c++ includes
 #include <initializer_list>
+#include <string>
+#include <vector>
 
 namespace cl
 {
@@ -18,12 +23,25 @@ class GLFWwindow;
 
 namespace app
 {
+  //Put together the source code for a kernel that uses 0 or more
+  //include files.  Files are relative to directory, which defaults
+  //to the installed include directory.
+  std::string readSource(const std::string kernelName, const std::vector<std::string>& includes, const std::string& directory = "");
+
+  //Files that kernels/skyline.cl needs in front of it, in order.  Shared by every
+  //application that builds the pathTrace kernel.
+  const std::vector<std::string>& skylineIncludes();
+
   //Put together an OpenCL Program from a kernel that uses 0 or
   //more include files.
   cl::Program constructSource(cl::Context& ctx, const std::string kernelName, const std::initializer_list<std::string> includes);
 
   //Choose the best OpenCL-capable GPU for rendering.
   std::pair<cl::Context, cl::Device> chooseDevice(GLFWwindow* window);
+
+  //Choose the first OpenCL device of a type like CL_DEVICE_TYPE_ALL that can read images.
+  //Doesn't need a window or OpenGL.  Throws std::runtime_error if there is no such device.
+  std::pair<cl::Context, cl::Device> chooseDevice(const cl_device_type type);
 }
 
 #endif //APP_LOADINTOCL_H
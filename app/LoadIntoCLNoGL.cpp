@@ -0,0 +1,112 @@
+//File: LoadIntoCLNoGL.cpp
+//Brief: Functions from LoadIntoCL.h that work without a window or an OpenGL
+//       context.  Kept separate so that headless applications like
+//       skyline-render don't have to link against GLFW.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//c++ includes
+#include <fstream>
+#include <stdexcept>
+
+#ifndef NDEBUG
+#include <iostream>
+#endif //NDEBUG
+
+//OpenCL includes
+#define __CL_ENABLE_EXCEPTIONS //OpenCL c++ API now throws exceptions
+#include <CL/cl.hpp>
+
+//app includes
+#include "app/LoadIntoCL.h"
+
+namespace app
+{
+  //Put together the source code for a kernel that uses 0 or more
+  //include files.  Files are relative to directory, which defaults
+  //to the installed include directory.
+  std::string readSource(const std::string kernelName, const std::vector<std::string>& includes, const std::string& directory)
+  {
+    const std::string prefix = (directory.empty()?std::string(INSTALL_DIR) + "/include":directory) + "/";
+    std::string source;
+    std::istreambuf_iterator<char> end;
+
+    for(const auto& file: includes)
+    {
+      std::ifstream fileStream(prefix + file);
+      std::istreambuf_iterator<char> begin(fileStream);
+      source.append(begin, end);
+    }
+
+    std::ifstream fileStream(prefix + kernelName);
+    std::istreambuf_iterator<char> begin(fileStream);
+    source.append(begin, end);
+
+    return source;
+  }
+
+  //Put together an OpenCL Program from a kernel that uses 0 or
+  //more include files.
+  cl::Program constructSource(cl::Context& ctx, const std::string kernelName, const std::initializer_list<std::string> includes)
+  {
+    return cl::Program(ctx, readSource(kernelName, includes));
+  }
+
+  //Files that kernels/skyline.cl needs in front of it, in order
+  const std::vector<std::string>& skylineIncludes()
+  {
+    static const std::vector<std::string> includes = {"serial/vector.h",
+                                                      "serial/ray.h",
+                                                      "serial/material.h",
+                                                      "serial/aabb.h",
+                                                      "serial/aabb.cpp",
+                                                      "serial/sphere.h",
+                                                      "serial/sphere.cpp",
+                                                      "serial/octahedral.h",
+                                                      "serial/octahedral.cpp",
+                                                      "serial/groundPlane.h",
+                                                      "serial/groundPlane.cpp",
+                                                      "serial/grid.h",
+                                                      "serial/grid.cpp",
+                                                      "serial/gridCell.h",
+                                                      "serial/gridCell.cpp",
+                                                      "serial/traversalStats.h",
+                                                      "serial/workQueue.h",
+                                                      "kernels/linearCongruential.cl",
+                                                      "serial/camera.h",
+                                                      "serial/camera.cpp"};
+    return includes;
+  }
+
+  //Choose the first OpenCL device of a given type that can read images.
+  std::pair<cl::Context, cl::Device> chooseDevice(const cl_device_type type)
+  {
+    std::vector<cl::Platform> platforms;
+    cl::Platform::get(&platforms);
+
+    for(const auto& platform: platforms)
+    {
+      std::vector<cl::Device> devices;
+      try
+      {
+        platform.getDevices(type, &devices);
+      }
+      catch(const cl::Error& e)
+      {
+        if(e.err() != CL_DEVICE_NOT_FOUND) throw e;
+      }
+
+      for(const auto& device: devices)
+      {
+        if(!device.getInfo<CL_DEVICE_IMAGE_SUPPORT>()) continue; //Textures and the sky are images
+
+        #ifndef NDEBUG
+        std::cout << "Chose to use device named " << device.getInfo<CL_DEVICE_NAME>() << "\n";
+        #endif //NDEBUG
+
+        return std::make_pair(cl::Context(device), device);
+      }
+    }
+
+    throw std::runtime_error("Couldn't find an OpenCL device of the requested type that supports images.");
+  }
+}
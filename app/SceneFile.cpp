@@ -0,0 +1,152 @@
+//File: SceneFile.cpp
+//Brief: A SceneFile is a binary version of a skyline geometry file that loads without parsing
+//       anything.  Reading copies each section straight from the file into the vector that
+//       keeps it, so a scene is only in memory once until it's uploaded.  Writing puts each
+//       section at an aligned offset after the header.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//app includes
+#include "app/SceneFile.h"
+
+//c++ includes
+#include <fstream>
+#include <cstring>
+
+namespace app
+{
+  SceneFile::SceneFile(const std::string& fileName): fFile(fileName, std::ios::binary | std::ios::ate), fFileName(fileName)
+  {
+    if(!fFile) throw exception("Failed to open a scene file named " + fileName);
+
+    const uint64_t size = fFile.tellg();
+    if(size < sizeof(fileHeader)) throw exception(fileName + " is too small to be a scene file");
+    fFile.seekg(0);
+    if(!fFile.read(reinterpret_cast<char*>(&fHeader), sizeof(fHeader))) throw exception("Failed to read the header of " + fileName);
+
+    const fileHeader& head = fHeader;
+    if(memcmp(head.magic, magic, sizeof(magic)) != 0) throw exception(fileName + " isn't a skyline scene file");
+    if(head.version != version) throw exception(fileName + " is scene file version " + std::to_string(head.version) + ", but I can only read version " + std::to_string(version));
+    if(head.nSections != N_SECTIONS) throw exception(fileName + " has " + std::to_string(head.nSections) + " sections, but I expected " + std::to_string(N_SECTIONS));
+    for(uint32_t which = 0; which < N_SECTIONS; ++which)
+    {
+      const sectionInfo& info = head.sections[which];
+      if(info.offset > size || info.bytes > size - info.offset) throw exception(fileName + " is truncated in section " + std::to_string(which));
+    }
+  }
+
+  bool SceneFile::isSceneFile(const std::string& fileName)
+  {
+    std::ifstream file(fileName, std::ios::binary);
+    char start[sizeof(magic)] = {};
+    return file.read(start, sizeof(start)) && !memcmp(start, magic, sizeof(magic));
+  }
+
+  std::vector<std::string> SceneFile::strings(const section which)
+  {
+    checkSize(which, 0);
+    const sectionInfo& info = fHeader.sections[which];
+    std::vector<uint64_t> offsets(info.count + 1);
+    std::vector<char> chars(info.bytes - offsets.size()*sizeof(uint64_t));
+    readBytes(which, reinterpret_cast<char*>(offsets.data()), offsets.size()*sizeof(uint64_t));
+    if(!fFile.read(chars.data(), chars.size())) throw exception("Failed to read string table " + std::to_string(which) + " from " + fFileName);
+
+    std::vector<std::string> result;
+    result.reserve(info.count);
+    for(uint64_t whichString = 0; whichString < info.count; ++whichString)
+    {
+      if(offsets[whichString] > offsets[whichString + 1] || offsets[whichString + 1] > chars.size())
+      {
+        throw exception("String table " + std::to_string(which) + " is corrupted at string " + std::to_string(whichString));
+      }
+      result.emplace_back(chars.data() + offsets[whichString], chars.data() + offsets[whichString + 1]);
+    }
+
+    return result;
+  }
+
+  void SceneFile::checkSize(const section which, const uint64_t elementSize) const
+  {
+    const sectionInfo& info = fHeader.sections[which];
+    if(info.elementSize != elementSize)
+    {
+      throw exception("Section " + std::to_string(which) + " has elements of " + std::to_string(info.elementSize)
+                      + " bytes, but I expected " + std::to_string(elementSize) + " bytes");
+    }
+
+    const uint64_t expected = (elementSize > 0)?info.count*elementSize:(info.count + 1)*sizeof(uint64_t);
+    if(info.count > info.bytes || info.bytes < expected) throw exception("Section " + std::to_string(which) + " is too small for " + std::to_string(info.count) + " elements");
+  }
+
+  void SceneFile::readBytes(const section which, char* bytes, const uint64_t nBytes)
+  {
+    fFile.seekg(fHeader.sections[which].offset);
+    if(!fFile.read(bytes, nBytes)) throw exception("Failed to read section " + std::to_string(which) + " from " + fFileName);
+  }
+
+  SceneFile::writer::writer(): fSections(N_SECTIONS, pending{{}, 0, 0})
+  {
+    //Sections nobody adds are empty string tables or empty arrays.  Arrays get their element
+    //size when they're added.
+    for(const section table: {BOX_NAMES, MATERIAL_NAMES, TEXTURE_NAMES, CAMERA_NAMES, SKY_FILE}) add(table, std::vector<std::string>{});
+  }
+
+  void SceneFile::writer::add(const section which, const std::vector<std::string>& strings)
+  {
+    pending& table = fSections[which];
+    table.count = strings.size();
+    table.elementSize = 0;
+
+    std::vector<uint64_t> offsets(1, 0);
+    for(const auto& string: strings) offsets.push_back(offsets.back() + string.size());
+
+    table.bytes.resize(offsets.size()*sizeof(uint64_t) + offsets.back());
+    memcpy(table.bytes.data(), offsets.data(), offsets.size()*sizeof(uint64_t));
+    char* chars = table.bytes.data() + offsets.size()*sizeof(uint64_t);
+    for(size_t whichString = 0; whichString < strings.size(); ++whichString)
+    {
+      memcpy(chars + offsets[whichString], strings[whichString].data(), strings[whichString].size());
+    }
+  }
+
+  void SceneFile::writer::add(const section which, const char* bytes, const uint64_t count, const uint64_t elementSize)
+  {
+    fSections[which] = pending{std::vector<char>(bytes, bytes + count*elementSize), count, elementSize};
+  }
+
+  void SceneFile::writer::write(const std::string& fileName, const settings& scene) const
+  {
+    const auto aligned = [](const uint64_t offset) { return (offset + alignment - 1)/alignment*alignment; };
+
+    fileHeader head;
+    memset(static_cast<void*>(&head), 0, sizeof(head)); //No uninitialized padding in the file
+    memcpy(head.magic, magic, sizeof(magic));
+    head.version = version;
+    head.nSections = N_SECTIONS;
+    head.scene = scene;
+
+    uint64_t offset = aligned(sizeof(fileHeader));
+    for(uint32_t which = 0; which < N_SECTIONS; ++which)
+    {
+      const pending& section = fSections[which];
+      head.sections[which] = sectionInfo{offset, section.count, section.elementSize, section.bytes.size()};
+      offset = aligned(offset + section.bytes.size());
+    }
+
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+    if(!file) throw exception("Failed to open " + fileName + " to write a scene file");
+
+    const std::vector<char> padding(alignment, 0);
+    const auto pad = [&file, &padding, &aligned](const uint64_t written) { file.write(padding.data(), aligned(written) - written); };
+
+    file.write(reinterpret_cast<const char*>(&head), sizeof(head));
+    pad(sizeof(head));
+    for(uint32_t which = 0; which < N_SECTIONS; ++which)
+    {
+      const pending& section = fSections[which];
+      file.write(section.bytes.data(), section.bytes.size());
+      pad(head.sections[which].offset + section.bytes.size());
+    }
+
+    if(!file) throw exception("Failed to write a scene file to " + fileName);
+  }
+}
@@ -0,0 +1,165 @@
+//File: SceneFile.h
+//Brief: A SceneFile is a binary version of a skyline geometry file that loads without parsing
+//       anything.  It holds the same arrays that Geometry uploads to the GPU in the same order:
+//       packed aabbs, materials, and a prebuilt grid.  Names and texture file names are string
+//       tables.  A SceneFile reads each section straight into the vector that Geometry keeps,
+//       and Geometry uploads those without rearranging them.  The layout is the host's native
+//       layout of the serial/ structs, so a file
+//       only loads on machines with the same endianness and padding.  The version number
+//       changes whenever the layout does.
+//
+//       File layout:
+//       header: magic, version, element size and location of each section, and scene settings
+//       sections: each one starts at a multiple of alignment bytes from the beginning of the file
+//       string tables: count + 1 offsets into the characters that follow them
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_SCENEFILE_H
+#define APP_SCENEFILE_H
+
+//serial includes
+#define NOT_ON_DEVICE
+#include "serial/vector.h"
+#include "serial/ray.h"
+#include "serial/grid.h"
+
+//c++ includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <cstdint>
+
+namespace app
+{
+  class SceneFile
+  {
+    public:
+      static constexpr char magic[8] = {'S', 'K', 'Y', 'L', 'I', 'N', 'E', '\0'};
+      static constexpr uint32_t version = 1;
+      static constexpr uint64_t alignment = 64; //Sections start on cache lines
+
+      //Sections in the order they're stored
+      enum section: uint32_t
+      {
+        BOXES = 0, //aabb in the device's order
+        MATERIALS, //material
+        GRID_CELLS, //gridCell referring to BOXES' order
+        GRID_INDICES, //int referring to BOXES' order
+        CAMERAS, //camera
+        BOX_NAMES, //Strings in BOXES' order
+        MATERIAL_NAMES, //Strings in MATERIALS' order
+        TEXTURE_NAMES, //Strings that materials' texture ids refer to.  The first one is the ground.
+        CAMERA_NAMES, //Strings in CAMERAS' order
+        SKY_FILE, //1 string
+        N_SECTIONS
+      };
+
+      //Everything that there's only 1 of in a scene
+      struct settings
+      {
+        grid gridSize;
+        cl_int largeBoxThreshold;
+        cl_float3 sunEmission;
+        cl_float3 sunCenter;
+        cl_float sunRadius;
+        cl_float horizon;
+        cl_float2 groundTexNorm;
+        cl_int2 textureSize;
+        cl_int2 texturesResident;
+      };
+
+      //Thrown when a file isn't a SceneFile this version can read
+      class exception: public std::runtime_error
+      {
+        public:
+          exception(const std::string& why): std::runtime_error(why) {}
+      };
+
+      //Open fileName and read its header.  Checks the header but not the contents of each section.
+      explicit SceneFile(const std::string& fileName);
+
+      //Whether fileName starts with magic.  Doesn't throw.
+      static bool isSceneFile(const std::string& fileName);
+
+      inline const settings& scene() const { return fHeader.scene; }
+
+      //Copy a section that isn't a string table out of the file.  Throws if T isn't the size
+      //of the elements that were written.
+      template <class T>
+      std::vector<T> read(const section which)
+      {
+        checkSize(which, sizeof(T));
+        std::vector<T> elements(count(which));
+        readBytes(which, reinterpret_cast<char*>(elements.data()), elements.size() * sizeof(T));
+        return elements;
+      }
+
+      inline size_t count(const section which) const { return fHeader.sections[which].count; }
+
+      //Copy a string table out of the file
+      std::vector<std::string> strings(const section which);
+
+      //Collects sections and writes them all at once
+      class writer
+      {
+        public:
+          writer();
+
+          template <class T>
+          void add(const section which, const T* begin, const T* end)
+          {
+            add(which, reinterpret_cast<const char*>(begin), end - begin, sizeof(T));
+          }
+
+          template <class T>
+          void add(const section which, const std::vector<T>& elements) { add(which, elements.data(), elements.data() + elements.size()); }
+
+          void add(const section which, const std::vector<std::string>& strings);
+
+          //Throws exception if fileName can't be written
+          void write(const std::string& fileName, const settings& scene) const;
+
+        private:
+          struct pending
+          {
+            std::vector<char> bytes;
+            uint64_t count;
+            uint64_t elementSize; //0 for string tables
+          };
+          std::vector<pending> fSections; //Indexed by section
+
+          void add(const section which, const char* bytes, const uint64_t count, const uint64_t elementSize);
+      };
+
+    private:
+      struct sectionInfo
+      {
+        uint64_t offset; //From the beginning of the file
+        uint64_t count;
+        uint64_t elementSize; //0 for string tables
+        uint64_t bytes;
+      };
+
+      struct fileHeader
+      {
+        char magic[8];
+        uint32_t version;
+        uint32_t nSections;
+        sectionInfo sections[N_SECTIONS];
+        settings scene;
+      };
+
+      std::ifstream fFile;
+      std::string fFileName;
+      fileHeader fHeader;
+
+      //Throw if which doesn't hold elements of elementSize
+      void checkSize(const section which, const uint64_t elementSize) const;
+
+      //Read the first nBytes of a section into bytes
+      void readBytes(const section which, char* bytes, const uint64_t nBytes);
+  };
+}
+
+#endif //APP_SCENEFILE_H
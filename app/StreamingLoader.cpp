@@ -0,0 +1,197 @@
+//File: StreamingLoader.cpp
+//Brief: A StreamingLoader converts the geometry map of a YAML file into boxes on several
+//       threads.  Splitting only looks at indentation, so it never parses anything itself.
+//       Workers take chunks in file order from an atomic counter, and each one converts its
+//       chunk with its own yaml-cpp node tree.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//app includes
+#include "app/StreamingLoader.h"
+
+//algebra includes
+#include "algebra/YAMLIntegration.h"
+
+//yaml-cpp includes
+#include "yaml-cpp/yaml.h"
+
+//c++ includes
+#include <string_view>
+#include <stdexcept>
+#include <algorithm>
+
+namespace app
+{
+  StreamingLoader::StreamingLoader(std::string text): fText(std::move(text)), fNext(0), fNDone(0), fTaken(0)
+  {
+    split();
+  }
+
+  StreamingLoader::~StreamingLoader()
+  {
+    fNext = fChunks.size(); //Workers stop after the chunk they're on
+    for(auto& worker: fWorkers) worker.join();
+  }
+
+  void StreamingLoader::start(std::unordered_map<std::string, int> materials, const unsigned int nThreads)
+  {
+    fMaterials = std::move(materials);
+    fResults.resize(fChunks.size());
+
+    const size_t nWorkers = std::min<size_t>(std::max(nThreads, 1u), fChunks.size());
+    for(size_t whichWorker = 0; whichWorker < nWorkers; ++whichWorker) fWorkers.emplace_back(&StreamingLoader::work, this);
+  }
+
+  size_t StreamingLoader::take(std::vector<aabb>& boxes, std::vector<std::string>& names)
+  {
+    size_t nBoxes = 0;
+    std::lock_guard<std::mutex> lock(fMutex);
+    while(fTaken < fResults.size() && fResults[fTaken].done)
+    {
+      auto& chunk = fResults[fTaken];
+      if(!chunk.error.empty()) throw std::runtime_error(chunk.error);
+
+      boxes.insert(boxes.end(), chunk.boxes.begin(), chunk.boxes.end());
+      names.insert(names.end(), std::make_move_iterator(chunk.names.begin()), std::make_move_iterator(chunk.names.end()));
+      nBoxes += chunk.boxes.size();
+      chunk = result{{}, {}, "", true}; //Free this chunk's memory now
+      ++fTaken;
+    }
+
+    return nBoxes;
+  }
+
+  void StreamingLoader::waitForNext()
+  {
+    std::unique_lock<std::mutex> lock(fMutex);
+    fChunkDone.wait(lock, [this] { return fTaken == fResults.size() || fResults[fTaken].done; });
+  }
+
+  size_t StreamingLoader::finish(std::vector<aabb>& boxes, std::vector<std::string>& names)
+  {
+    {
+      std::unique_lock<std::mutex> lock(fMutex);
+      fChunkDone.wait(lock, [this] { return fNDone == fResults.size(); });
+    }
+    return take(boxes, names);
+  }
+
+  size_t StreamingLoader::nReady() const
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    size_t ready = fTaken;
+    while(ready < fResults.size() && fResults[ready].done) ++ready;
+    return ready - fTaken;
+  }
+
+  void StreamingLoader::work()
+  {
+    for(size_t whichChunk = fNext++; whichChunk < fChunks.size(); whichChunk = fNext++)
+    {
+      result converted;
+      try
+      {
+        const auto& range = fChunks[whichChunk];
+        const YAML::Node boxMap = YAML::Load(fText.substr(range.first, range.second - range.first));
+        for(const auto& box: boxMap)
+        {
+          converted.names.push_back(box.first.as<std::string>());
+          converted.boxes.push_back(convert(converted.names.back(), box.second, fMaterials));
+        }
+      }
+      catch(const YAML::Exception& e)
+      {
+        converted.error = e.what();
+      }
+      catch(const std::runtime_error& e)
+      {
+        converted.error = e.what();
+      }
+      converted.done = true;
+
+      {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fResults[whichChunk] = std::move(converted);
+        ++fNDone;
+      }
+      fChunkDone.notify_all();
+    }
+  }
+
+  aabb StreamingLoader::convert(const std::string& name, const YAML::Node& box, const std::unordered_map<std::string, int>& materials)
+  {
+    const auto material = materials.find(box["material"].as<std::string>());
+    if(material == materials.end()) throw std::runtime_error("Failed to look up a material named " + box["material"].as<std::string>()
+                                                             + " for a box named " + name);
+
+    aabb newBox;
+    newBox.width = box["width"].as<cl::float3>().data;
+    newBox.center = box["center"].as<cl::float3>().data;
+    newBox.texNorm = box["texNorm"].as<cl::float3>(newBox.width).data;
+    newBox.material = material->second;
+    return newBox;
+  }
+
+  void StreamingLoader::split()
+  {
+    //Walk through fText 1 line at a time
+    const auto lineAt = [this](const size_t begin)
+                        {
+                          const size_t end = std::min(fText.find('\n', begin), fText.size());
+                          return std::string_view(fText.data() + begin, end - begin);
+                        };
+
+    //Find the top-level geometry key and the next top-level key after it
+    constexpr std::string_view key = "geometry:";
+    size_t geometryLine = std::string::npos, geometryBegin = 0, geometryEnd = fText.size();
+    for(size_t begin = 0; begin < fText.size(); begin += lineAt(begin).size() + 1)
+    {
+      const auto line = lineAt(begin);
+      if(line.empty() || line[0] == ' ' || line[0] == '\t' || line[0] == '#' || line[0] == '\r') continue;
+      if(line[0] == '{' || (line[0] == '-' && line.substr(0, 3) != "---")) return; //The document isn't a block map
+
+      if(geometryLine != std::string::npos)
+      {
+        geometryEnd = begin;
+        break;
+      }
+
+      if(line.substr(0, key.size()) == key)
+      {
+        //Only a block map can be split.  Anything after the colon has to be a comment.
+        const size_t after = line.find_first_not_of(" \t\r", key.size());
+        if(after != std::string::npos && line[after] != '#') return;
+        geometryLine = begin;
+        geometryBegin = std::min(begin + line.size() + 1, fText.size());
+      }
+    }
+    if(geometryLine == std::string::npos) return;
+
+    //Anchors and aliases could refer to something in another chunk
+    const std::string_view section(fText.data() + geometryBegin, geometryEnd - geometryBegin);
+    if(section.find_first_of("&*") != std::string::npos) return;
+
+    //Each box starts on a line with the same indentation as the first box
+    std::vector<size_t> boxStarts;
+    size_t indent = std::string::npos;
+    for(size_t begin = geometryBegin; begin < geometryEnd; begin += lineAt(begin).size() + 1)
+    {
+      const auto line = lineAt(begin);
+      const size_t first = line.find_first_not_of(' ');
+      if(first == std::string::npos || line[first] == '#' || line[first] == '\r') continue;
+      if(line[first] == '\t') return; //Tabs aren't YAML indentation
+
+      if(indent == std::string::npos) indent = first;
+      if(first < indent || (first == indent && line[first] == '-')) return; //geometry has to be a map
+      if(first == indent) boxStarts.push_back(begin);
+    }
+    if(boxStarts.empty()) return;
+
+    for(size_t firstBox = 0; firstBox < boxStarts.size(); firstBox += boxesPerChunk)
+    {
+      const size_t end = (firstBox + boxesPerChunk < boxStarts.size())?boxStarts[firstBox + boxesPerChunk]:geometryEnd;
+      fChunks.emplace_back(boxStarts[firstBox], end);
+    }
+
+    fRest = fText.substr(0, geometryLine) + fText.substr(geometryEnd);
+  }
+}
@@ -0,0 +1,121 @@
+//File: StreamingLoader.h
+//Brief: A StreamingLoader converts the geometry map of a YAML file into boxes on several
+//       threads.  It splits the map into chunks at the lines that start each box, so every
+//       thread only builds a yaml-cpp node tree for its own chunk instead of 1 tree for the
+//       whole city.  Chunks are handed back in the same order as the file, and they can be
+//       taken as soon as they're ready so that rendering starts on the first boxes while the
+//       rest load.  Only block-style geometry maps without anchors or aliases can be split.
+//       canStream() is false for anything else, and Geometry parses the whole file like it
+//       always has.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_STREAMINGLOADER_H
+#define APP_STREAMINGLOADER_H
+
+//serial includes
+#define NOT_ON_DEVICE
+#include "serial/vector.h"
+#include "serial/ray.h"
+#include "serial/material.h"
+#include "serial/aabb.h"
+
+//c++ includes
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace YAML
+{
+  class Node;
+}
+
+namespace app
+{
+  class StreamingLoader
+  {
+    public:
+      //Boxes per chunk.  Small enough that the first chunk is ready almost right away and
+      //big enough that handing out chunks doesn't matter.
+      static constexpr size_t boxesPerChunk = 4096;
+
+      //Look for a geometry map in text that I can split into chunks.  Doesn't start converting
+      //anything yet.
+      explicit StreamingLoader(std::string text);
+
+      //Stops converting chunks and waits for the threads to finish
+      ~StreamingLoader();
+
+      //Whether text had a geometry map I could split.  Nothing else works without one.
+      inline bool canStream() const { return !fChunks.empty(); }
+
+      //text without its geometry map for yaml-cpp to parse
+      inline const std::string& rest() const { return fRest; }
+
+      //Start converting chunks on nThreads threads.  Boxes' materials are looked up in materials.
+      void start(std::unordered_map<std::string, int> materials, const unsigned int nThreads = std::thread::hardware_concurrency());
+
+      //Append boxes and their names from every chunk that's done and comes right after the chunks
+      //already taken.  Returns how many boxes it appended.  Throws std::runtime_error if one of
+      //those chunks failed to convert.
+      size_t take(std::vector<aabb>& boxes, std::vector<std::string>& names);
+
+      //Wait until the next chunk in order is done or there are none left
+      void waitForNext();
+
+      //Wait for every chunk, then take() them all
+      size_t finish(std::vector<aabb>& boxes, std::vector<std::string>& names);
+
+      //Chunks that take() would append right now
+      size_t nReady() const;
+
+      inline size_t nTaken() const { return fTaken; }
+      inline size_t nChunks() const { return fChunks.size(); }
+      inline bool allTaken() const { return fTaken == fChunks.size(); }
+
+      //Fraction of chunks that are converted
+      inline float progress() const { return canStream()?(float)fNDone/fChunks.size():1.f; }
+
+      //Convert the box called name from a geometry map.  Its material is looked up in materials.
+      //Throws std::runtime_error if there's no such material and YAML::Exception if box is missing
+      //something.  Geometry uses this too when it parses the whole file at once.
+      static aabb convert(const std::string& name, const YAML::Node& box, const std::unordered_map<std::string, int>& materials);
+
+    private:
+      //Converted boxes from 1 chunk
+      struct result
+      {
+        std::vector<aabb> boxes;
+        std::vector<std::string> names;
+        std::string error; //Why this chunk failed if it did
+        bool done = false;
+      };
+
+      const std::string fText;
+      std::string fRest;
+      std::vector<std::pair<size_t, size_t>> fChunks; //Beginning and end of each chunk in fText
+      std::unordered_map<std::string, int> fMaterials;
+
+      std::vector<std::thread> fWorkers;
+      std::atomic<size_t> fNext; //Next chunk a worker should convert
+      std::atomic<size_t> fNDone; //Chunks converted so far in any order
+      size_t fTaken; //Chunks already handed out by take().  Only touched by the thread that calls take().
+
+      //Protect fResults
+      mutable std::mutex fMutex;
+      std::condition_variable fChunkDone;
+      std::vector<result> fResults;
+
+      //Convert chunks until there are none left
+      void work();
+
+      //Find the geometry map in fText and fill fChunks and fRest.  Leaves fChunks empty if the
+      //map isn't something I can split.
+      void split();
+  };
+}
+
+#endif //APP_STREAMINGLOADER_H
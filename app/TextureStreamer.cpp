@@ -0,0 +1,406 @@
+//File: TextureStreamer.cpp
+//Brief: A TextureStreamer keeps a fixed-size pool of textures on the GPU and fills it
+//       on demand.  The kernel records which texture ids and mip levels it touched each
+//       frame in a feedback buffer.  update() reads that buffer back, asks a pool of
+//       host threads to decode any textures that aren't resident yet, and uploads whatever
+//       finished decoding into the least recently used layers of the pool.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//OpenCL includes
+#define __CL_ENABLE_EXCEPTIONS //OpenCL c++ API now throws exceptions
+#include <CL/cl.hpp>
+#include <CL/cl_gl.h>
+
+//app includes
+#include "app/TextureStreamer.h"
+
+//stb includes
+#include "stb_image/stb_image.h"
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image/stb_image_resize.h"
+
+//c++ includes
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <iterator>
+
+namespace
+{
+  //Color of textures that haven't been loaded yet.  Not reflective at all.
+  constexpr unsigned char placeholderColor[] = {128, 128, 128, 0};
+
+  //Look for each texture in the current directory, then in the examples that ship with skyline.
+  //Files that aren't in either place keep their original names and fail to decode.
+  //TODO: Look for texture search directories in the YAML file.
+  std::vector<std::string> findTextures(const std::vector<std::string>& fileNames)
+  {
+    std::vector<std::string> paths;
+    paths.reserve(fileNames.size());
+    for(const auto& name: fileNames)
+    {
+      const std::string example = std::string(INSTALL_DIR) + "/include/examples/" + name;
+      if(!std::ifstream(name) && std::ifstream(example)) paths.push_back(example);
+      else paths.push_back(name);
+    }
+
+    return paths;
+  }
+}
+
+namespace app
+{
+  TextureStreamer::TextureStreamer(const std::vector<std::string>& fileNames, const unsigned int width, const unsigned int height,
+                                   const unsigned int nResident, const unsigned int nCoarse, const bool interop,
+                                   const unsigned int nDecoders): fFileNames(fileNames), fPaths(findTextures(fileNames)), fWidth(width), fHeight(height),
+                                                                                                                  fInterop(interop), fUnpackBuffer(0),
+                                                                                              fPages(fileNames.size(), cl_int2{{-1, -1}}),
+                                                                                              fPublished(fileNames.size(), cl_int2{{-1, -1}}),
+                                                                                              fFeedback(fileNames.size(), 0), fWanted(fileNames.size(), 0),
+                                                                                              fFailed(fileNames.size(), false),
+                                                                                              fPoolOwners(nResident, -1), fPoolLastUsed(nResident, 0),
+                                                                                              fCoarseOwners(nCoarse + 1, -1), fCoarseLastUsed(nCoarse + 1, 0),
+                                                                                              fFrame(0), fPending(fileNames.size(), false), fStop(false)
+  {
+    //Without interop, the pools are created in sendToGPU() when there's an OpenCL context
+    if(fInterop)
+    {
+      fPool.reset(new pool_t(fWidth, fHeight, fPoolOwners.size()));
+      fCoarsePool.reset(new pool_t(fWidth/coarseFactor, fHeight/coarseFactor, fCoarseOwners.size()));
+
+      //Fill the first layer of the coarse pool with a placeholder
+      std::vector<unsigned char> placeholder((fWidth/coarseFactor) * (fHeight/coarseFactor) * 4);
+      for(size_t pixel = 0; pixel < placeholder.size(); pixel += 4) std::copy(placeholderColor, placeholderColor + 4, placeholder.begin() + pixel);
+      fCoarsePool->insert(0, GL_RGBA, placeholder.data());
+
+      glGenBuffers(1, &fUnpackBuffer);
+    }
+    fCoarseOwners[0] = std::numeric_limits<int>::max(); //Never evict the placeholder
+
+    //hardware_concurrency() is allowed to return 0
+    const unsigned int nThreads = std::max(1u, std::min<unsigned int>(nDecoders, fFileNames.size()));
+    for(unsigned int whichThread = 0; whichThread < nThreads; ++whichThread) fDecoders.emplace_back(&TextureStreamer::decodeLoop, this);
+  }
+
+  TextureStreamer::~TextureStreamer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fStop = true;
+    }
+    fWakeUp.notify_all();
+    for(auto& decoder: fDecoders) decoder.join();
+
+    //Writes that haven't finished yet still read from fUploading, fPublished, and fFeedback
+    if(!fWrites.empty()) cl::WaitForEvents(fWrites);
+
+    for(const auto& batch: fFenced) glDeleteSync(batch.fence);
+    if(fUnpackBuffer) glDeleteBuffers(1, &fUnpackBuffer);
+  }
+
+  void TextureStreamer::sendToGPU(cl::Context& ctx)
+  {
+    //The pools never change size, so I only have to share them with OpenCL once.
+    if(!fDevPages()) //Default-constructed cl::Buffers don't refer to any memory yet
+    {
+      if(fInterop)
+      {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, fPool->name);
+        fDevPool = cl::ImageGL(ctx, CL_MEM_READ_ONLY, GL_TEXTURE_2D_ARRAY, 0, fPool->name);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, fCoarsePool->name);
+        fDevCoarsePool = cl::ImageGL(ctx, CL_MEM_READ_ONLY, GL_TEXTURE_2D_ARRAY, 0, fCoarsePool->name);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+      }
+      else
+      {
+        //The coarse pool starts with the placeholder in its first layer.  Nothing reads the other layers until
+        //a texture is uploaded to them.
+        const size_t coarseWidth = fWidth/coarseFactor, coarseHeight = fHeight/coarseFactor;
+        std::vector<unsigned char> coarse(coarseWidth * coarseHeight * 4 * fCoarseOwners.size(), 0);
+        for(size_t pixel = 0; pixel < coarseWidth * coarseHeight * 4; pixel += 4) std::copy(placeholderColor, placeholderColor + 4, coarse.begin() + pixel);
+
+        const cl::ImageFormat format(CL_RGBA, CL_UNORM_INT8);
+        fArrayPool = cl::Image2DArray(ctx, CL_MEM_READ_ONLY, format, fPoolOwners.size(), fWidth, fHeight, 0, 0);
+        fArrayCoarsePool = cl::Image2DArray(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, format, fCoarseOwners.size(), coarseWidth, coarseHeight,
+                                            coarseWidth * 4, coarseWidth * coarseHeight * 4, coarse.data());
+        fDevPool = fArrayPool;
+        fDevCoarsePool = fArrayCoarsePool;
+      }
+
+      fDevPages = cl::Buffer(ctx, fPublished.begin(), fPublished.end(), true);
+      fDevFeedback = cl::Buffer(ctx, fFeedback.begin(), fFeedback.end(), false);
+    }
+  }
+
+  void TextureStreamer::update(cl::CommandQueue& queue)
+  {
+    ++fFrame;
+
+    //Find out what the last frame needed.  This blocks on an in-order queue, so the
+    //last update()'s image writes are done with their pixels after it.
+    queue.enqueueReadBuffer(fDevFeedback, CL_TRUE, 0, sizeof(cl_uint) * fFeedback.size(), fFeedback.data());
+    fUploading.clear();
+    fWrites.clear();
+    bool pagesChanged = publishFinished();
+
+    std::vector<int> newRequests;
+    for(size_t id = 0; id < fFeedback.size(); ++id)
+    {
+      const auto levels = fFeedback[id];
+      if(!levels) continue;
+
+      if(fPages[id].x >= 0) fPoolLastUsed[fPages[id].x] = fFrame;
+      if(fPages[id].y >= 0) fCoarseLastUsed[fPages[id].y] = fFrame;
+
+      const bool missingFull = (levels & (1u << FULL)) && fPages[id].x < 0,
+                 missingCoarse = fPages[id].y < 0; //Every request needs a coarse fallback
+      if((missingFull || missingCoarse) && !fFailed[id])
+      {
+        fWanted[id] |= levels;
+        if(!fPending[id])
+        {
+          fPending[id] = true;
+          newRequests.push_back(id);
+        }
+      }
+    }
+
+    //Reset feedback for the next frame.  fFeedback won't be touched again until the
+    //next call to update() which is after this write finishes on an in-order queue.
+    std::fill(fFeedback.begin(), fFeedback.end(), 0);
+    fWrites.emplace_back();
+    queue.enqueueWriteBuffer(fDevFeedback, CL_FALSE, 0, sizeof(cl_uint) * fFeedback.size(), fFeedback.data(), nullptr, &fWrites.back());
+
+    //Exchange work with the decoding thread.  Textures that are still waiting for a layer go first.
+    std::vector<decoded> finished;
+    std::swap(finished, fWaiting);
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fRequests.insert(fRequests.end(), newRequests.begin(), newRequests.end());
+      std::move(fFinished.begin(), fFinished.end(), std::back_inserter(finished));
+      fFinished.clear();
+    }
+    if(!newRequests.empty()) fWakeUp.notify_all();
+
+    //Choose layers for textures that are ready
+    std::vector<upload> uploads;
+    std::vector<decoded> uploaded;
+    for(auto& texture: finished)
+    {
+      if(texture.full.empty())
+      {
+        std::cerr << "Failed to load a texture from " << fFileNames[texture.id] << ".  Using a placeholder instead.\n";
+        fFailed[texture.id] = true;
+        fPending[texture.id] = false;
+        continue;
+      }
+
+      //Keep this texture until there's a layer for it instead of decoding it again
+      bool noLayer = false;
+      if(fPages[texture.id].y < 0)
+      {
+        const int layer = allocate(fCoarseOwners, fCoarseLastUsed, 1);
+        if(layer < 0) noLayer = true;
+        else
+        {
+          if(fCoarseOwners[layer] >= 0) fPages[fCoarseOwners[layer]].y = fPublished[fCoarseOwners[layer]].y = -1;
+          uploads.push_back(upload{COARSE, layer, texture.coarse.data(), texture.id});
+          fCoarseOwners[layer] = texture.id;
+          fCoarseLastUsed[layer] = fFrame;
+          fPages[texture.id].y = layer;
+        }
+      }
+
+      if((fWanted[texture.id] & (1u << FULL)) && fPages[texture.id].x < 0)
+      {
+        const int layer = allocate(fPoolOwners, fPoolLastUsed, 0);
+        if(layer < 0) noLayer = true;
+        else
+        {
+          if(fPoolOwners[layer] >= 0) fPages[fPoolOwners[layer]].x = fPublished[fPoolOwners[layer]].x = -1;
+          uploads.push_back(upload{FULL, layer, texture.full.data(), texture.id});
+          fPoolOwners[layer] = texture.id;
+          fPoolLastUsed[layer] = fFrame;
+          fPages[texture.id].x = layer;
+        }
+      }
+
+      //A texture that's still missing a layer tries again next update().  Writes from this update()
+      //might be reading its other level, so fWaiting keeps it alive either way.
+      if(noLayer) fWaiting.push_back(std::move(texture));
+      else
+      {
+        fPending[texture.id] = false;
+        fWanted[texture.id] = 0;
+        uploaded.push_back(std::move(texture));
+      }
+    }
+
+    if(!uploads.empty())
+    {
+      insert(queue, uploads);
+      pagesChanged = true; //Evictions at least
+      if(fInterop)
+      {
+        //Don't wait for OpenGL here.  The kernel keeps using the coarse texture or the placeholder until a
+        //later update() sees this fence signal.  Evicted layers are already hidden, so nothing reads a layer
+        //while it's being written.
+        fFenced.push_back(fenced{glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), uploads});
+        glFlush(); //Make sure the fence gets to the GPU so that it can signal
+      }
+      else
+      {
+        //Image writes finish before anything later on queue
+        for(const auto& texture: uploads) ((texture.which == FULL)?fPublished[texture.id].x:fPublished[texture.id].y) = texture.layer;
+        std::move(uploaded.begin(), uploaded.end(), std::back_inserter(fUploading)); //Keep pixels alive until the writes finish
+      }
+    }
+
+    //fPublished doesn't change again until after the next update()'s blocking read.  So, nothing here has
+    //to wait for this write.
+    if(pagesChanged)
+    {
+      fWrites.emplace_back();
+      queue.enqueueWriteBuffer(fDevPages, CL_FALSE, 0, sizeof(cl_int2) * fPublished.size(), fPublished.data(), nullptr, &fWrites.back());
+    }
+  }
+
+  bool TextureStreamer::publishFinished()
+  {
+    bool changed = false;
+    while(!fFenced.empty())
+    {
+      const auto status = glClientWaitSync(fFenced.front().fence, 0, 0);
+      if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break; //Later fences can't have signaled either
+
+      //A texture might have been evicted from its layer while it was waiting
+      for(const auto& texture: fFenced.front().uploads)
+      {
+        const int current = (texture.which == FULL)?fPages[texture.id].x:fPages[texture.id].y;
+        if(current != texture.layer) continue;
+        ((texture.which == FULL)?fPublished[texture.id].x:fPublished[texture.id].y) = texture.layer;
+        changed = true;
+      }
+
+      glDeleteSync(fFenced.front().fence);
+      fFenced.pop_front();
+    }
+
+    return changed;
+  }
+
+  void TextureStreamer::insert(cl::CommandQueue& queue, const std::vector<upload>& uploads)
+  {
+    const size_t fullBytes = fWidth * fHeight * 4, coarseBytes = fullBytes/coarseFactor/coarseFactor;
+
+    if(fInterop)
+    {
+      //Copy every texture into 1 pixel buffer object, then let OpenGL copy from there to the pools
+      //whenever it's ready.  glTexSubImage3D() from client memory has to finish with the pixels
+      //before it returns.
+      std::vector<size_t> offsets;
+      size_t totalBytes = 0;
+      for(const auto& texture: uploads)
+      {
+        offsets.push_back(totalBytes);
+        totalBytes += (texture.which == FULL)?fullBytes:coarseBytes;
+      }
+
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, fUnpackBuffer);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, totalBytes, nullptr, GL_STREAM_DRAW); //Orphan the last frame's copies instead of waiting for them
+      auto staging = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, totalBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+      if(!staging)
+      {
+        //Fall back to uploading from client memory
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        for(const auto& texture: uploads) ((texture.which == FULL)?fPool:fCoarsePool)->insert(texture.layer, GL_RGBA, const_cast<unsigned char*>(texture.data));
+        return;
+      }
+
+      for(size_t whichUpload = 0; whichUpload < uploads.size(); ++whichUpload)
+      {
+        const auto& texture = uploads[whichUpload];
+        memcpy(staging + offsets[whichUpload], texture.data, (texture.which == FULL)?fullBytes:coarseBytes);
+      }
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+      for(size_t whichUpload = 0; whichUpload < uploads.size(); ++whichUpload)
+      {
+        const auto& texture = uploads[whichUpload];
+        ((texture.which == FULL)?fPool:fCoarsePool)->insertFromUnpackBuffer(texture.layer, GL_RGBA, offsets[whichUpload]);
+      }
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return;
+    }
+
+    //Non-blocking.  update() keeps the pixels alive in fUploading or fWaiting until the next frame.
+    for(const auto& texture: uploads)
+    {
+      const unsigned int factor = (texture.which == FULL)?1:coarseFactor;
+      cl::size_t<3> origin, region;
+      origin[0] = 0;
+      origin[1] = 0;
+      origin[2] = texture.layer;
+      region[0] = fWidth/factor;
+      region[1] = fHeight/factor;
+      region[2] = 1;
+      fWrites.emplace_back();
+      queue.enqueueWriteImage((texture.which == FULL)?fArrayPool:fArrayCoarsePool, CL_FALSE, origin, region, 0, 0, const_cast<unsigned char*>(texture.data),
+                              nullptr, &fWrites.back());
+    }
+  }
+
+  int TextureStreamer::allocate(std::vector<int>& owners, std::vector<size_t>& lastUsed, const size_t firstLayer) const
+  {
+    const auto empty = std::find(owners.begin() + firstLayer, owners.end(), -1);
+    if(empty != owners.end()) return std::distance(owners.begin(), empty);
+
+    const auto oldest = std::min_element(lastUsed.begin() + firstLayer, lastUsed.end());
+    if(oldest == lastUsed.end() || *oldest >= fFrame) return -1; //Everything is in use.  Try again next frame.
+    return std::distance(lastUsed.begin(), oldest);
+  }
+
+  void TextureStreamer::decodeLoop()
+  {
+    while(true)
+    {
+      int id;
+      {
+        std::unique_lock<std::mutex> lock(fMutex);
+        fWakeUp.wait(lock, [this] { return fStop || !fRequests.empty(); });
+        if(fStop) return;
+
+        id = fRequests.front();
+        fRequests.pop_front();
+      }
+
+      auto result = decode(id);
+
+      std::lock_guard<std::mutex> lock(fMutex);
+      fFinished.push_back(std::move(result));
+    }
+  }
+
+  TextureStreamer::decoded TextureStreamer::decode(const int id) const
+  {
+    decoded result;
+    result.id = id;
+
+    int width, height, channels;
+    auto pixels = stbi_load(fPaths[id].c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if(!pixels) return result;
+
+    //Textures don't have to match the size of the pool anymore.  Resample them instead.
+    result.full.resize(fWidth * fHeight * 4);
+    if(width == (int)fWidth && height == (int)fHeight) std::copy(pixels, pixels + result.full.size(), result.full.begin());
+    else stbir_resize_uint8(pixels, width, height, 0, result.full.data(), fWidth, fHeight, 0, 4);
+    stbi_image_free(pixels);
+
+    result.coarse.resize((fWidth/coarseFactor) * (fHeight/coarseFactor) * 4);
+    stbir_resize_uint8(result.full.data(), fWidth, fHeight, 0, result.coarse.data(), fWidth/coarseFactor, fHeight/coarseFactor, 0, 4);
+
+    return result;
+  }
+}
@@ -0,0 +1,184 @@
+//File: TextureStreamer.h
+//Brief: A TextureStreamer keeps a fixed-size pool of textures on the GPU and fills it
+//       on demand.  The kernel records which texture ids and mip levels it touched each
+//       frame in a feedback buffer.  update() reads that buffer back, asks a pool of
+//       host threads to decode any textures that aren't resident yet, and uploads whatever
+//       finished decoding into the least recently used layers of the pool.  Uploads go
+//       through a pixel buffer object with OpenGL and non-blocking image writes without it,
+//       so neither one waits for the copy to finish.  With OpenGL, the kernel only finds out
+//       about a new layer once a fence after its upload has signaled.  Until a texture
+//       arrives, the kernel falls back to a coarse version of it and then to a
+//       placeholder.  So, neither startup time nor GPU memory scales with the number of
+//       textures in a geometry file.  Without OpenGL interop, the pools are plain
+//       OpenCL image arrays instead of OpenGL textures.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_TEXTURESTREAMER_H
+#define APP_TEXTURESTREAMER_H
+
+//c++ includes
+#include <vector>
+#include <string>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+//OpenCL c++ API includes
+#include <CL/cl.hpp>
+
+//gl includes
+#include "gl/TextureArray.cpp"
+
+namespace app
+{
+  class TextureStreamer
+  {
+    public:
+      //Mip levels that the kernel can request.  FULL textures live in pool(), and
+      //COARSE textures live in coarsePool().
+      enum level
+      {
+        FULL = 0,
+        COARSE = 1
+      };
+
+      //Coarse textures are this many times smaller than full textures along each axis.
+      static constexpr unsigned int coarseFactor = 8;
+
+      //fileNames are indexed by the texture ids that materials refer to.  Nothing is
+      //decoded until the kernel asks for it.  All textures are resampled to width x height
+      //in the full pool.  If interop is false, no OpenGL context is needed.  nDecoders
+      //threads decode textures at the same time.
+      TextureStreamer(const std::vector<std::string>& fileNames, const unsigned int width, const unsigned int height,
+                      const unsigned int nResident, const unsigned int nCoarse, const bool interop = true,
+                      const unsigned int nDecoders = std::thread::hardware_concurrency());
+      ~TextureStreamer();
+
+      //Create OpenCL handles to the texture pools and allocate the feedback buffer.
+      void sendToGPU(cl::Context& ctx);
+
+      //Call once per frame after the kernel that writes feedback() has finished and
+      //before the pools are acquired for the next frame.  Reads back which textures
+      //were used, requests the ones that are missing, and uploads finished textures.
+      void update(cl::CommandQueue& queue);
+
+      //Application handles to data on the GPU.  The pools are cl::ImageGLs that have to be
+      //acquired before each kernel that uses them with interop and cl::Image2DArrays without.
+      inline const cl::Memory& pool() const { return fDevPool; }
+      inline const cl::Memory& coarsePool() const { return fDevCoarsePool; }
+      inline const cl::Buffer& pages() const { return fDevPages; }
+      inline const cl::Buffer& feedback() const { return fDevFeedback; }
+
+      //Metadata for a user interface
+      inline unsigned int width() const { return fWidth; }
+      inline unsigned int height() const { return fHeight; }
+      inline unsigned int nResident() const { return fPoolOwners.size(); }
+      inline unsigned int nCoarse() const { return fCoarseOwners.size() - 1; } //Not counting the placeholder
+
+      //Whether any texture the kernel asked for is still being decoded.  Offline rendering waits
+      //for this to be false so that no samples see a placeholder.
+      inline bool loading() const { return std::find(fPending.begin(), fPending.end(), true) != fPending.end(); }
+
+      //A texture that a decoding thread finished
+      struct decoded
+      {
+        int id;
+        std::vector<unsigned char> full; //Empty if decoding failed
+        std::vector<unsigned char> coarse;
+      };
+
+      //Load and resample one texture.  Runs on fDecoders and anywhere else that needs textures
+      //on the host like app::CPURenderer.  Safe to call from any thread.
+      decoded decode(const int id) const;
+
+      inline size_t nTextures() const { return fFileNames.size(); }
+
+    private:
+
+      //Configuration
+      const std::vector<std::string> fFileNames;
+      const std::vector<std::string> fPaths; //Where each file was found.  Looked up once instead of for every decode.
+      const unsigned int fWidth; //Size of each texture in the full pool
+      const unsigned int fHeight;
+      const bool fInterop; //Whether the pools are shared with OpenGL
+
+      //Texture pools on the GPU.  The first layer of fCoarsePool is a placeholder
+      //for textures that haven't been decoded yet.
+      using pool_t = gl::TextureArray<GL_RGBA8, GL_UNSIGNED_BYTE>;
+      std::unique_ptr<pool_t> fPool;
+      std::unique_ptr<pool_t> fCoarsePool;
+      GLuint fUnpackBuffer; //Pixel buffer object that uploads to fPool and fCoarsePool are staged in
+
+      //Residency bookkeeping on the host
+      std::vector<cl_int2> fPages; //Layer in {fPool, fCoarsePool} for each texture id, or -1 if not resident
+      std::vector<cl_int2> fPublished; //What the kernel sees in fDevPages.  Like fPages, but layers OpenGL is still filling are -1.
+      std::vector<cl_uint> fFeedback; //Mip levels requested by the last frame for each texture id
+      std::vector<cl_uint> fWanted; //Mip levels requested since each texture was last decoded
+      std::vector<bool> fFailed; //Textures that couldn't be loaded.  Don't keep trying to load them.
+      std::vector<int> fPoolOwners; //Texture id in each layer of fPool, or -1 if empty
+      std::vector<size_t> fPoolLastUsed; //Frame when each layer of fPool was last used
+      std::vector<int> fCoarseOwners;
+      std::vector<size_t> fCoarseLastUsed;
+      size_t fFrame; //Number of times update() has been called
+
+      //Data on the GPU
+      cl::Memory fDevPool;
+      cl::Memory fDevCoarsePool;
+      cl::Image2DArray fArrayPool; //Only without interop.  fDevPool refers to the same memory.
+      cl::Image2DArray fArrayCoarsePool;
+      cl::Buffer fDevPages;
+      cl::Buffer fDevFeedback;
+
+      //A decoded texture that update() chose a layer for
+      struct upload
+      {
+        level which;
+        int layer;
+        const unsigned char* data;
+        int id;
+      };
+
+      //Uploads that OpenGL might still be working on.  fence signals when they're done.
+      struct fenced
+      {
+        GLsync fence;
+        std::vector<upload> uploads; //data is dangling by now.  Only which, layer, and id mean anything.
+      };
+      std::deque<fenced> fFenced; //Oldest first
+
+      //Decoded textures that are still being copied to the pools.  Without interop, image writes
+      //don't block, so their pixels have to live until the queue is done with them.
+      std::vector<decoded> fUploading;
+      std::vector<cl::Event> fWrites; //Writes from the last update() that read from fUploading, fPublished, or fFeedback
+
+      //Communication with the decoding threads
+      std::mutex fMutex;
+      std::condition_variable fWakeUp;
+      std::deque<int> fRequests; //Texture ids to decode.  Guarded by fMutex.
+      std::vector<bool> fPending; //Texture ids that have been requested but not uploaded.  Only used by the render thread.
+      std::vector<decoded> fFinished; //Guarded by fMutex.
+      std::vector<decoded> fWaiting; //Decoded textures that didn't get a layer because every layer was used that frame.  Only used by the render thread.
+      bool fStop; //Guarded by fMutex.
+      std::vector<std::thread> fDecoders; //Must be constructed last
+
+      //Body of each thread in fDecoders
+      void decodeLoop();
+
+      //Show the kernel the layers of every upload in fFenced whose fence has signaled.  Never waits.
+      //Returns whether fPublished changed.
+      bool publishFinished();
+
+      //Put decoded textures into layers of the pools.  Doesn't wait for the copies to finish.
+      //With interop, they all share 1 trip through fUnpackBuffer.
+      void insert(cl::CommandQueue& queue, const std::vector<upload>& uploads);
+
+      //Choose a layer in a pool for a new texture.  Prefers empty layers, then the least recently
+      //used layer that wasn't used this frame.  Returns -1 if every layer is in use.
+      int allocate(std::vector<int>& owners, std::vector<size_t>& lastUsed, const size_t firstLayer) const;
+  };
+}
+
+#endif //APP_TEXTURESTREAMER_H
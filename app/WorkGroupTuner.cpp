@@ -0,0 +1,101 @@
+//File: WorkGroupTuner.cpp
+//Brief: A WorkGroupTuner chooses how many pixels wide each square work group of
+//       the path tracing kernel is.  The first time skyline runs on a device, it
+//       times a few frames with each tile size that fits in a work group and keeps
+//       the fastest one.  The choice is cached in a YAML file in the user's home
+//       directory so that later runs on the same device and driver start with it.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//OpenCL includes
+#define __CL_ENABLE_EXCEPTIONS //OpenCL c++ API now throws exceptions
+#include <CL/cl.hpp>
+
+//app includes
+#include "app/WorkGroupTuner.h"
+
+//yaml-cpp includes
+#include "yaml-cpp/yaml.h"
+
+//c++ includes
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdlib> //std::getenv()
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
+
+namespace app
+{
+  WorkGroupTuner::WorkGroupTuner(const cl::Device& device, const size_t maxWorkGroupSize): fKey(device.getInfo<CL_DEVICE_NAME>() + " " + device.getInfo<CL_DRIVER_VERSION>()),
+                                                                                          fCandidate(0), fFrames(0), fBest(1)
+  {
+    //Tiles smaller than 4 x 4 don't share enough to be worth trying
+    for(int size = 4; (size_t)(size * size) <= maxWorkGroupSize; size *= 2) fCandidates.push_back(size);
+    if(fCandidates.empty()) fCandidates.push_back(1);
+    fTimes.resize(fCandidates.size(), 0.f);
+
+    //Skip tuning if this device has been tuned before
+    const auto fileName = cacheFile();
+    if(fileName.empty() || !fs::exists(fileName)) return;
+
+    try
+    {
+      const auto cache = YAML::LoadFile(fileName);
+      if(cache[fKey])
+      {
+        const int cached = cache[fKey].as<int>();
+        if(std::find(fCandidates.begin(), fCandidates.end(), cached) != fCandidates.end())
+        {
+          fBest = cached;
+          fCandidate = fCandidates.size();
+        }
+      }
+    }
+    catch(const YAML::Exception& e)
+    {
+      std::cerr << "Couldn't read work group sizes from " << fileName << " because:\n" << e.what() << "\nTuning again.\n";
+    }
+  }
+
+  void WorkGroupTuner::record(const float kernelTime)
+  {
+    if(done()) return;
+
+    //Throw out the first frame with each candidate
+    if(fFrames > 0) fTimes[fCandidate] += kernelTime;
+    if(++fFrames <= framesPerCandidate) return;
+
+    fFrames = 0;
+    if(++fCandidate < fCandidates.size()) return;
+
+    //Every candidate ran the same number of frames, so I can compare totals
+    fBest = fCandidates[std::distance(fTimes.begin(), std::min_element(fTimes.begin(), fTimes.end()))];
+    std::cout << "Chose " << fBest << " x " << fBest << " pixel work groups for " << fKey << "\n";
+
+    const auto fileName = cacheFile();
+    if(fileName.empty()) return;
+
+    try
+    {
+      YAML::Node cache;
+      if(fs::exists(fileName)) cache = YAML::LoadFile(fileName);
+      cache[fKey] = fBest;
+
+      fs::create_directories(fs::path(fileName).parent_path());
+      std::ofstream output(fileName);
+      output << cache;
+    }
+    catch(const std::exception& e) //Not being able to save the result isn't worth crashing over
+    {
+      std::cerr << "Couldn't save work group size to " << fileName << " because:\n" << e.what() << "\n";
+    }
+  }
+
+  std::string WorkGroupTuner::cacheFile() const
+  {
+    const char* home = std::getenv("HOME");
+    if(!home) return "";
+    return std::string(home) + "/.skyline/workGroups.yaml";
+  }
+}
@@ -0,0 +1,56 @@
+//File: WorkGroupTuner.h
+//Brief: A WorkGroupTuner chooses how many pixels wide each square work group of
+//       the path tracing kernel is.  The first time skyline runs on a device, it
+//       times a few frames with each tile size that fits in a work group and keeps
+//       the fastest one.  The choice is cached in a YAML file in the user's home
+//       directory so that later runs on the same device and driver start with it.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef APP_WORKGROUPTUNER_H
+#define APP_WORKGROUPTUNER_H
+
+//c++ includes
+#include <vector>
+#include <string>
+
+namespace cl
+{
+  class Device;
+}
+
+namespace app
+{
+  class WorkGroupTuner
+  {
+    public:
+      //Tile sizes to try are powers of 2 whose squares are no more than maxWorkGroupSize.
+      WorkGroupTuner(const cl::Device& device, const size_t maxWorkGroupSize);
+
+      //Whether the best tile size for this device is known yet
+      inline bool done() const { return fCandidate >= fCandidates.size(); }
+
+      //Tile size to use for the next frame.  This is the best tile size once done().
+      inline int tileSize() const { return done()?fBest:fCandidates[fCandidate]; }
+
+      //Report how long the last frame's kernel took in ms with tileSize().  Saves
+      //the best tile size when done() becomes true.
+      void record(const float kernelTime);
+
+    private:
+      //Frames to time each candidate.  The first frame after switching is thrown out because
+      //it includes warming up caches.
+      static constexpr int framesPerCandidate = 10;
+
+      std::string fKey; //Identifies this device and driver in the cache
+      std::vector<int> fCandidates;
+      std::vector<float> fTimes; //Total kernel time for each candidate
+      size_t fCandidate; //Which candidate is being timed
+      int fFrames; //Frames timed with this candidate so far
+      int fBest;
+
+      //Where tile sizes are cached.  Empty if there's no home directory.
+      std::string cacheFile() const;
+  };
+}
+
+#endif //APP_WORKGROUPTUNER_H
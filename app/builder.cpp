@@ -19,9 +19,15 @@
 #include "app/Geometry.h"
 #include "app/GUI.h"
 #include "app/LoadIntoCL.h"
+#include "app/WorkGroupTuner.h"
+#include "app/KernelVariants.h"
+#include "app/KernelReloader.h"
+#include "app/ABTest.h"
+#include "app/BoxPicker.h"
 
 //algorithms borrowed from OpenCL kernel
 #include "serial/camera.cpp"
+#include "serial/workQueue.h"
 
 //camera includes
 #include "camera/FPSController.h"
@@ -48,6 +54,9 @@
 #include <fstream>
 #include <algorithm>
 #include <memory> //std::unique_ptr
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
 
 namespace
 {
@@ -59,6 +68,38 @@ namespace
     SETUP_ERROR,
     RENDER_ERROR
   };
+
+  //Kernels built with this option read 16-bit box indices
+  const std::string shortIndexOption = " -DBOX_INDEX_16";
+
+  //Build options for the path tracing kernel that match the engine's settings.  Everything else
+  //is a kernel argument.  Settings that can take any value are only compiled in when the
+  //engine specializes kernels.  Otherwise, every gamma I try would build another variant.
+  std::string pathTraceOptions(eng::WithRandomSeeds& engine, const app::Geometry& geom)
+  {
+    std::string options = "-DTEXTURE_MODE=" + std::to_string(engine.textures());
+    if(engine.specialize())
+    {
+      options += " -DGAMMA=" + std::to_string(engine.gamma()) + "f -DN_BOUNCES=" + std::to_string(engine.nBounces())
+                 + " -DN_SAMPLES=" + std::to_string(engine.nSamples());
+    }
+    if(geom.shortIndices()) options += shortIndexOption;
+    return options;
+  }
+
+  //Whether the variant built with options reads 16-bit box indices
+  bool readsShortIndices(const std::string& options)
+  {
+    return options.find(shortIndexOption) != std::string::npos;
+  }
+
+  //The same options for a kernel that reads 32-bit box indices
+  std::string withoutShortIndices(std::string options)
+  {
+    const auto found = options.find(shortIndexOption);
+    if(found != std::string::npos) options.erase(found, shortIndexOption.size());
+    return options;
+  }
 }
 
 int main(const int argc, const char** argv)
@@ -104,7 +145,7 @@ int main(const int argc, const char** argv)
 
     try
     {
-      geom.load(argc, argv);
+      geom.load(argc, argv, true); //Start rendering while the rest of a big city loads
     }
     catch(const app::Geometry::exception& e)
     {
@@ -114,49 +155,27 @@ int main(const int argc, const char** argv)
 
     //Get the first GPU device among all platforms that matches the current OpenGL context
     auto [ctx, chosen] = app::chooseDevice(window);
-    cl::CommandQueue queue(ctx, chosen);
-
-    //Create the OpenCL kernel from installed kernels
-    auto program = app::constructSource(ctx, "kernels/skyline.cl",
-                                        {"serial/vector.h",
-                                         "serial/ray.h",
-                                         "serial/material.h",
-                                         "serial/aabb.h",
-                                         "serial/aabb.cpp",
-                                         "serial/sphere.h",
-                                         "serial/sphere.cpp",
-                                         "serial/groundPlane.h",
-                                         "serial/groundPlane.cpp",
-                                         "serial/grid.h",
-                                         "serial/grid.cpp",
-                                         "serial/gridCell.h",
-                                         "serial/gridCell.cpp",
-                                         "kernels/linearCongruential.cl",
-                                         "serial/camera.h",
-                                         "serial/camera.cpp"
-                                        });
-
-    //Build OpenCL program
-    try
-    {
-      program.build();
-    }
-    catch(const cl::Error& e)
-    {
-      const auto status = program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(chosen);
-      if(status == CL_BUILD_ERROR)
-      {
-        const auto name = chosen.getInfo<CL_DEVICE_NAME>();
-        const auto log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(chosen);
-        std::cerr << "The program for device " << name << " failed because:\n" << log << "\n";
-        return SETUP_ERROR;
-      }
-      
-      std::cerr << "Got unrecognized error when building OpenCL program: " << e.err() << ": " << e.what() << "\n";
-      return SETUP_ERROR;
-    }
-
-    auto pathTrace = cl::make_kernel<cl::ImageGL, cl::Sampler, cl::Image2D, cl::Buffer, cl::Buffer, cl::Buffer, grid, cl::Buffer, sphere, sphere, cl_float3, cl_float2, camera, int, cl::Buffer, int, int, cl::ImageGL, cl::Sampler>(cl::Kernel(program, "pathTrace"));
+    cl::CommandQueue queue(ctx, chosen, CL_QUEUE_PROFILING_ENABLE); //Profiling for the metrics window
+
+    //Reload kernels from the source tree while I edit them.  Fall back to the installed kernels when
+    //builder runs somewhere without the source code.
+    const std::string kernelDir = fs::is_directory(std::string(SOURCE_DIR) + "/kernels")?std::string(SOURCE_DIR):std::string(INSTALL_DIR) + "/include";
+    app::KernelReloader reloader(ctx, chosen, kernelDir, "kernels/skyline.cl", app::skylineIncludes(), "pathTrace");
+    std::shared_ptr<app::KernelVariants> requestedVariants = reloader.variants(), activeVariants = requestedVariants;
+    using pathTrace_t = cl::make_kernel<cl::ImageGL, cl::Sampler, cl::Image2D, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, grid, cl::Buffer, sphere, cl::Image2D, sphere, cl_float3, cl_float2, camera, int, cl::Buffer, int, int, cl::Memory, cl::Memory, cl::Buffer, cl::Buffer, cl::Sampler, cl::Buffer,
+                                        cl::LocalSpaceArg, int, cl::LocalSpaceArg, cl::LocalSpaceArg, int, cl::Buffer, float>;
+
+    //Primary ray tiles get whatever __local memory the kernel doesn't already use.  With 48kiB of
+    //__local memory, that's about 1300 boxes.
+    constexpr int maxTileCells = 256;
+    const size_t localMem = chosen.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+
+    //Persistent threads only help if all of their work groups run at the same time.  OpenCL 1.2 can't tell
+    //me how many work groups fit on a compute unit, so guess from how many work items a GPU core usually
+    //keeps in flight.  A CPU core runs 1 work group at a time.
+    const size_t computeUnits = chosen.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    const bool isCPU = (chosen.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU);
+    constexpr size_t residentWorkItemsPerUnit = 2048;
 
     //Set up viewport
     int width, height;
@@ -185,12 +204,53 @@ int main(const int argc, const char** argv)
     ImGui_ImplOpenGL3_Init("#version 420");
 
     //Set up geometry to send to the GPU.  It was read in from the command line in a file.
-    geom.sendToGPU(ctx);
+    try
+    {
+      geom.sendToGPU(ctx, queue);
+    }
+    catch(const app::Geometry::exception& e)
+    {
+      std::cerr << e.what();
+      return CMD_LINE_ERROR;
+    }
     cl::Sampler sampler(ctx, false, CL_ADDRESS_CLAMP, CL_FILTER_NEAREST),
                 textureSampler(ctx, true, CL_ADDRESS_REPEAT, CL_FILTER_LINEAR);
 
+    //Build the kernel for the engine's starting settings.  Other variants are built when the settings change.
+    std::string requestedOptions = ::pathTraceOptions(change, geom), currentOptions = requestedOptions;
+    const app::KernelVariants::variant* current = nullptr;
+    try
+    {
+      current = &activeVariants->get(currentOptions);
+    }
+    catch(const app::KernelVariants::buildError& e)
+    {
+      std::cerr << e.what();
+      return SETUP_ERROR;
+    }
+
+    //Time each tile size the first time I see this device
+    app::WorkGroupTuner tuner(chosen, current->maxWorkGroupSize);
+    change.tileSize() = tuner.tileSize();
+
     //Selection state
     std::unique_ptr<app::Geometry::selected> selection;
+    std::vector<std::unique_ptr<app::Geometry::selected>> multiSelection; //Boxes in the last rectangle the user drew
+    app::BoxPicker picker(ctx);
+
+    //Time that the last frame's kernel took in ms
+    float kernelTime = 0.;
+
+    //Grid traversal counters from the last frame
+    const traversalStats noStats = {0, 0, 0, 0};
+    traversalStats stats = noStats;
+    cl::Buffer statsBuffer(ctx, CL_MEM_READ_WRITE, sizeof(traversalStats));
+
+    //Which tiles each frame renders
+    cl::Buffer workBuffer(ctx, CL_MEM_READ_WRITE, sizeof(workQueue));
+
+    //Alternates 2 kernel variants when turned on in the kernels window
+    app::ABTest abTest;
 
     //Render loop that calls OpenCL kernel
     while(!glfwWindowShouldClose(window))
@@ -203,36 +263,180 @@ int main(const int argc, const char** argv)
       //Run the skyline engine
       try
       {
-        std::vector<cl::Memory> mem = {*(change.glImage), geom.textures()};
+        //Add boxes that finished loading since the last frame.  Selections refer to boxes by
+        //index, and indices move when new boxes are added.
+        if(geom.loading())
+        {
+          try
+          {
+            if(geom.loadMore())
+            {
+              selection.reset();
+              multiSelection.clear();
+              geom.sendToGPU(ctx, queue, true);
+              change.onCameraChange();
+            }
+          }
+          catch(const app::Geometry::exception& e)
+          {
+            std::cerr << "Stopped loading boxes: " << e.what() << "\n";
+          }
+        }
+
+        //Grids for big cities are built on a worker thread.  Start rendering the new one between frames
+        //once it's on the GPU.
+        try
+        {
+          if(geom.updateRebuild(ctx, queue)) change.onCameraChange();
+        }
+        catch(const app::Geometry::exception& e)
+        {
+          std::cerr << "Failed to rebuild the grid: " << e.what() << "\n";
+        }
+
+        //Upload textures that the last frame asked for before OpenCL takes the texture pools
+        auto& textures = geom.textures();
+        textures.update(queue);
+
+        std::vector<cl::Memory> mem = {*(change.glImage), textures.pool(), textures.coarsePool()};
         queue.enqueueAcquireGLObjects(&mem);
-        pathTrace(cl::EnqueueArgs(queue, cl::NDRange(change.fWidth, change.fHeight)),
-                  *(change.glImage), sampler, *(change.clImage),
-                  geom.boxes(), geom.gridIndices(), geom.gridCells(),
-                  geom.gridSize(), geom.materials(),
-                  geom.sky(), geom.sun(), geom.sunEmission().data,
-                  geom.groundTexNorm().data, change.camera().state(),
-                  change.nBounces(), change.seeds(), ++change.nIterations(),
-                  change.nSamples(), geom.textures(), textureSampler);
+        queue.enqueueWriteBuffer(statsBuffer, CL_FALSE, 0, sizeof(traversalStats), &noStats);
+        //Switch kernels when a setting that's compiled in changes or the reloader built a new program.
+        //Only try to build each new set of options once.
+        const auto engineOptions = ::pathTraceOptions(change, geom);
+        const auto options = abTest.enabled?engineOptions + " " + abTest.current():engineOptions;
+        if(abTest.enabled) reloader.setOptions({engineOptions + " " + abTest.options[0], engineOptions + " " + abTest.options[1]});
+        else reloader.setOptions({options});
+
+        const auto newest = reloader.variants();
+        if(options != requestedOptions || newest != requestedVariants)
+        {
+          requestedOptions = options;
+          requestedVariants = newest;
+          try
+          {
+            current = &newest->get(options);
+            currentOptions = options;
+            activeVariants = newest;
+          }
+          catch(const app::KernelVariants::buildError& e)
+          {
+            std::cerr << e.what() << "Keeping the last kernel that built.\n";
+            if(abTest.enabled)
+            {
+              abTest.enabled = false;
+              abTest.error = "Stopped because options \"" + options + "\" didn't build.  See the terminal for the build log.";
+            }
+          }
+        }
+
+        //The variant that's running has to agree with geom about how wide box indices are.  If the
+        //variant for geom's indices didn't build, the last one that did might want 16-bit indices
+        //that geom doesn't have anymore.  Every grid has 32-bit indices, so use those instead.
+        if(::readsShortIndices(currentOptions) && !geom.shortIndices())
+        {
+          try
+          {
+            current = &activeVariants->get(::withoutShortIndices(currentOptions));
+            currentOptions = ::withoutShortIndices(currentOptions);
+          }
+          catch(const app::KernelVariants::buildError& e)
+          {
+            std::cerr << e.what() << "No kernel that built can read this grid's box indices.\n";
+            return SETUP_ERROR;
+          }
+        }
+        pathTrace_t pathTrace(current->kernel);
+        const bool shortIndices = ::readsShortIndices(currentOptions);
+
+        const size_t maxTileWorkItems = current->maxWorkGroupSize,
+                     localMemUsed = current->localMemSize + maxTileCells * sizeof(gridCell);
+        const int maxTileBoxes = (localMem > localMemUsed)?(localMem - localMemUsed)/(sizeof(aabbBounds) + sizeof(cl_int)):0;
+
+        //Each work group is a square tile of pixels in Morton order.  Tiles have to be a power of 2 wide
+        //and fit in a work group.  Round the number of work items up to a whole number of tiles.
+        auto& tileSize = change.tileSize();
+        if(!tuner.done()) tileSize = tuner.tileSize();
+        tileSize = std::max(tileSize, 1);
+        while(tileSize & (tileSize - 1)) tileSize &= tileSize - 1;
+        while(tileSize * tileSize > (int)maxTileWorkItems) tileSize /= 2;
+        const int nTiles = ((change.fWidth + tileSize - 1)/tileSize) * ((change.fHeight + tileSize - 1)/tileSize);
+        const bool tiled = (change.localTiles() && maxTileBoxes > 0);
+
+        //Render up to tilesPerFrame tiles starting where the last frame stopped.  Every pixel in an iteration
+        //has to get the same weight, so a frame never crosses into the next iteration.
+        auto& nextTile = change.nextTile();
+        if(nextTile >= nTiles) nextTile = 0; //Finished the last iteration, or the window shrank
+        if(nextTile == 0) ++change.nIterations();
+        const int nTilesThisFrame = (change.tilesPerFrame() > 0)?std::min(change.tilesPerFrame(), nTiles - nextTile):nTiles - nextTile;
+        const workQueue work = {0, nextTile, nTilesThisFrame, 0};
+        queue.enqueueWriteBuffer(workBuffer, CL_FALSE, 0, sizeof(workQueue), &work);
+
+        //Persistent work groups take tiles from workBuffer until they're all done.  Otherwise, every tile
+        //gets its own work group.  Tiles take up all of __local memory, so only 1 fits on a compute unit.
+        const size_t groupSize = tileSize * tileSize,
+                     groupsPerUnit = (isCPU || tiled)?1:std::max<size_t>(1, residentWorkItemsPerUnit/groupSize),
+                     nGroups = change.persistent()?std::min<size_t>(nTilesThisFrame, computeUnits * groupsPerUnit):nTilesThisFrame;
+
+        auto kernelDone = pathTrace(cl::EnqueueArgs(queue, cl::NDRange(nGroups * groupSize), cl::NDRange(groupSize)),
+                                    *(change.glImage), sampler, *(change.clImage),
+                                    geom.boxes(), geom.bounds(), shortIndices?geom.gridIndices16():geom.gridIndices(), geom.gridCells(),
+                                    geom.gridSize(), geom.materials(),
+                                    geom.sky(), geom.skyMap(), geom.sun(), geom.sunEmission().data,
+                                    geom.groundTexNorm().data, change.camera().state(),
+                                    change.nBounces(), change.seeds(), change.nIterations(),
+                                    change.nSamples(), textures.pool(), textures.coarsePool(),
+                                    textures.pages(), textures.feedback(), textureSampler, statsBuffer,
+                                    cl::Local(tiled?maxTileCells*sizeof(gridCell):sizeof(gridCell)), maxTileCells,
+                                    cl::Local(tiled?maxTileBoxes*sizeof(cl_int):sizeof(cl_int)),
+                                    cl::Local(tiled?maxTileBoxes*sizeof(aabbBounds):sizeof(aabbBounds)), tiled?maxTileBoxes:0,
+                                    workBuffer, change.gamma());
+        nextTile += nTilesThisFrame;
 
         if(!io.WantCaptureMouse)
         {
+          //Shift + drag draws a rectangle that selects every box visible in it
+          const ImVec2 dragStart = io.MouseClickedPos[0], dragEnd = ImGui::GetMousePos();
+          const bool dragged = (ImGui::GetMouseDragDelta(0).x != 0 || ImGui::GetMouseDragDelta(0).y != 0);
           if(ImGui::IsMouseDoubleClicked(0))
           {
+            //Everything I need to know about what's under the mouse is 1 pixel of what pickBoxes sees
             const auto pos = ImGui::GetMousePos();
-            //GLFW's pixels have the reverse convention of OpenGL textures in the y direction.  So, I have
-            //to flip pos.y before using it with generateRay().
-            size_t seed = 0; //I don't care about what random subpixel jitter I apply here
-            const auto fromCamera = generateRay(change.camera().state(), cl::int2{pos.x, abs(pos.y - change.fHeight)},
-                                                change.fWidth, change.fHeight, &seed);
+            picker.render(queue, current->program, geom, shortIndices, change.camera().state(), change.fWidth, change.fHeight);
+            const int hit = picker.at(queue, geom, cl::int2{(int)pos.x, (int)pos.y});
 
             //TODO: Check whether I'm clicking on the sun
-            //TODO: CTRL + click for multi-selection
-            selection = std::move(geom.select(fromCamera));
+            multiSelection.clear(); //Adding a box below would invalidate them anyway
+            if(hit >= 0) selection = geom.select(hit);
+            else
+            {
+              //Clicked on the sky or the ground, so make a new box where this ray ends.  GLFW's pixels have the
+              //reverse convention of OpenGL textures in the y direction.  So, I have to flip pos.y before using it
+              //with generateRay().
+              size_t seed = 0; //I don't care about what random subpixel jitter I apply here
+              const auto fromCamera = generateRay(change.camera().state(), cl::int2{pos.x, abs(pos.y - change.fHeight)},
+                                                  change.fWidth, change.fHeight, &seed);
+              selection = std::move(geom.select(fromCamera));
+            }
 
-            geom.sendToGPU(ctx);
+            geom.sendToGPU(ctx, queue, true);
             change.onCameraChange();
           }
-          else app::handleCamera(change, io);
+          else if(io.KeyShift && ImGui::IsMouseDown(0))
+          {
+            ImGui::GetForegroundDrawList()->AddRectFilled(dragStart, dragEnd, IM_COL32(100, 150, 255, 50));
+            ImGui::GetForegroundDrawList()->AddRect(dragStart, dragEnd, IM_COL32(100, 150, 255, 255));
+          }
+          else if(io.KeyShift && ImGui::IsMouseReleased(0) && dragged)
+          {
+            picker.render(queue, current->program, geom, shortIndices, change.camera().state(), change.fWidth, change.fHeight);
+            const auto visible = picker.inRectangle(queue, current->program, geom, cl::int2{(int)dragStart.x, (int)dragStart.y},
+                                                    cl::int2{(int)dragEnd.x, (int)dragEnd.y});
+            selection.reset();
+            multiSelection.clear();
+            for(const int box: visible) multiSelection.push_back(geom.select(box));
+          }
+          else if(!io.KeyShift) app::handleCamera(change, io);
         }
 
         //Draw GUI while kernel is running
@@ -240,25 +444,40 @@ int main(const int argc, const char** argv)
         {
           if(app::drawFile(geom))
           {
-            geom.sendToGPU(ctx);
+            try
+            {
+              geom.sendToGPU(ctx, queue);
+            }
+            catch(const app::Geometry::exception& e)
+            {
+              std::cerr << "Failed to build a grid for the new file: " << e.what() << "\n";
+            }
             change.onCameraChange();
           }
           //TODO: edit menu with materials and skybox options
           app::drawCameras(geom, change);
-          app::drawMetrics(io);
+          app::drawMetrics(io, kernelTime, stats);
           app::drawHelp();
 
-          if(app::drawGrid(geom)) geom.sendToGPU(ctx);
+          if(app::drawGrid(geom)) geom.sendToGPU(ctx, queue, true);
           if(app::drawBackground(geom)) change.onCameraChange();
           if(app::drawEngine(change)) change.onCameraChange();
+          app::drawKernels(reloader, abTest);
+          app::drawLoading(geom);
           ImGui::EndMainMenuBar();
 
+          if(!multiSelection.empty() && app::editBoxes(multiSelection, geom))
+          {
+            geom.sendToGPU(ctx, queue, true);
+            change.onCameraChange();
+          }
+
           if(selection)
           {
             if(app::editBox(selection, geom))
             {
               //Only update GPU data if something changed.
-              geom.sendToGPU(ctx);
+              geom.sendToGPU(ctx, queue, true);
               change.onCameraChange();
             }
 
@@ -267,6 +486,10 @@ int main(const int argc, const char** argv)
         }
 
         queue.finish();
+        queue.enqueueReadBuffer(statsBuffer, CL_TRUE, 0, sizeof(traversalStats), &stats);
+        kernelTime = (kernelDone.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernelDone.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 1.e-6; //ns to ms
+        tuner.record(kernelTime);
+        if(abTest.enabled) abTest.record(kernelTime);
         queue.enqueueReleaseGLObjects(&mem);
       }
       catch(const cl::Error& e)
@@ -0,0 +1,70 @@
+//File: convertScene.cpp
+//Brief: Convert a skyline geometry file between YAML and the binary SceneFile format.  The
+//       direction depends on what the output file is called: .yaml and .yml files are YAML,
+//       and anything else is a SceneFile.  Either kind of file can be the input.  Building
+//       the grid for a big city takes a while, so convert it to a SceneFile once and let
+//       builder and skyline-render load that instead.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//app includes
+#include "app/Geometry.h"
+
+//c++ includes
+#include <iostream>
+#include <chrono>
+#include <string>
+
+#define USAGE "Usage: convertScene <input> <output>\n\n"\
+              "convertScene: Convert a skyline geometry file between YAML and the\n"\
+              "              binary scene format that loads without parsing.  Writes\n"\
+              "              YAML if output ends in .yaml or .yml and a binary scene\n"\
+              "              file otherwise.  Binary scene files include the grid, so\n"\
+              "              the grid and largeBoxCells settings from the input are\n"\
+              "              applied before converting.\n"
+
+namespace
+{
+  bool endsWith(const std::string& name, const std::string& suffix)
+  {
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+}
+
+int main(const int argc, const char** argv)
+{
+  if(argc != 3)
+  {
+    std::cerr << USAGE;
+    return 1;
+  }
+
+  const std::string input = argv[1], output = argv[2];
+  app::Geometry geom(false); //Nothing here needs OpenGL
+
+  try
+  {
+    const auto start = std::chrono::steady_clock::now();
+    geom.load(input);
+    const auto loaded = std::chrono::steady_clock::now();
+
+    if(endsWith(output, ".yaml") || endsWith(output, ".yml")) geom.write(output);
+    else geom.writeScene(output);
+    const auto written = std::chrono::steady_clock::now();
+
+    std::cout << "Converted " << geom.nBoxes() << " boxes from " << input << " to " << output << ".  Loading took "
+              << std::chrono::duration<double>(loaded - start).count() << "s, and writing took "
+              << std::chrono::duration<double>(written - loaded).count() << "s.\n";
+  }
+  catch(const app::Geometry::exception& e)
+  {
+    std::cerr << e.what();
+    return 1;
+  }
+  catch(const YAML::Exception& e)
+  {
+    std::cerr << "Failed to write " << output << ": " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
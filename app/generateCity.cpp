@@ -0,0 +1,158 @@
+//File: generateCity.cpp
+//Brief: Write a YAML geometry file for a large, randomly generated city.  Useful for
+//       benchmarking acceleration structures on scenes that are much bigger than
+//       anything I want to build by hand in builder.  Long buildings and plazas
+//       span several grid cells on purpose.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//serial includes
+#define NOT_ON_DEVICE
+#include "serial/vector.h"
+
+//algebra includes
+#include "algebra/YAMLIntegration.h"
+
+//yaml-cpp includes
+#include "yaml-cpp/yaml.h"
+
+//c++ includes
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <string>
+
+#define USAGE "Usage: generateCity <nBlocksX> <nBlocksZ> <output.yaml> [seed]\n\n"\
+              "generateCity: Write a skyline geometry file with a grid of city blocks.\n"\
+              "              Each block has a few buildings of random heights.  Some\n"\
+              "              blocks have a long building or a plaza that covers more\n"\
+              "              than one grid cell, and elevated highways cross the\n"\
+              "              whole city.  Open the result with builder.\n"
+
+namespace
+{
+  //Dimensions of the city in the same units as the YAML file
+  constexpr float blockSize = 1.f, streetWidth = 0.2f, maxHeight = 1.5f;
+
+  YAML::Node material(const std::string& wall, const std::string& roof)
+  {
+    YAML::Node mat;
+    mat["emission"] = cl::float3{0.f, 0.f, 0.f};
+    mat["left"] = wall;
+    mat["right"] = wall;
+    mat["front"] = wall;
+    mat["back"] = wall;
+    mat["top"] = roof;
+    mat["bottom"] = roof;
+    return mat;
+  }
+
+  void addBox(YAML::Node& geometry, const std::string& name, const cl::float3 center, const cl::float3 width, const std::string& material)
+  {
+    auto box = geometry[name];
+    box["center"] = center;
+    box["width"] = width;
+    box["texNorm"] = width;
+    box["material"] = material;
+  }
+}
+
+int main(const int argc, const char** argv)
+{
+  if(argc < 4 || argc > 5)
+  {
+    std::cerr << USAGE;
+    return 1;
+  }
+
+  const int nBlocksX = std::stoi(argv[1]), nBlocksZ = std::stoi(argv[2]);
+  if(nBlocksX < 1 || nBlocksZ < 1)
+  {
+    std::cerr << "Need at least 1 block in each direction.\n\n" << USAGE;
+    return 1;
+  }
+  std::mt19937 gen((argc == 5)?std::stoul(argv[4]):0);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+  YAML::Node city;
+  city["sky"] = "1024x512/small_harbor_02_1k.hdr";
+  city["ground"]["file"] = "1024x512/StoneStreetIntersection.png";
+  city["ground"]["texNorm"] = cl::float2{3.5f, 3.5f};
+  city["sun"]["color"] = cl::float3{20.f, 16.f, 12.f};
+  city["sun"]["center"] = cl::float3{7.071068f, 7.071068f, 0.f};
+  city["sun"]["radius"] = 2.f;
+
+  city["materials"]["marble"] = ::material("1024x512/MarbleBuilding.png", "1024x512/roof.png");
+  city["materials"]["glass"] = ::material("1024x512/glassBuilding.png", "1024x512/roof.png");
+  city["materials"]["plaza"] = ::material("1024x512/StoneStreetIntersection.png", "1024x512/StoneStreetIntersection.png");
+
+  //Center the city on the origin
+  const float pitch = blockSize + streetWidth;
+  const cl::float2 corner = {-pitch*nBlocksX/2.f, -pitch*nBlocksZ/2.f};
+
+  auto geometry = city["geometry"];
+  for(int blockX = 0; blockX < nBlocksX; ++blockX)
+  {
+    for(int blockZ = 0; blockZ < nBlocksZ; ++blockZ)
+    {
+      const std::string blockName = "block_" + std::to_string(blockX) + "_" + std::to_string(blockZ);
+      const float x0 = corner.x + blockX*pitch + streetWidth/2.f, z0 = corner.y + blockZ*pitch + streetWidth/2.f;
+
+      const float roll = uniform(gen);
+      if(roll < 0.1f)
+      {
+        //A plaza that covers the whole block
+        addBox(geometry, blockName + "_plaza", cl::float3{x0 + blockSize/2.f, 0.01f, z0 + blockSize/2.f},
+               cl::float3{blockSize, 0.02f, blockSize}, "plaza");
+      }
+      else if(roll < 0.3f)
+      {
+        //A long building down the middle of the block with a few small ones beside it
+        const float height = maxHeight * (0.2f + 0.8f*uniform(gen));
+        addBox(geometry, blockName + "_long", cl::float3{x0 + blockSize/2.f, height/2.f, z0 + blockSize/4.f},
+               cl::float3{blockSize, height, blockSize/2.f}, "glass");
+        for(int which = 0; which < 3; ++which)
+        {
+          const float smallHeight = maxHeight * (0.1f + 0.4f*uniform(gen));
+          addBox(geometry, blockName + "_" + std::to_string(which),
+                 cl::float3{x0 + (which + 0.5f)*blockSize/3.f, smallHeight/2.f, z0 + 0.75f*blockSize},
+                 cl::float3{0.9f*blockSize/3.f, smallHeight, 0.45f*blockSize}, "marble");
+        }
+      }
+      else
+      {
+        //3 x 3 buildings
+        for(int whichX = 0; whichX < 3; ++whichX)
+        {
+          for(int whichZ = 0; whichZ < 3; ++whichZ)
+          {
+            const float height = maxHeight * (0.1f + 0.9f*uniform(gen)*uniform(gen));
+            addBox(geometry, blockName + "_" + std::to_string(whichX) + "_" + std::to_string(whichZ),
+                   cl::float3{x0 + (whichX + 0.5f)*blockSize/3.f, height/2.f, z0 + (whichZ + 0.5f)*blockSize/3.f},
+                   cl::float3{0.9f*blockSize/3.f, height, 0.9f*blockSize/3.f}, (uniform(gen) < 0.5f)?"marble":"glass");
+          }
+        }
+      }
+    }
+  }
+
+  //Elevated highways over every 8th street cover a whole row of grid cells
+  for(int street = 4; street < nBlocksZ; street += 8)
+  {
+    addBox(geometry, "highway_" + std::to_string(street), cl::float3{0.f, 0.4f, corner.y + street*pitch},
+           cl::float3{pitch*nBlocksX, 0.03f, 0.9f*streetWidth}, "plaza");
+  }
+
+  //About 2 grid cells per block so that long buildings and plazas span multiple cells
+  city["grid"] = cl::int2{2*nBlocksX, 2*nBlocksZ};
+
+  //Start at the edge of the city looking in
+  auto camera = city["cameras"]["default"];
+  camera["position"] = cl::float3{0.f, 0.3f, -corner.y + 0.5f};
+  camera["focal"] = cl::float3{0.f, 0.3f, -corner.y - 0.5f};
+
+  std::ofstream output(argv[3]);
+  output << city;
+  std::cout << "Wrote " << geometry.size() << " boxes to " << argv[3] << "\n";
+
+  return 0;
+}
@@ -0,0 +1,82 @@
+//File: gridOverflowTest.cpp
+//Brief: Make sure Geometry::buildGrid() never puts more boxes in a gridCell than gridCell can
+//       count.  A city with more than GRIDCELL_MAX_COUNT boxes overflows the default 1x1 grid,
+//       so buildGrid() has to split cells until they fit.  Boxes that are all on top of each
+//       other never fit, so buildGrid() has to throw an exception instead.  Returns 0 if both
+//       work and prints what went wrong otherwise.  An overflowing cell loses the high bits
+//       of its count, so some boxes wouldn't be in any cell.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//app includes
+#include "app/Geometry.h"
+
+//c++ includes
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+  //nBoxes 1x1x1 boxes.  Each one is spacing farther along x and z than the last.
+  std::vector<aabb> makeBoxes(const int nBoxes, const float spacing)
+  {
+    std::vector<aabb> boxes(nBoxes);
+    for(int whichBox = 0; whichBox < nBoxes; ++whichBox)
+    {
+      boxes[whichBox].width = {1.f, 1.f, 1.f};
+      boxes[whichBox].center = {whichBox * spacing, 0.5f, whichBox * spacing};
+      boxes[whichBox].texNorm = {1.f, 1.f, 1.f};
+      boxes[whichBox].material = 0;
+    }
+    return boxes;
+  }
+}
+
+int main(const int /*argc*/, const char** /*argv*/)
+{
+  const int nBoxes = GRIDCELL_MAX_COUNT + 1000;
+  int nFailed = 0;
+
+  //Spread out boxes fit after the grid is split
+  const auto boxes = makeBoxes(nBoxes, 2.f);
+  const auto [size, cells, indices] = app::Geometry::buildGrid(boxes, cl::int2{1, 1}, 0);
+
+  std::vector<bool> found(boxes.size(), false);
+  for(int whichBox = size.largeBoxes.x; whichBox < size.largeBoxes.y; ++whichBox) found[indices[whichBox]] = true;
+  for(const auto& cell: cells)
+  {
+    const int count = gridCell_count(cell);
+    if(gridCell_nShared(cell) > count || (!gridCell_isInline(cell) && cell.first + count > (int)indices.size()))
+    {
+      std::cerr << "Got a cell with " << count << " boxes, " << gridCell_nShared(cell) << " of them shared, starting at index "
+                << cell.first << " of " << indices.size() << ".\n";
+      ++nFailed;
+      break;
+    }
+    for(int which = 0; which < count; ++which) found[gridCell_volume(cell, indices.data(), which)] = true;
+  }
+
+  if(std::count(found.begin(), found.end(), false) > 0)
+  {
+    std::cerr << std::count(found.begin(), found.end(), false) << " boxes aren't in any cell.\n";
+    ++nFailed;
+  }
+  if(size.max.x * size.max.y <= 1)
+  {
+    std::cerr << "The grid wasn't split even though " << nBoxes << " boxes don't fit in 1 cell.\n";
+    ++nFailed;
+  }
+
+  //Boxes on top of each other never fit
+  try
+  {
+    app::Geometry::buildGrid(makeBoxes(nBoxes, 0.f), cl::int2{1, 1}, 0);
+    std::cerr << "Built a grid for " << nBoxes << " boxes in the same place.  At least 1 cell must have overflowed.\n";
+    ++nFailed;
+  }
+  catch(const app::Geometry::exception& /*e*/)
+  {
+  }
+
+  return nFailed;
+}
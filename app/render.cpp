@@ -0,0 +1,515 @@
+//File: render.cpp
+//Brief: Render a skyline geometry file to an image without a window.  Works
+//       on any OpenCL device that supports images, including CPU-only
+//       implementations like pocl, so it runs on render nodes and in CI.
+//       Prints how fast it rendered so that batch jobs double as
+//       performance tests.  --cpu renders with app::CPURenderer instead
+//       of OpenCL, and --compare checks the OpenCL device's image against it.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+//OpenCL includes
+#define __CL_ENABLE_EXCEPTIONS //OpenCL c++ API now throws exceptions
+#include <CL/cl.hpp>
+
+//app includes
+#include "app/Geometry.h"
+#include "app/LoadIntoCL.h"
+#include "app/KernelVariants.h"
+#include "app/CPURenderer.h"
+
+//serial includes
+#include "serial/workQueue.h"
+
+//stb includes
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image/stb_image_write.h"
+
+//c++ includes
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define USAGE "Usage: skyline-render <geometry.yaml> <output.png|output.hdr> [options]\n\n"\
+              "skyline-render: Path trace a skyline geometry file from one of its\n"\
+              "                cameras and write the result to an image.  Doesn't\n"\
+              "                need a window or OpenGL.  Prints throughput when\n"\
+              "                it's done.\n\n"\
+              "\tOptions:\n"\
+              "\t--camera <name>: Camera from the geometry file.  Defaults to the first one.\n"\
+              "\t--samples <n>: Samples per pixel.  Defaults to 64.\n"\
+              "\t--samples-per-frame <n>: Samples per pixel in each kernel launch.  Defaults to 1.\n"\
+              "\t--bounces <n>: Bounces per path.  Defaults to 4.\n"\
+              "\t--size <width> <height>: Image size in pixels.  Defaults to 800 x 600.\n"\
+              "\t--device <gpu|cpu|any>: OpenCL device type.  Defaults to any.\n"\
+              "\t--tile <n>: Pixels on each side of a work group.  Defaults to 8.\n"\
+              "\t--local-tiles: Share primary ray grid cells in __local memory.\n"\
+              "\t--gamma <g>: Gamma correction.  Defaults to 2.2.\n"\
+              "\t--cpu: Render on the CPU instead of an OpenCL device.\n"\
+              "\t--compare: Render on the CPU too and compare it to the OpenCL device's image.\n"\
+              "\t--threads <n>: CPU threads.  Defaults to every core.\n"\
+              "\t--single-rays: The CPU traces 1 ray at a time instead of packets of neighboring pixels' rays.\n"\
+              "\t--ray-benchmark: Before rendering on the CPU, time packets against single rays with 1 thread.\n"\
+              "\t--tolerance <t>: Largest RMS difference over 8 x 8 blocks that --compare accepts.\n"\
+              "\t                 Defaults to 0.02.\n\n"\
+              "\tReturn values:\n"\
+              "\t0: Wrote the image.\n"\
+              "\t1: Command line was not parsed correctly.\n"\
+              "\t2: Could not begin rendering.\n"\
+              "\t3: Rendering or writing the image failed.\n"\
+              "\t4: --compare found that the OpenCL device's image is too different from the CPU's.\n"
+
+namespace
+{
+  //Error codes returned to the operating system
+  enum errorCode
+  {
+    SUCCESS = 0,
+    CMD_LINE_ERROR,
+    SETUP_ERROR,
+    RENDER_ERROR,
+    COMPARE_ERROR
+  };
+
+  //Everything the command line can change
+  struct settings
+  {
+    std::string geometryFile;
+    std::string outputFile;
+    std::string cameraName;
+    int nSamples = 64;
+    int samplesPerFrame = 1;
+    int nBounces = 4;
+    int width = 800;
+    int height = 600;
+    cl_device_type device = CL_DEVICE_TYPE_ALL;
+    int tileSize = 8;
+    bool localTiles = false;
+    float gamma = 2.2f;
+    bool cpu = false;
+    bool compare = false;
+    int nThreads = 0; //Every core
+    bool packets = true;
+    bool rayBenchmark = false;
+    float tolerance = 0.02f;
+  };
+
+  //Throws std::invalid_argument or std::out_of_range with a message for the user if something is wrong
+  settings parse(const int argc, const char** argv)
+  {
+    if(argc < 3) throw std::invalid_argument("Need a geometry file and an output file.");
+
+    settings config;
+    config.geometryFile = argv[1];
+    config.outputFile = argv[2];
+
+    for(int arg = 3; arg < argc; ++arg)
+    {
+      const std::string flag = argv[arg];
+      const auto value = [&arg, argc, argv, &flag]()
+                         {
+                           if(++arg >= argc) throw std::invalid_argument(flag + " needs a value.");
+                           return std::string(argv[arg]);
+                         };
+
+      if(flag == "--camera") config.cameraName = value();
+      else if(flag == "--samples") config.nSamples = std::stoi(value());
+      else if(flag == "--samples-per-frame") config.samplesPerFrame = std::stoi(value());
+      else if(flag == "--bounces") config.nBounces = std::stoi(value());
+      else if(flag == "--size")
+      {
+        config.width = std::stoi(value());
+        config.height = std::stoi(value());
+      }
+      else if(flag == "--device")
+      {
+        const auto type = value();
+        if(type == "gpu") config.device = CL_DEVICE_TYPE_GPU;
+        else if(type == "cpu") config.device = CL_DEVICE_TYPE_CPU;
+        else if(type == "any") config.device = CL_DEVICE_TYPE_ALL;
+        else throw std::invalid_argument("Unknown device type " + type);
+      }
+      else if(flag == "--tile") config.tileSize = std::stoi(value());
+      else if(flag == "--local-tiles") config.localTiles = true;
+      else if(flag == "--gamma") config.gamma = std::stof(value());
+      else if(flag == "--cpu") config.cpu = true;
+      else if(flag == "--compare") config.compare = true;
+      else if(flag == "--threads") config.nThreads = std::stoi(value());
+      else if(flag == "--single-rays") config.packets = false;
+      else if(flag == "--ray-benchmark") config.rayBenchmark = true;
+      else if(flag == "--tolerance") config.tolerance = std::stof(value());
+      else throw std::invalid_argument("Unknown option " + flag);
+    }
+
+    if(config.nSamples < 1 || config.samplesPerFrame < 1 || config.nBounces < 1) throw std::invalid_argument("Samples and bounces must be at least 1.");
+    if(config.width < 1 || config.height < 1) throw std::invalid_argument("The image must be at least 1 pixel on each side.");
+    if(config.gamma <= 0.f) throw std::invalid_argument("Gamma must be positive.");
+    if(config.cpu && config.compare) throw std::invalid_argument("--compare already renders on the CPU.  Leave out --cpu.");
+    if(config.nThreads < 0) throw std::invalid_argument("The number of threads can't be negative.");
+    if(config.rayBenchmark && !config.cpu && !config.compare) throw std::invalid_argument("--ray-benchmark needs --cpu or --compare.");
+
+    return config;
+  }
+
+  //Build options for the path tracing kernel.  Offline rendering never changes settings, so
+  //bounces and samples are always compiled in.
+  std::string pathTraceOptions(const settings& config, const app::Geometry& geom)
+  {
+    std::string options = "-DGAMMA=" + std::to_string(config.gamma) + "f -DTEXTURE_MODE=0"
+                          " -DN_BOUNCES=" + std::to_string(config.nBounces) + " -DN_SAMPLES=" + std::to_string(config.samplesPerFrame);
+    if(geom.shortIndices()) options += " -DBOX_INDEX_16";
+    return options;
+  }
+
+  //Write pixels to fileName as an HDR image if it ends in .hdr and a PNG otherwise.  pixels are
+  //RGBA and gamma corrected like the kernel writes them.  Returns false if writing failed.
+  bool writeImage(const std::string& fileName, const std::vector<float>& pixels, const int width, const int height, const float gamma)
+  {
+    //OpenCL images start at the bottom like OpenGL textures, but image files start at the top
+    stbi_flip_vertically_on_write(1);
+
+    const bool hdr = (fileName.size() >= 4 && fileName.compare(fileName.size() - 4, 4, ".hdr") == 0);
+    if(hdr)
+    {
+      //HDR files store linear light
+      std::vector<float> linear(width * height * 3);
+      for(int pixel = 0; pixel < width * height; ++pixel)
+      {
+        for(int channel = 0; channel < 3; ++channel) linear[3*pixel + channel] = std::pow(std::max(pixels[4*pixel + channel], 0.f), gamma);
+      }
+      return stbi_write_hdr(fileName.c_str(), width, height, 3, linear.data());
+    }
+
+    std::vector<unsigned char> bytes(width * height * 3);
+    for(int pixel = 0; pixel < width * height; ++pixel)
+    {
+      for(int channel = 0; channel < 3; ++channel) bytes[3*pixel + channel] = std::lround(255.f * std::min(std::max(pixels[4*pixel + channel], 0.f), 1.f));
+    }
+    return stbi_write_png(fileName.c_str(), width, height, 3, bytes.data(), width * 3);
+  }
+
+  //Render on the GPU.  Fills pixels and returns SUCCESS or why it couldn't.
+  int renderOnGPU(app::Geometry& geom, const camera& view, const settings& config, const int nFrames, std::vector<float>& pixels)
+  {
+    try //Look for OpenCL errors in the whole program and print error codes for lookup
+    {
+      cl::Context ctx;
+      cl::Device chosen;
+      try
+      {
+        std::tie(ctx, chosen) = app::chooseDevice(config.device);
+      }
+      catch(const std::runtime_error& e)
+      {
+        std::cerr << e.what() << "\n";
+        return SETUP_ERROR;
+      }
+      cl::CommandQueue queue(ctx, chosen, CL_QUEUE_PROFILING_ENABLE); //Profiling to report throughput
+      std::cout << "Rendering on " << chosen.getInfo<CL_DEVICE_NAME>() << "\n";
+
+      try
+      {
+        geom.sendToGPU(ctx, queue);
+      }
+      catch(const app::Geometry::exception& e)
+      {
+        std::cerr << e.what();
+        return SETUP_ERROR;
+      }
+      cl::Sampler sampler(ctx, false, CL_ADDRESS_CLAMP, CL_FILTER_NEAREST),
+                  textureSampler(ctx, true, CL_ADDRESS_REPEAT, CL_FILTER_LINEAR);
+
+      app::KernelVariants variants(ctx, chosen, app::readSource("kernels/skyline.cl", app::skylineIncludes()), "pathTrace");
+      const app::KernelVariants::variant* pathTraceVariant = nullptr;
+      try
+      {
+        pathTraceVariant = &variants.get(::pathTraceOptions(config, geom));
+      }
+      catch(const app::KernelVariants::buildError& e)
+      {
+        std::cerr << e.what();
+        return SETUP_ERROR;
+      }
+      cl::make_kernel<cl::Image2D, cl::Sampler, cl::Image2D, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, grid, cl::Buffer, sphere, cl::Image2D, sphere, cl_float3, cl_float2, camera, int, cl::Buffer, int, int, cl::Memory, cl::Memory, cl::Buffer, cl::Buffer, cl::Sampler, cl::Buffer,
+                      cl::LocalSpaceArg, int, cl::LocalSpaceArg, cl::LocalSpaceArg, int, cl::Buffer, float> pathTrace(pathTraceVariant->kernel);
+
+      //Same work division as builder, but every frame renders the whole image
+      constexpr int maxTileCells = 256;
+      const size_t localMem = chosen.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>(),
+                   localMemUsed = pathTraceVariant->localMemSize + maxTileCells * sizeof(gridCell);
+      const int maxTileBoxes = (localMem > localMemUsed)?(localMem - localMemUsed)/(sizeof(aabbBounds) + sizeof(cl_int)):0;
+      const bool tiled = (config.localTiles && maxTileBoxes > 0);
+
+      int tileSize = std::max(config.tileSize, 1);
+      while(tileSize & (tileSize - 1)) tileSize &= tileSize - 1;
+      while(tileSize * tileSize > (int)pathTraceVariant->maxWorkGroupSize) tileSize /= 2;
+      const int nTiles = ((config.width + tileSize - 1)/tileSize) * ((config.height + tileSize - 1)/tileSize);
+      const size_t groupSize = tileSize * tileSize;
+
+      //Float images so that the average over samples isn't rounded to 8 bits every frame.  Each frame reads
+      //the last frame's image and writes the other one.  The first frame gives the image it reads a weight
+      //of 0, but garbage could still be NaN.  So, start with black.
+      const cl::ImageFormat format(CL_RGBA, CL_FLOAT);
+      std::vector<float> black(config.width * config.height * 4, 0.f);
+      cl::Image2D images[2] = {cl::Image2D(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, format, config.width, config.height, 0, black.data()),
+                               cl::Image2D(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, format, config.width, config.height, 0, black.data())};
+
+      std::vector<size_t> hostSeeds(config.width * config.height);
+      for(size_t id = 0; id < hostSeeds.size(); ++id) hostSeeds[id] = id + 1;
+      cl::Buffer seeds(ctx, hostSeeds.begin(), hostSeeds.end(), false);
+
+      const workQueue work = {0, 0, nTiles, 0};
+      cl::Buffer workBuffer(ctx, CL_MEM_READ_WRITE, sizeof(workQueue));
+
+      const traversalStats noStats = {0, 0, 0, 0};
+      traversalStats stats = noStats;
+      cl::Buffer statsBuffer(ctx, CL_MEM_READ_WRITE, sizeof(traversalStats));
+
+      auto& textures = geom.textures();
+
+      //Run 1 frame and return how long its kernel took in ms
+      const auto frame = [&](const int iteration)
+      {
+        queue.enqueueWriteBuffer(workBuffer, CL_FALSE, 0, sizeof(workQueue), &work);
+        queue.enqueueWriteBuffer(statsBuffer, CL_FALSE, 0, sizeof(traversalStats), &noStats);
+        auto kernelDone = pathTrace(cl::EnqueueArgs(queue, cl::NDRange(nTiles * groupSize), cl::NDRange(groupSize)),
+                                    images[iteration % 2], sampler, images[(iteration + 1) % 2],
+                                    geom.boxes(), geom.bounds(), geom.shortIndices()?geom.gridIndices16():geom.gridIndices(), geom.gridCells(),
+                                    geom.gridSize(), geom.materials(),
+                                    geom.sky(), geom.skyMap(), geom.sun(), geom.sunEmission().data,
+                                    geom.groundTexNorm().data, view,
+                                    config.nBounces, seeds, iteration, config.samplesPerFrame,
+                                    textures.pool(), textures.coarsePool(),
+                                    textures.pages(), textures.feedback(), textureSampler, statsBuffer,
+                                    cl::Local(tiled?maxTileCells*sizeof(gridCell):sizeof(gridCell)), maxTileCells,
+                                    cl::Local(tiled?maxTileBoxes*sizeof(cl_int):sizeof(cl_int)),
+                                    cl::Local(tiled?maxTileBoxes*sizeof(aabbBounds):sizeof(aabbBounds)), tiled?maxTileBoxes:0,
+                                    workBuffer, config.gamma);
+        queue.enqueueReadBuffer(statsBuffer, CL_TRUE, 0, sizeof(traversalStats), &stats);
+        textures.update(queue);
+        return (kernelDone.getProfilingInfo<CL_PROFILING_COMMAND_END>() - kernelDone.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 1.e-6; //ns to ms
+      };
+
+      try
+      {
+        //Textures are decoded the first time the kernel asks for them.  Don't let any samples that count
+        //see a placeholder.
+        constexpr int maxWarmUpFrames = 500;
+        int nWarmUpFrames = 0;
+        do
+        {
+          frame(1);
+          if(textures.loading()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        while(textures.loading() && ++nWarmUpFrames < maxWarmUpFrames);
+        if(nWarmUpFrames == maxWarmUpFrames) std::cerr << "Some textures still weren't loaded after " << maxWarmUpFrames << " frames.  Rendering anyway.\n";
+
+        double kernelTime = 0.; //in ms
+        size_t nRays = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for(int iteration = 1; iteration <= nFrames; ++iteration)
+        {
+          kernelTime += frame(iteration);
+          nRays += stats.nRays;
+        }
+        queue.finish();
+        const double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); //in s
+
+        //The last frame wrote to the image after the one it read
+        pixels.resize(config.width * config.height * 4);
+        cl::size_t<3> origin, region;
+        origin[0] = 0;
+        origin[1] = 0;
+        origin[2] = 0;
+        region[0] = config.width;
+        region[1] = config.height;
+        region[2] = 1;
+        queue.enqueueReadImage(images[(nFrames + 1) % 2], CL_TRUE, origin, region, 0, 0, pixels.data());
+
+        const double nSamples = (double)config.width * config.height * nFrames * config.samplesPerFrame;
+        std::cout << "GPU wall time: " << wallTime << " s, kernel time: " << kernelTime * 1.e-3 << " s\n"
+                  << "GPU throughput: " << nSamples / wallTime * 1.e-6 << " Msamples/s, " << nRays / (kernelTime * 1.e-3) * 1.e-6 << " Mrays/s\n";
+      }
+      catch(const cl::Error& e)
+      {
+        std::cerr << "Caught an OpenCL error while rendering:\n" << e.err() << ": " << e.what() << "\n";
+        return RENDER_ERROR;
+      }
+    }
+    catch(const cl::Error& e)
+    {
+      std::cerr << "Caught an OpenCL error while setting up rendering:\n" << e.err() << ": " << e.what() << "\n";
+      return SETUP_ERROR;
+    }
+
+    return SUCCESS;
+  }
+
+  //Render on the host with every core.  Doesn't need OpenCL at all.
+  std::vector<float> renderOnCPU(app::Geometry& geom, const camera& view, const settings& config, const int nFrames)
+  {
+    app::CPURenderer cpu(geom, config.nThreads);
+    const int packetSize = config.packets?cpu.packetSize():1;
+    std::cout << "Rendering on the CPU with " << cpu.nThreads() << " threads and " << packetSize << " rays per packet\n";
+
+    app::CPURenderer::settings cpuConfig;
+    cpuConfig.width = config.width;
+    cpuConfig.height = config.height;
+    cpuConfig.nBounces = config.nBounces;
+    cpuConfig.nFrames = nFrames;
+    cpuConfig.samplesPerFrame = config.samplesPerFrame;
+    cpuConfig.gamma = config.gamma;
+    cpuConfig.packets = config.packets;
+
+    if(config.rayBenchmark)
+    {
+      const auto rates = cpu.benchmark(view, cpuConfig);
+      std::cout << "Grid traversal with 1 thread in Mrays/s, single rays vs. " << cpu.packetSize() << "-ray packets:\n"
+                << "  primary: " << rates.primarySingle << " vs. " << rates.primaryPacket << " (" << rates.primaryPacket/rates.primarySingle << "x)\n"
+                << "  diffuse: " << rates.diffuseSingle << " vs. " << rates.diffusePacket << " (" << rates.diffusePacket/rates.diffuseSingle << "x)\n";
+      if(rates.mismatches > 0) std::cerr << rates.mismatches << " rays hit a different box in a packet than on their own\n";
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto pixels = cpu.render(view, cpuConfig);
+    const double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); //in s
+
+    const double nSamples = (double)config.width * config.height * nFrames * config.samplesPerFrame;
+    std::cout << "CPU wall time: " << wallTime << " s\n"
+              << "CPU throughput: " << nSamples / wallTime * 1.e-6 << " Msamples/s, " << cpu.stats().nRays / wallTime * 1.e-6 << " Mrays/s\n";
+    return pixels;
+  }
+
+  //How far apart 2 renders of the same image are.  Both are noisy, so single pixels differ even when
+  //both renderers are right.  Averages over blocks of pixels cancel most of that noise.
+  struct difference
+  {
+    double rms; //Over every channel of every pixel
+    double blockRMS; //Over every channel of averages over blockSize x blockSize pixels
+    double maxBlock; //Largest difference between block averages
+  };
+
+  difference compare(const std::vector<float>& lhs, const std::vector<float>& rhs, const int width, const int height)
+  {
+    constexpr int blockSize = 8;
+    difference diff = {0., 0., 0.};
+
+    for(int pixel = 0; pixel < width * height; ++pixel)
+    {
+      for(int channel = 0; channel < 3; ++channel) diff.rms += std::pow(lhs[4*pixel + channel] - rhs[4*pixel + channel], 2);
+    }
+    diff.rms = std::sqrt(diff.rms / (3. * width * height));
+
+    int nBlocks = 0;
+    for(int firstY = 0; firstY < height; firstY += blockSize)
+    {
+      for(int firstX = 0; firstX < width; firstX += blockSize)
+      {
+        for(int channel = 0; channel < 3; ++channel)
+        {
+          double blockDiff = 0.;
+          int nPixels = 0;
+          for(int y = firstY; y < std::min(firstY + blockSize, height); ++y)
+          {
+            for(int x = firstX; x < std::min(firstX + blockSize, width); ++x)
+            {
+              blockDiff += lhs[4*(x + y*width) + channel] - rhs[4*(x + y*width) + channel];
+              ++nPixels;
+            }
+          }
+          blockDiff /= nPixels;
+          diff.blockRMS += blockDiff * blockDiff;
+          diff.maxBlock = std::max(diff.maxBlock, std::fabs(blockDiff));
+          ++nBlocks;
+        }
+      }
+    }
+    diff.blockRMS = std::sqrt(diff.blockRMS / nBlocks);
+
+    return diff;
+  }
+}
+
+int main(const int argc, const char** argv)
+{
+  settings config;
+  try
+  {
+    config = ::parse(argc, argv);
+  }
+  catch(const std::logic_error& e) //std::invalid_argument and std::out_of_range from std::stoi()
+  {
+    std::cerr << e.what() << "\n\n" << USAGE;
+    return CMD_LINE_ERROR;
+  }
+
+  //No window, so no OpenGL interop
+  app::Geometry geom(false);
+  try
+  {
+    geom.load(config.geometryFile);
+  }
+  catch(const app::Geometry::exception& e)
+  {
+    std::cerr << e.what();
+    return CMD_LINE_ERROR;
+  }
+
+  auto chosenCamera = std::find_if(geom.cameras.begin(), geom.cameras.end(), [&config](const auto& cam) { return cam.first == config.cameraName; });
+  if(config.cameraName.empty()) chosenCamera = geom.cameras.begin();
+  if(chosenCamera == geom.cameras.end())
+  {
+    std::cerr << "Couldn't find a camera named \"" << config.cameraName << "\" in " << config.geometryFile << "\n";
+    return CMD_LINE_ERROR;
+  }
+  const camera view = chosenCamera->second.state();
+  const int nFrames = (config.nSamples + config.samplesPerFrame - 1)/config.samplesPerFrame;
+
+  std::vector<float> pixels;
+  if(config.cpu)
+  {
+    try
+    {
+      geom.prepare();
+    }
+    catch(const app::Geometry::exception& e)
+    {
+      std::cerr << e.what();
+      return SETUP_ERROR;
+    }
+    pixels = ::renderOnCPU(geom, view, config, nFrames);
+  }
+  else
+  {
+    const int result = ::renderOnGPU(geom, view, config, nFrames, pixels);
+    if(result != SUCCESS) return result;
+  }
+
+  if(!::writeImage(config.outputFile, pixels, config.width, config.height, config.gamma))
+  {
+    std::cerr << "Failed to write " << config.outputFile << "\n";
+    return RENDER_ERROR;
+  }
+  std::cout << "Wrote " << config.width << " x " << config.height << " pixels with " << nFrames * config.samplesPerFrame
+            << " samples each to " << config.outputFile << "\n";
+
+  //The CPU renderer is the reference.  sendToGPU() already prepared geom for it.
+  if(config.compare)
+  {
+    const auto reference = ::renderOnCPU(geom, view, config, nFrames);
+    const auto diff = ::compare(pixels, reference, config.width, config.height);
+    std::cout << "GPU - CPU difference: " << diff.rms << " RMS per pixel, " << diff.blockRMS << " RMS and "
+              << diff.maxBlock << " max over 8 x 8 blocks\n";
+    if(diff.blockRMS > config.tolerance)
+    {
+      std::cerr << "GPU output differs from the CPU reference by more than " << config.tolerance << "\n";
+      return COMPARE_ERROR;
+    }
+  }
+
+  return SUCCESS;
+}
@@ -12,7 +12,7 @@
 namespace eng
 {
   CameraModel::CameraModel(const cl::float3& pos, const cl::float3& focal,
-                           const float size): fCameraState{{pos.x, pos.y, pos.z, 1.f}, focal, size},
+                           const float size): fCameraState{{pos.x, pos.y, pos.z, 1.f}, focal, {}, {}, size},
                                               fLCGen(std::chrono::system_clock::now().time_since_epoch().count()),
                                               fDist(0., 0.0),
                                               fPitch(asin((fCameraState.focalPos - fCameraState.position).y)),
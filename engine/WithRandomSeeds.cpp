@@ -10,7 +10,9 @@
 namespace eng
 {
   WithRandomSeeds::WithRandomSeeds(GLFWwindow* window, cl::Context& ctx,
-                                   std::unique_ptr<eng::CameraController>&& camera): WithCamera(window, ctx, std::move(camera)), fLatency(0), fNIterations(0), fNBounces(4), fNSamples(1)
+                                   std::unique_ptr<eng::CameraController>&& camera): WithCamera(window, ctx, std::move(camera)), fLatency(0), fNIterations(0), fNBounces(4), fNSamples(1),
+                                                                                     fTileSize(8), fLocalTiles(false), fPersistent(false), fTilesPerFrame(0), fNextTile(0),
+                                                                                     fGamma(2.2f), fTextureMode(STREAMED), fSpecialize(true)
   {
     std::vector<size_t> hostSeeds(fWidth*fHeight);
     for(size_t id = 1; id <= fWidth*fHeight; ++id) hostSeeds[id] = id;
@@ -24,11 +26,13 @@ namespace eng
     fSeeds = cl::Buffer(fContext, hostSeeds.begin(), hostSeeds.end(), false);
     
     fNIterations = 0;
+    fNextTile = 0;
   };
                                                                                                                     
   void WithRandomSeeds::onCameraChange()
   {
     fNIterations = fLatency; //Weight the Scene starts with when the camera moves.  Basically, making this number
                              //larger causes the scene to blur more rather than be disrupted by bad sampling.
+    fNextTile = 0; //Start a new iteration
   }
 };
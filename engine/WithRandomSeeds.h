@@ -19,6 +19,13 @@ namespace eng
   class WithRandomSeeds: public eng::WithCamera
   {
     public:
+      //Which textures building surfaces use.  Must match TEXTURE_MODE in skyline.cl.
+      enum textureMode
+      {
+        STREAMED = 0, //Full textures for specular paths when they're resident
+        COARSE = 1 //Only coarse textures
+      };
+
       WithRandomSeeds(GLFWwindow* window, cl::Context& ctx,
                       std::unique_ptr<eng::CameraController>&& camera);
   
@@ -36,6 +43,14 @@ namespace eng
       //to be updated when these parameters change.
       inline int& latency() { return fLatency; }
       inline int& nBounces() { return fNBounces; }
+      inline int& tileSize() { return fTileSize; }
+      inline bool& localTiles() { return fLocalTiles; }
+      inline bool& persistent() { return fPersistent; }
+      inline int& tilesPerFrame() { return fTilesPerFrame; }
+      inline int& nextTile() { return fNextTile; }
+      inline float& gamma() { return fGamma; }
+      inline int& textures() { return fTextureMode; }
+      inline bool& specialize() { return fSpecialize; }
   
     protected:
       virtual void userResize(const int width, const int height) override;
@@ -50,6 +65,15 @@ namespace eng
       int fNIterations; //Number of times this frame has been path traced since a camera change
       int fNBounces; //Number of ray reflections allowed per frame
       int fNSamples; //Number of times to path trace the scene before presenting a frame
+      int fTileSize; //Work groups are square tiles of pixels this wide.  Must be a power of 2.
+      bool fLocalTiles; //Whether primary rays in each tile share grid cells in __local memory
+      bool fPersistent; //Whether to launch only as many work groups as the device can run at once and let
+                        //them take tiles from a queue
+      int fTilesPerFrame; //Number of tiles to render in each frame.  0 means the whole image.
+      int fNextTile; //First tile to render next frame.  Each iteration starts at tile 0.
+      float fGamma; //Gamma correction for textures and output
+      int fTextureMode; //One of textureMode
+      bool fSpecialize; //Whether to build a kernel with fNBounces and fNSamples fixed at compile time
   };
 }
 
@@ -8,6 +8,7 @@
 
 //c++ includes
 #include <cassert>
+#include <cstddef>
 
 //OpenGL C API includes
 #include "glad/include/glad/glad.h"
@@ -63,6 +64,19 @@ namespace gl
         glBindTexture(TARGET, 0);
       }
   
+      //Replace the image at pos with pixels from the buffer object bound to
+      //GL_PIXEL_UNPACK_BUFFER starting offset bytes into it.  OpenGL copies out of
+      //the buffer object on its own time, so this doesn't wait for the upload.
+      void insertFromUnpackBuffer(const unsigned int pos, const unsigned int format, const size_t offset)
+      {
+        assert(pos < fSize && "Texture arrays have a fixed size!");
+
+        glBindTexture(TARGET, name);
+        CHECK_GL_ERROR(glTexSubImage3D, TARGET, 0, 0, 0, pos, fWidth, fHeight, 1, format, COMPONENT, reinterpret_cast<void*>(offset));
+
+        glBindTexture(TARGET, 0);
+      }
+
       ~TextureArray()
       {
         glDeleteTextures(1, &name);
@@ -9,71 +9,266 @@
  #define M_PI 3.1415926535897932384626433832f
 #endif
 
+//Mip levels of streamed textures.  Must match app::TextureStreamer::level.
+#define FULL_TEXTURE 0
+#define COARSE_TEXTURE 1
+
+//Settings that app::KernelVariants fixes at compile time with -D.  GAMMA, N_BOUNCES, and N_SAMPLES
+//are optional.  Without them, the kernel uses its gammaArg, nBounces, and nSamplesPerFrame arguments.
+
+//Which textures building surfaces use.  Must match eng::WithRandomSeeds::textureMode.
+#define TEXTURE_STREAMED 0 //Full textures for specular paths when they're resident.  Coarse textures otherwise.
+#define TEXTURE_COARSE 1 //Only coarse textures.  Never asks the host for full textures.
+#ifndef TEXTURE_MODE
+  #define TEXTURE_MODE TEXTURE_STREAMED
+#endif //TEXTURE_MODE
+
+//Diffuse bounces read the sky from the mip level that is this many texels on a side.
+//Paths that are already blurry don't need more detail than that.
+#define SKY_DIFFUSE_SIZE 32
+
+//Number of boxes that span multiple grid cells that each ray remembers intersecting.
+//Oldest intersections are forgotten first.
+#define MAILBOX_SIZE 8
+
+//The sky map is a horizontal strip of mip levels, so I address it in texels.
+__constant sampler_t skySampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+
 float2 signum(const float2 checkSign)
 {
   return (float2){(checkSign.x < 0)?-1.f:1.f, (checkSign.y < 0.f)?-1.f:1.f};
 }
 
+//Undo gridCell_spreadBits() for 1 axis of a Morton index.  Handles tiles up to 256 pixels on a side.
+int compactBits(int bits)
+{
+  bits &= 0x5555;
+  bits = (bits | (bits >> 1)) & 0x3333;
+  bits = (bits | (bits >> 2)) & 0x0f0f;
+  bits = (bits | (bits >> 4)) & 0x00ff;
+  return bits;
+}
+
+//Work groups are square tiles of pixels whose sides are a power of 2.  Tiles are row by row across the image,
+//and pixels are in Morton order within each tile.  So, work items that run together trace rays through pixels
+//that are next to each other in both directions instead of along a thin row.
+int2 tilePixel(const int whichTile, const int tileSize, const int width)
+{
+  const int tilesX = (width + tileSize - 1)/tileSize, inTile = get_local_id(0);
+  return (int2){whichTile % tilesX, whichTile / tilesX}*tileSize + (int2){compactBits(inTile), compactBits(inTile >> 1)};
+}
+
+//Copy every box in the grid cells that this work group's primary rays can cross into __local memory.
+//Every work item in the group has to call this.  Returns the rectangle of grid cells that are in
+//__local memory as {min.x, min.y, end.x, end.y} or an empty rectangle if they don't fit.  tileCells
+//is row by row within that rectangle, and every cell in it refers to a list in tileBoxes and tileBounds.
+int4 loadTile(const camera cam, const int2 pixel, const int width, const int height, const grid gridSize,
+              __global const gridCell* cells, __global const boxIndex* boxIndices, __global const aabbBounds* bounds,
+              __local gridCell* tileCells, const int maxTileCells, __local int* tileBoxes, __local aabbBounds* tileBounds,
+              const int maxTileBoxes, __local int* tileLimits)
+{
+  const int localID = get_local_id(0), groupSize = get_local_size(0);
+  if(localID == 0)
+  {
+    tileLimits[0] = INT_MAX;
+    tileLimits[1] = INT_MAX;
+    tileLimits[2] = -1; //Cells are never negative after clamp()
+    tileLimits[3] = -1;
+    tileLimits[4] = 0; //Number of boxes copied so far
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  //Find where rays through the corners of each pixel enter and leave the grid.  Rays between them cross
+  //cells inside the bounding box of those points.  If I miss a cell somehow, intersectScene() just reads
+  //it from global memory.
+  if(pixel.x < width && pixel.y < height)
+  {
+    const float2 gridEnd = gridSize.origin + convert_float2(gridSize.max)*gridSize.cellSize;
+    for(int corner = 0; corner < 4; ++corner)
+    {
+      const ray cornerRay = camera_rayThrough(cam, (float2){pixel.x + (corner & 1), pixel.y + (corner >> 1)}, width, height);
+
+      //2D slab test against the rectangle the grid covers
+      const float2 t0 = (gridSize.origin - cornerRay.position.xz)/cornerRay.direction.xz,
+                   t1 = (gridEnd - cornerRay.position.xz)/cornerRay.direction.xz;
+      const float tEnter = max(max(min(t0.x, t1.x), min(t0.y, t1.y)), 0.f),
+                  tExit = min(max(t0.x, t1.x), max(t0.y, t1.y));
+      if(!(tExit >= tEnter)) continue; //Also skips NaNs from rays along the grid's edges
+
+      const int2 enterCell = clamp(positionToCell(gridSize, cornerRay.position + cornerRay.direction*tEnter), (int2)(0), gridSize.max - 1),
+                 exitCell = clamp(positionToCell(gridSize, cornerRay.position + cornerRay.direction*tExit), (int2)(0), gridSize.max - 1);
+      atomic_min(tileLimits + 0, min(enterCell.x, exitCell.x));
+      atomic_min(tileLimits + 1, min(enterCell.y, exitCell.y));
+      atomic_max(tileLimits + 2, max(enterCell.x, exitCell.x));
+      atomic_max(tileLimits + 3, max(enterCell.y, exitCell.y));
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  //Every work item sees the same limits, so they all make the same decisions from here on
+  const int4 rect = (int4){tileLimits[0], tileLimits[1], tileLimits[2] + 1, tileLimits[3] + 1};
+  if(rect.z <= rect.x) return (int4)(0); //No primary ray in this tile crosses the grid
+  const int tileWidth = rect.z - rect.x, nTileCells = tileWidth * (rect.w - rect.y);
+  if(nTileCells > maxTileCells) return (int4)(0);
+
+  //Work items take turns with grid cells and claim space for each cell's boxes
+  for(int whichTileCell = localID; whichTileCell < nTileCells; whichTileCell += groupSize)
+  {
+    const gridCell cell = cells[grid_cellIndex(gridSize, rect.xy + (int2){whichTileCell % tileWidth, whichTileCell / tileWidth})];
+    const int count = gridCell_count(cell), offset = atomic_add(tileLimits + 4, count);
+    tileCells[whichTileCell] = gridCell_list(offset, count, gridCell_nShared(cell));
+    if(offset + count > maxTileBoxes) continue; //Out of space.  Everyone finds out after the barrier.
+
+    for(int which = 0; which < count; ++which)
+    {
+      const int whichBox = gridCell_volume(cell, boxIndices, which);
+      tileBoxes[offset + which] = whichBox;
+      tileBounds[offset + which] = bounds[whichBox];
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  return (tileLimits[4] > maxTileBoxes)?(int4)(0):rect;
+}
+
 //Test a ray for intersecting the aabbs in the scene.  Returns texture coordinates by value
-//normal by reference.
+//normal by reference.  Sets hitBox to the box it hit or -1 for the sky and the ground.  Adds the work it did to stats.  Grid cells inside tileRect come from
+//__local memory that loadTile() filled.  Pass an empty tileRect to always use global memory.
 //Updates ray's position but not its direction.
-float3 intersectScene(ray* thisRay, __global gridCell* cells, const grid gridSize, __global aabb* geometry, __global int* boxIndices,
-                      __global material* materials, float3* normal, const float2 groundTexNorm, sphere sky, int2* whichGridCell)
+float3 intersectScene(ray* thisRay, __global gridCell* cells, const grid gridSize, __global aabb* geometry,
+                      __global const aabbBounds* bounds, __global boxIndex* boxIndices,
+                      __global material* materials, float3* normal, const float2 groundTexNorm, sphere sky, int2* whichGridCell,
+                      int* hitBox, traversalStats* stats, __local const gridCell* tileCells, __local const int* tileBoxes,
+                      __local const aabbBounds* tileBounds, const int4 tileRect)
 {
   //Intersect the sky
+  //Don't look up anything about the sky until I know this ray escapes.  sampleSky() only needs its direction.
   float closestDist = FLT_MAX;
   { //Parentheses to limit the scope of skyDist
     const float skyDist = sphere_intersect(sky, *thisRay);
     if(skyDist > 0) closestDist = skyDist;
   }
-  float3 texCoords = sphere_tex_coords(sky, thisRay->position + thisRay->direction*closestDist);
-  *normal = sphere_normal(sky, thisRay->position + thisRay->direction*closestDist);
+  float3 texCoords = (float3){0.f, 0.f, SKY_TEXTURE};
+  *normal = -thisRay->direction;
 
-  //Intersect the ground plane
+  //Intersect the ground plane.  Its normal and texture coordinates wait until I know nothing is closer.
+  bool hitGround = false;
   { //Parentheses to limit the scope of groundDist
     const float groundDist = groundPlane_intersect(*thisRay);
     if(groundDist > 0 && groundDist < closestDist)
     {
       closestDist = groundDist;
-      texCoords = groundPlane_tex_coords(groundTexNorm, thisRay->position + thisRay->direction*closestDist);
-      *normal = groundPlane_normal(thisRay->position + thisRay->direction*closestDist);
+      hitGround = true;
     }
   }
 
-  //Intersect grid cells instead of buildings
-  int index = whichGridCell->x + whichGridCell->y * gridSize.max.x;
-  bool hitSomething = false; //TODO: Is there a way to structure this loop without another condition?
+  //Intersect grid cells instead of buildings.  Only remember which box is closest here.  The closest box so
+  //far is often replaced by a box a few iterations later, so its normal and texture coordinates would be wasted.
+  int closestBox = -1;
+  const float3 invDir = 1.f/thisRay->direction; //Only divide once per ray instead of once per box
   float2 distToNext = distToCellEdge(gridSize, *thisRay, *whichGridCell);
+  ++stats->nRays;
+
+  //Mailbox of boxes that are in more than one cell that this ray already intersected.  A box's
+  //intersection distance doesn't depend on which cell I'm in, so I can reuse it instead of
+  //testing the same box again.
+  int mailboxBoxes[MAILBOX_SIZE];
+  float mailboxDists[MAILBOX_SIZE];
+  int nextMailbox = 0;
+  for(int whichMailbox = 0; whichMailbox < MAILBOX_SIZE; ++whichMailbox) mailboxBoxes[whichMailbox] = -1;
+
+  //Boxes that would cover too many grid cells are tested once per ray before traversal.  Whatever
+  //they hit limits how far this ray has to go through the grid.
+  for(int whichIndex = gridSize.largeBoxes.x; whichIndex < gridSize.largeBoxes.y; ++whichIndex)
+  {
+    const int whichBox = boxIndices[whichIndex];
+    const float dist = aabbBounds_intersect(bounds[whichBox], thisRay->position, invDir);
+    ++stats->nBoxTests;
+    if(dist > 0 && dist < closestDist)
+    {
+      closestDist = dist;
+      closestBox = whichBox;
+    }
+  }
 
   //Grid traversal algorithm from https://www.scratchapixel.com/lessons/advanced-rendering/introduction-acceleration-structure/grid
-  while(!hitSomething && whichGridCell->x < gridSize.max.x && whichGridCell->y < gridSize.max.y
+  while(whichGridCell->x < gridSize.max.x && whichGridCell->y < gridSize.max.y
         && whichGridCell->x >= 0 && whichGridCell->y >= 0)
   {
     const float nextCellDist = min(distToNext.x, distToNext.y);
 
-    //Intersect boxes in this grid cell if any
-    const size_t begin = cells[whichGridCell->x + whichGridCell->y * gridSize.max.x].begin,
-                 end = cells[whichGridCell->x + whichGridCell->y * gridSize.max.x].end;
-    for(size_t whichIndex = begin; whichIndex < end; ++whichIndex)
+    //Intersect boxes in this grid cell if any.  Boxes that are shared with other cells come first.
+    //Cells with 1 or 2 boxes store them directly and never use the mailbox.  Cells in this work group's
+    //tile always refer to lists in __local memory.
+    const bool inTile = all(*whichGridCell >= tileRect.xy) && all(*whichGridCell < tileRect.zw);
+    const gridCell cell = inTile?tileCells[(whichGridCell->y - tileRect.y)*(tileRect.z - tileRect.x) + whichGridCell->x - tileRect.x]
+                                :cells[grid_cellIndex(gridSize, *whichGridCell)];
+    const int nInCell = gridCell_count(cell), endShared = gridCell_nShared(cell);
+    for(int whichIndex = 0; whichIndex < nInCell; ++whichIndex)
     {
-      const int whichBox = boxIndices[whichIndex];
-      const float dist = aabb_intersect(geometry + whichBox, *thisRay);
+      const int whichBox = inTile?tileBoxes[cell.first + whichIndex]:gridCell_volume(cell, boxIndices, whichIndex);
+      float dist = -1.f;
+      bool inMailbox = false;
+
+      //Cells where no box is shared skip the mailbox entirely
+      if(whichIndex < endShared)
+      {
+        for(int whichMailbox = 0; whichMailbox < MAILBOX_SIZE; ++whichMailbox)
+        {
+          if(mailboxBoxes[whichMailbox] == whichBox)
+          {
+            dist = mailboxDists[whichMailbox];
+            inMailbox = true;
+          }
+        }
+      }
+
+      if(inMailbox) ++stats->nMailboxHits;
+      else
+      {
+        dist = aabbBounds_intersect(inTile?tileBounds[cell.first + whichIndex]:bounds[whichBox], thisRay->position, invDir);
+        ++stats->nBoxTests;
+
+        if(whichIndex < endShared)
+        {
+          mailboxBoxes[nextMailbox] = whichBox;
+          mailboxDists[nextMailbox] = dist;
+          nextMailbox = (nextMailbox + 1) % MAILBOX_SIZE;
+        }
+      }
+
       if(dist > 0 && dist < min(closestDist, nextCellDist))
       {
         closestDist = dist;
-        *normal = aabb_normal_tex_coords(geometry[whichBox], thisRay->position + thisRay->direction*closestDist,
-                                         materials[geometry[whichBox].material], &texCoords);
-        hitSomething = true;
+        closestBox = whichBox;
       }
     }
 
+    //Stop in the cell where the closest intersection is.  That could be a box in this cell, a large box,
+    //or the ground.  Every other cell starts farther away.  This also leaves whichGridCell where the next
+    //bounce starts.
+    if(closestDist <= nextCellDist) break;
+
     //Calculate the next grid cell to test
-    if(!hitSomething)
-    {
-      //Hack to select the smallest component of a vector component at runtime: step(-nextCellDist, -distToNext)
-      *whichGridCell += convert_int_rtn(step(-nextCellDist, -distToNext)*signum(thisRay->direction.xz));
-      distToNext += step(-nextCellDist, -distToNext)*distBetweenCells(gridSize, *thisRay);
-    }
+    //Hack to select the smallest component of a vector component at runtime: step(-nextCellDist, -distToNext)
+    *whichGridCell += convert_int2_rtn(step(-nextCellDist, -distToNext)*signum(thisRay->direction.xz));
+    distToNext += step(-nextCellDist, -distToNext)*distBetweenCells(gridSize, *thisRay);
+  }
+
+  //Now that I know what this ray hit, calculate its surface attributes exactly once.
+  *hitBox = closestBox;
+  if(closestBox >= 0)
+  {
+    //Only read the texture index for the face I hit instead of the whole material
+    const int face = aabb_entry_face(geometry + closestBox, *thisRay);
+    *normal = aabb_face_normal(face);
+    texCoords = aabb_face_tex_coords(geometry + closestBox, thisRay->position + thisRay->direction*closestDist, face,
+                                     ((__global const uchar*)&materials[geometry[closestBox].material].textures)[face]);
+  }
+  else if(hitGround)
+  {
+    texCoords = groundPlane_tex_coords(groundTexNorm, thisRay->position + thisRay->direction*closestDist);
+    *normal = groundPlane_normal(thisRay->position + thisRay->direction*closestDist);
   }
 
   //Update thisRay's position to the position where it hit the volume it intersected.
@@ -87,9 +282,35 @@ float3 intersectScene(ray* thisRay, __global gridCell* cells, const grid gridSiz
   return texCoords;
 }
 
-//Trace the path of a single ray through nBounces in a scene of boxes
-void scatterAndShade(ray* thisRay, float3* lightColor, float3* maskColor, size_t* mySeed, const float3 normal,
-                     const float3 texCoords, /*__global material* struckMaterial,*/ image2d_array_t textures,
+//Look up a streamed texture.  Records which texture and mip level this ray wanted in textureFeedback
+//so that the host can make it resident for the next frame.  Falls back to the coarse version of a texture
+//when the full version isn't on the GPU yet.  Layer 0 of coarseTextures is a placeholder for textures
+//that haven't been decoded at all.
+float4 sampleTexture(const float3 texCoords, const bool wantFull, __read_only image2d_array_t textures,
+                     __read_only image2d_array_t coarseTextures, __global const int2* texturePages,
+                     __global uint* textureFeedback, sampler_t textureSampler)
+{
+  #if TEXTURE_MODE == TEXTURE_COARSE
+    const bool useFull = false;
+  #else
+    const bool useFull = wantFull;
+  #endif //TEXTURE_MODE
+
+  const int id = (int)texCoords.z;
+  const uint level = 1u << (useFull?FULL_TEXTURE:COARSE_TEXTURE);
+  if(!(textureFeedback[id] & level)) atomic_or(textureFeedback + id, level); //Most rays read the same few textures.  Avoid contention.
+
+  const int2 page = texturePages[id];
+  if(useFull && page.x >= 0) return read_imagef(textures, textureSampler, (float4){texCoords.xy, (float)page.x, 0.f});
+  return read_imagef(coarseTextures, textureSampler, (float4){texCoords.xy, (float)max(page.y, 0), 0.f});
+}
+
+//Trace the path of a single ray through nBounces in a scene of boxes.  Returns whether this ray was
+//reflected specularly.
+bool scatterAndShade(ray* thisRay, float3* lightColor, float3* maskColor, size_t* mySeed, const float3 normal,
+                     const float3 texCoords, /*__global material* struckMaterial,*/ const bool wantFull,
+                     __read_only image2d_array_t textures, __read_only image2d_array_t coarseTextures,
+                     __global const int2* texturePages, __global uint* textureFeedback,
                      sampler_t textureSampler, const float gamma)
 {
   //Small angle approximation speeds up processing
@@ -101,7 +322,8 @@ void scatterAndShade(ray* thisRay, float3* lightColor, float3* maskColor, size_t
                                                              :(float3)(0.f, -normal.z, normal.y));
   const float3 localYAxis = cross(normal, localXAxis);
 
-  const float4 color = pow(read_imagef(textures, textureSampler, (float4){texCoords, 0.}), (float4){gamma, gamma, gamma, 1.f});
+  const float4 color = pow(sampleTexture(texCoords, wantFull, textures, coarseTextures, texturePages, textureFeedback, textureSampler),
+                           (float4){gamma, gamma, gamma, 1.f});
 
   //TODO: Fresnel equation: the fraction of light that is reflected or transmmitted depends on direction.
   //Do specular reflections color.w percent of the time and diffuse otherwise.
@@ -129,96 +351,240 @@ void scatterAndShade(ray* thisRay, float3* lightColor, float3* maskColor, size_t
   //      texture access for the ground plane
   //      Using fabs(normal.x) for localXAxis
   *maskColor *= color.xyz * dot(thisRay->direction, normal);
+
+  return isSpecular;
+}
+
+//Look up the sky in the direction dir from an octahedral map.  Mip level 0 is a square on the left
+//of skyMap, and each smaller level is packed to the right of the level before it.
+float4 sampleSkyMap(__read_only image2d_t skyMap, const float3 dir, const int level)
+{
+  const int fullSize = get_image_height(skyMap), size = fullSize >> level;
+  const float2 texel = clamp(octahedral_encode(dir) * (float)size, 0.5f, (float)size - 0.5f); //Don't filter in texels from the next level
+  return read_imagef(skyMap, skySampler, (float2){(float)(2*fullSize - 2*size) + texel.x, texel.y});
 }
 
 //Sample the sky for a light color and calculate the light accumulated by a ray that hit it.
 //The sky texture can partially occlude the sun according to its alpha channel to simulate the sun
-//behind a cloud.
-float3 sampleSky(const sphere sky, const sphere sun, const float3 sunEmission, const ray thisRay, const float3 texCoords, const float3 maskColor,
-                 __read_only image2d_array_t textures, sampler_t textureSampler, const float gamma)
+//behind a cloud.  The sky map is already in linear color, so it doesn't need gamma correction.
+float3 sampleSky(const sphere sun, const float3 sunEmission, const ray thisRay, const float3 maskColor,
+                 const bool wantFull, __read_only image2d_t skyMap)
 {
-  float4 skyColor = read_imagef(textures, textureSampler, (float4){texCoords, 0.});
+  //log2() of the sky map's size is 31 - clz() because it's a power of 2
+  const int diffuseLevel = max(0, (31 - (int)clz(get_image_height(skyMap))) - (31 - (int)clz(SKY_DIFFUSE_SIZE)));
+  float4 skyColor = sampleSkyMap(skyMap, thisRay.direction, wantFull?0:diffuseLevel);
   if(sphere_intersect(sun, thisRay) > 0) skyColor.xyz = mix(skyColor.xyz, sunEmission, skyColor.w);
-  return maskColor * pow(skyColor.xyz, (float3){gamma, gamma, gamma});
+  return maskColor * skyColor.xyz;
 }
 
 __kernel void pathTrace(__read_only image2d_t prev, sampler_t sampler, __write_only image2d_t pixels, __global aabb* geometry,
-                        __global int* boxIndices, __global gridCell* gridCells, const grid gridSize, __global material* materials,
-                        const sphere sky, const sphere sun, const float3 sunEmission, const float2 groundTexNorm, const camera cam,
+                        __global const aabbBounds* bounds,
+                        __global boxIndex* boxIndices, __global gridCell* gridCells, const grid gridSize, __global material* materials,
+                        const sphere sky, __read_only image2d_t skyMap, const sphere sun, const float3 sunEmission,
+                        const float2 groundTexNorm, const camera cam,
                         const int nBounces, __global size_t* seeds, const int iterations, const int nSamplesPerFrame,
-                        __read_only image2d_array_t textures, sampler_t textureSampler)
+                        __read_only image2d_array_t textures, __read_only image2d_array_t coarseTextures,
+                        __global const int2* texturePages, __global uint* textureFeedback, sampler_t textureSampler,
+                        __global traversalStats* stats, __local gridCell* tileCells, const int maxTileCells,
+                        __local int* tileBoxes, __local aabbBounds* tileBounds, const int maxTileBoxes,
+                        __global workQueue* work, const float gammaArg)
 {
-  //TODO: Copy geometry into __local memory
+  //Count traversal work for this work item in private memory and add it up for this work group in __local memory
+  traversalStats myStats = {0, 0, 0, 0};
+  __local traversalStats groupStats;
+  const bool firstInGroup = (get_local_id(0) == 0);
+  if(firstInGroup) groupStats = myStats;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const int width = get_image_width(pixels), height = get_image_height(pixels);
+  const int tileSize = 1 << ((31 - (int)clz((int)get_local_size(0)))/2), //log2() of a power of 2 is 31 - clz()
+            nImageTiles = ((width + tileSize - 1)/tileSize) * ((height + tileSize - 1)/tileSize);
+  #ifdef GAMMA
+    const float gamma = GAMMA;
+  #else
+    const float gamma = gammaArg;
+  #endif //GAMMA
+
+  //Loops over these unroll when a kernel variant fixes them at compile time
+  #ifdef N_BOUNCES
+    const int maxBounces = N_BOUNCES;
+  #else
+    const int maxBounces = nBounces;
+  #endif //N_BOUNCES
+  #ifdef N_SAMPLES
+    const int nSamples = N_SAMPLES;
+  #else
+    const int nSamples = nSamplesPerFrame;
+  #endif //N_SAMPLES
+
+  //Each work group starts with its own tile.  If there are more tiles than work groups, work groups that
+  //finish early take the next tile from work until every tile is done.  Paths that end in the sky after
+  //1 bounce don't leave their work group idle while an alley somewhere else takes 10 bounces.
+  __local int nextTile;
+  __local int tileLimits[5];
+  int whichTile = get_group_id(0);
+  while(whichTile < work->nTiles)
+  {
+    //1 pixel per compute unit.  The host rounds the number of work items up to a whole number of tiles,
+    //so some work items are outside the image.  They still help load tiles.
+    const int2 pixel = tilePixel((work->firstTile + whichTile) % nImageTiles, tileSize, width);
+
+    //Primary rays from a tile start from the same place and point in similar directions, so they
+    //share grid cells in __local memory when the host gives them room.
+    const int4 tileRect = (maxTileBoxes > 0)?loadTile(cam, pixel, width, height, gridSize, gridCells, boxIndices, bounds,
+                                                       tileCells, maxTileCells, tileBoxes, tileBounds, maxTileBoxes, tileLimits)
+                                            :(int4)(0);
+    const int4 noTile = (int4)(0); //Bounces go everywhere, so they only use global memory
+    if(firstInGroup && tileRect.z > tileRect.x) ++groupStats.nLocalTiles;
+
+    if(pixel.x < width && pixel.y < height)
+    {
+      size_t seed = seeds[pixel.x * height + pixel.y]; //Keep this in private memory as long as possible
 
-  //1 pixel per compute unit
-  size_t seed = seeds[get_global_id(0) * get_global_size(1) + get_global_id(1)]; //Keep this in private memory as long as possible
-  const int2 pixel = (int2)(get_global_id(0), get_global_id(1));
-  
-  const float gamma = 2.2; //TODO: Make this an engine setting
+      float4 pixelColor = pow(read_imagef(prev, sampler, pixel), (float4){gamma, gamma, gamma, 1.f})*(1.f-1.f/(float)iterations); //undo gamma correction
 
-  float4 pixelColor = pow(read_imagef(prev, sampler, pixel), (float4){gamma, gamma, gamma, 1.f})*(1.f-1.f/(float)iterations); //undo gamma correction
+      //Reuse first intersection before relfection for each sample of this pixel.
+      float3 normal, lightColor = {0.f, 0.f, 0.f}, maskColor, texCoords;
+      bool hitSky, wantFull; //wantFull: Whether every bounce so far was specular.  Blurry paths only need coarse textures.
+      int2 cameraCell = positionToCell(gridSize, cam.position), whichGridCell;
+      int hitBox; //Only pickBoxes() cares which box a ray hit
 
-  //Reuse first intersection before relfection for each sample of this pixel.
-  float3 normal, lightColor = {0.f, 0.f, 0.f}, maskColor, texCoords;
-  bool hitSky;
-  int2 cameraCell = positionToCell(gridSize, cam.position), whichGridCell;
+      //For each sample of this pixel
+      //TODO: Using higher samplersPerFrame makes the scene darker
+      //      after gamma correction and tonemapping updates.  Maybe tonemapping needs to be done each time lightColor
+      //      is updated?
+      for(int sample = 0; sample < nSamples; ++sample)
+      {
+        //Reset accumulated color
+        maskColor = (float3){1.f, 1.f, 1.f};
+
+        //Simulate a camera
+        ray localRay = generateRay(cam, pixel, width, height, &seed);
+
+        //Figure out where localRay enters the grid
+        whichGridCell = cameraCell;
+        if(cameraCell.x < 0 || cameraCell.y < 0 ||
+           cameraCell.x >= gridSize.max.x || cameraCell.y >= gridSize.max.y)
+        {
+          const float distToGrid = grid_intersect(gridSize, localRay);
+          if(distToGrid > 0) whichGridCell = positionToCell(gridSize, localRay.position + localRay.direction * (distToGrid + 0.001f));
+          //else it doesn't matter what whichGridCell is anyway as long as it's outside the grid's limits
+        }
+
+        //Always intersect the scene at least once
+        texCoords = intersectScene(&localRay, gridCells, gridSize, geometry, bounds, boxIndices, materials, &normal, groundTexNorm, sky, &whichGridCell, &hitBox, &myStats,
+                                   tileCells, tileBoxes, tileBounds, tileRect);
+        hitSky = (texCoords.z == SKY_TEXTURE);
+        wantFull = true;
+
+        //For each bounce of this ray around the scene.  Stop when I hit the only light source, the sky,
+        //and limit the maximum number of bounces.  Rays that bounce too many times without hitting the
+        //the sky contribute no color.
+        for(int bounce = 1; bounce < maxBounces && !hitSky; ++bounce)
+        {
+          //TODO: Sort rays by struck material and process 1 material at a time?
+          //      I might get a lot more milage out of sorting rays when I'm reading from
+          //      textures.  My performance is already getting killed by the skybox texture.
+
+          //Otherwise, scatter this ray off of whatever it hit and intersect the scene again
+          wantFull &= scatterAndShade(&localRay, &lightColor, &maskColor, &seed, normal, texCoords, wantFull, textures, coarseTextures,
+                                      texturePages, textureFeedback, textureSampler, gamma);
+          texCoords = intersectScene(&localRay, gridCells, gridSize, geometry, bounds, boxIndices, materials, &normal, groundTexNorm, sky, &whichGridCell, &hitBox, &myStats,
+                                     tileCells, tileBoxes, tileBounds, noTile);
+          hitSky = (texCoords.z == SKY_TEXTURE);
+        }
+
+        //Last shade for this sample
+        if(hitSky)
+        {
+          lightColor += sampleSky(sun, sunEmission, localRay, maskColor, wantFull, skyMap);
+        }
+        //TODO: scatterAndShade when there are light sources other than the sun
+        //else scatterAndShade(&thisRay, &lightColor, &maskColor, &seed, normal, texCoords, textures, textureSampler);
+      }
 
-  //For each sample of this pixel
-  //TODO: Using higher samplersPerFrame makes the scene darker
-  //      after gamma correction and tonemapping updates.  Maybe tonemapping needs to be done each time lightColor
-  //      is updated?
-  for(size_t sample = 0; sample < nSamplesPerFrame; ++sample)
-  {
-    //Reset accumulated color
-    maskColor = (float3){1.f, 1.f, 1.f};
+      //Reinhard tonemapping to convert HDR colors to LDR.  Divide by number of iterations after tonemapping for iterative
+      //camera updates when looking at the same scene for a long time.
+      const float4 ldrColor = (float4){lightColor, 1.f};
+      pixelColor += ldrColor/(ldrColor + (float4){1.f, 1.f, 1.f, 0.f}) / (float)(iterations*nSamples);
 
-    //Simulate a camera
-    ray localRay = generateRay(cam, pixel, get_global_size(0), get_global_size(1), &seed);
+      seeds[pixel.x * height + pixel.y] = seed; //Update seed for next frame
 
-    //Figure out where localRay enters the grid
-    whichGridCell = cameraCell;
-    if(cameraCell.x < 0 || cameraCell.y < 0 ||
-       cameraCell.x >= gridSize.max.x || cameraCell.y >= gridSize.max.y)
-    {
-      const float distToGrid = grid_intersect(gridSize, localRay);
-      if(distToGrid > 0) whichGridCell = positionToCell(gridSize, localRay.position + localRay.direction * (distToGrid + 0.001f));
-      //else it doesn't matter what whichGridCell is anyway as long as it's outside the grid's limits
+      write_imagef(pixels, pixel, pow(pixelColor, (float4){1.f/gamma, 1.f/gamma, 1.f/gamma, 1.f})); //Gamma correction only
     }
 
-    //Always intersect the scene at least once
-    texCoords = intersectScene(&localRay, gridCells, gridSize, geometry, boxIndices, materials, &normal, groundTexNorm, sky, &whichGridCell);
-    hitSky = (texCoords.z == SKY_TEXTURE);
+    //Every tile already has its own work group.  Don't bother with work.
+    if(get_num_groups(0) >= work->nTiles) break;
 
-    //For each bounce of this ray around the scene.  Stop when I hit the only light source, the sky,
-    //and limit the maximum number of bounces.  Rays that bounce too many times without hitting the
-    //the sky contribute no color.
-    for(size_t bounce = 1; bounce < nBounces && !hitSky; ++bounce)
-    {
-      //TODO: Sort rays by struck material and process 1 material at a time?
-      //      I might get a lot more milage out of sorting rays when I'm reading from
-      //      textures.  My performance is already getting killed by the skybox texture.
-
-      //Otherwise, scatter this ray off of whatever it hit and intersect the scene again
-      scatterAndShade(&localRay, &lightColor, &maskColor, &seed, normal, texCoords, textures, textureSampler, gamma);
-      texCoords = intersectScene(&localRay, gridCells, gridSize, geometry, boxIndices, materials, &normal, groundTexNorm, sky, &whichGridCell);
-      hitSky = (texCoords.z == SKY_TEXTURE);
-    }
+    //Wait for everyone to finish with this tile's __local memory before choosing the next tile
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(firstInGroup) nextTile = get_num_groups(0) + atomic_inc(&work->next);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    whichTile = nextTile;
+  }
 
-    //Last shade for this sample
-    if(hitSky)
-    {
-      lightColor += sampleSky(sky, sun, sunEmission, localRay, texCoords, maskColor, textures, textureSampler, gamma);
-    }
-    //TODO: scatterAndShade when there are light sources other than the sun
-    //else scatterAndShade(&thisRay, &lightColor, &maskColor, &seed, normal, texCoords, textures, textureSampler);
+  //Only 1 global atomic operation per counter per work group
+  atomic_add(&groupStats.nRays, myStats.nRays);
+  atomic_add(&groupStats.nBoxTests, myStats.nBoxTests);
+  atomic_add(&groupStats.nMailboxHits, myStats.nMailboxHits);
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if(firstInGroup)
+  {
+    atomic_add(&stats->nRays, groupStats.nRays);
+    atomic_add(&stats->nBoxTests, groupStats.nBoxTests);
+    atomic_add(&stats->nMailboxHits, groupStats.nMailboxHits);
+    atomic_add(&stats->nLocalTiles, groupStats.nLocalTiles);
+  }
+}
+
+//Write the index on the device of the box that each pixel's primary ray hits into ids, or -1 where
+//it sees the sky or the ground.  Rays go through the centers of pixels with no bounces and no
+//textures, so this is much cheaper than a frame of pathTrace().  builder runs it when the user
+//picks boxes instead of every frame.  1 work item per pixel in a 2D range.
+__kernel void pickBoxes(__write_only image2d_t ids, __global aabb* geometry, __global const aabbBounds* bounds,
+                        __global boxIndex* boxIndices, __global gridCell* gridCells, const grid gridSize,
+                        __global material* materials, const sphere sky, const float2 groundTexNorm, const camera cam)
+{
+  //intersectScene() never reads __local memory with an empty tileRect, but it still wants pointers to some
+  __local gridCell noCells[1];
+  __local int noBoxes[1];
+  __local aabbBounds noBounds[1];
+
+  const int width = get_image_width(ids), height = get_image_height(ids);
+  const int2 pixel = (int2)(get_global_id(0), get_global_id(1));
+  if(pixel.x >= width || pixel.y >= height) return;
+
+  ray localRay = camera_rayThrough(cam, convert_float2(pixel) + 0.5f, width, height);
+
+  //Figure out where localRay enters the grid like pathTrace() does
+  int2 whichGridCell = positionToCell(gridSize, cam.position);
+  if(whichGridCell.x < 0 || whichGridCell.y < 0 ||
+     whichGridCell.x >= gridSize.max.x || whichGridCell.y >= gridSize.max.y)
+  {
+    const float distToGrid = grid_intersect(gridSize, localRay);
+    if(distToGrid > 0) whichGridCell = positionToCell(gridSize, localRay.position + localRay.direction * (distToGrid + 0.001f));
   }
 
-  //Reinhard tonemapping to convert HDR colors to LDR.  Divide by number of iterations after tonemapping for iterative
-  //camera updates when looking at the same scene for a long time.
-  const float4 ldrColor = (float4){lightColor, 1.f};
-  pixelColor += ldrColor/(ldrColor + (float4){1.f, 1.f, 1.f, 0.f}) / (float)(iterations*nSamplesPerFrame);
+  float3 normal;
+  int hitBox;
+  traversalStats myStats = {0, 0, 0, 0};
+  intersectScene(&localRay, gridCells, gridSize, geometry, bounds, boxIndices, materials, &normal, groundTexNorm, sky, &whichGridCell, &hitBox, &myStats,
+                 noCells, noBoxes, noBounds, (int4)(0));
+  write_imagei(ids, pixel, (int4)(hitBox, 0, 0, 0));
+}
+
+//Reduce the pixels of ids from rect.xy up to but not including rect.zw to the list of boxes that
+//they see.  Each box ends up in found once.  seen has a flag for every box on the device that
+//the host clears first, and nFound counts boxes in found.  1 work item per pixel in rect.
+__kernel void visibleBoxes(__read_only image2d_t ids, const int4 rect, __global uint* seen, __global int* found,
+                           __global uint* nFound)
+{
+  const int2 pixel = rect.xy + (int2)(get_global_id(0), get_global_id(1));
+  if(any(pixel >= rect.zw)) return;
 
-  seeds[get_global_id(0) * get_global_size(1) + get_global_id(1)] = seed; //Update seed for next frame
+  const int box = read_imagei(ids, pixel).x;
+  if(box < 0) return;
 
-  write_imagef(pixels, pixel, pow(pixelColor, (float4){1.f/gamma, 1.f/gamma, 1.f/gamma, 1.f})); //Gamma correction only
+  //Most pixels see a box that another pixel already added.  Only the first one to flip seen adds it.
+  if(seen[box] == 0 && atomic_xchg(seen + box, 1u) == 0) found[atomic_inc(nFound)] = box;
 }
@@ -43,6 +43,33 @@ float aabb_intersect(__global const aabb* shape, const ray thisRay)
   return (tmin > 0)?tmin:tmax;
 }
 
+//Convert an aabb to the format used for intersection tests on the device
+aabbBounds aabb_bounds(const aabb shape)
+{
+  aabbBounds bounds;
+  bounds.min = shape.center - shape.width/2.f;
+  bounds.max = shape.center + shape.width/2.f;
+  return bounds;
+}
+
+//Return the distance from a ray's origin to its intersection with bounds.  invDir is 1/direction
+//of the ray so that it only has to be calculated once for each ray.  Returns a negative number if
+//there is no intersection.
+//Same slab test as aabb_intersect(), but the slabs come straight from memory.  min() and max()
+//sort out which slab is near and which is far, so there are no signs to choose and no branches.
+float aabbBounds_intersect(const aabbBounds bounds, const CL(float3) position, const CL(float3) invDir)
+{
+  const float tx0 = (bounds.min.x - position.x)*invDir.x, tx1 = (bounds.max.x - position.x)*invDir.x,
+              ty0 = (bounds.min.y - position.y)*invDir.y, ty1 = (bounds.max.y - position.y)*invDir.y,
+              tz0 = (bounds.min.z - position.z)*invDir.z, tz1 = (bounds.max.z - position.z)*invDir.z;
+
+  const float tmin = max(max(min(tx0, tx1), min(ty0, ty1)), min(tz0, tz1)),
+              tmax = min(min(max(tx0, tx1), max(ty0, ty1)), max(tz0, tz1));
+
+  //Like aabb_intersect(), return tmax when the ray starts inside the box
+  return (tmax >= max(tmin, 0.f))?((tmin > 0.f)?tmin:tmax):-1.f;
+}
+
 //Return the normal vector at a point on shape 
 CL(float3) aabb_normal(const aabb shape, const CL(float3) pos)
 {
@@ -100,3 +127,56 @@ CL(float3) aabb_normal_tex_coords(const aabb shape, const CL(float3) pos, const
   *texCoords = (CL(float3)){diff.x/shape.texNorm.x + 0.5f, diff.y/shape.texNorm.y + 0.5f, (float)((unsigned char*)&mat.textures)[5]};
   return (CL(float3)){0.f, 0.f, -1.f};
 }
+
+//Return which face of shape thisRay intersects.  Faces are numbered like material::textures:
+//+x, -x, +y, -y, +z, -z.  This is the same slab test as aabb_intersect(), but it keeps track of
+//which slab the intersection came from instead of comparing the intersection point to each face.
+int aabb_entry_face(__global const aabb* shape, const ray thisRay)
+{
+  const CL(float3) diff = thisRay.position - shape->center;
+  const float dirInv[3] = {1.f/thisRay.direction.x, 1.f/thisRay.direction.y, 1.f/thisRay.direction.z},
+              diffs[3] = {diff.x, diff.y, diff.z},
+              halfWidths[3] = {shape->width.x/2.f, shape->width.y/2.f, shape->width.z/2.f};
+
+  float tmin = -FLT_MAX, tmax = FLT_MAX;
+  int entryFace = 0, exitFace = 0;
+  for(int axis = 0; axis < 3; ++axis)
+  {
+    const int sign = (dirInv[axis] > 0)?1:-1;
+    const float tnear = (-sign*halfWidths[axis] - diffs[axis])*dirInv[axis],
+                tfar = (sign*halfWidths[axis] - diffs[axis])*dirInv[axis];
+
+    //A ray going in the +axis direction enters through the -axis face
+    if(tnear > tmin)
+    {
+      tmin = tnear;
+      entryFace = 2*axis + (sign > 0);
+    }
+    if(tfar < tmax)
+    {
+      tmax = tfar;
+      exitFace = 2*axis + (sign < 0);
+    }
+  }
+
+  //aabb_intersect() returns tmax when thisRay starts inside shape
+  return (tmin > 0)?entryFace:exitFace;
+}
+
+//Return the normal vector of a face from aabb_entry_face()
+CL(float3) aabb_face_normal(const int face)
+{
+  const int axis = face/2;
+  const float sign = (face % 2)?-1.f:1.f;
+  return (CL(float3)){(axis == 0)?sign:0.f, (axis == 1)?sign:0.f, (axis == 2)?sign:0.f};
+}
+
+//Return texture coordinates at a point on a face from aabb_entry_face().
+//texture is the index of the texture on that face.
+CL(float3) aabb_face_tex_coords(__global const aabb* shape, const CL(float3) pos, const int face, const float texture)
+{
+  const CL(float3) diff = pos - shape->center;
+  if(face < 2) return (CL(float3)){diff.z/shape->texNorm.z + 0.5f, diff.y/shape->texNorm.y + 0.5f, texture}; //x
+  if(face < 4) return (CL(float3)){diff.x/shape->texNorm.x + 0.5f, diff.z/shape->texNorm.z + 0.5f, texture}; //y
+  return (CL(float3)){diff.x/shape->texNorm.x + 0.5f, diff.y/shape->texNorm.y + 0.5f, texture}; //z
+}
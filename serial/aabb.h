@@ -25,13 +25,42 @@ typedef struct aabb_tag
   SCALAR(int) dummy3;
 } aabb;
 
+//The same box as an aabb, but stored as its corners for intersection tests on the device.
+//aabbs are easier to edit, so the host converts them to aabbBounds with aabb_bounds() when
+//it uploads them.
+typedef struct aabbBounds_tag
+{
+  CL(float3) min; //Corner with the smallest x, y, and z
+  CL(float3) max; //Corner with the largest x, y, and z
+} aabbBounds;
+
 //OpenCL functions for intersection tests of aabbs
 //Return the distance from thisRay's origin to its intersection with shape
 float aabb_intersect(__global const aabb* shape, const ray thisRay);
 
+//Convert an aabb to the format used for intersection tests on the device
+aabbBounds aabb_bounds(const aabb shape);
+
+//Return the distance from a ray's origin to its intersection with bounds.  invDir is 1/direction
+//of the ray so that it only has to be calculated once for each ray.  Returns a negative number if
+//there is no intersection.  bounds is passed by value so that it can come from __global or
+//__local memory.
+float aabbBounds_intersect(const aabbBounds bounds, const CL(float3) position, const CL(float3) invDir);
+
 //Return the normal vector at a point on shape 
 CL(float3) aabb_normal(const aabb shape, const CL(float3) pos);
 
 //Return normal by value and texture coordinates by reference
 CL(float3) aabb_normal_tex_coords(const aabb shape, const CL(float3) pos, const material mat, CL(float3)* texCoords);
+
+//Return which face of shape thisRay intersects.  Faces are numbered like material::textures:
+//+x, -x, +y, -y, +z, -z.  Only call this after aabb_intersect() finds an intersection.
+int aabb_entry_face(__global const aabb* shape, const ray thisRay);
+
+//Return the normal vector of a face from aabb_entry_face()
+CL(float3) aabb_face_normal(const int face);
+
+//Return texture coordinates at a point on a face from aabb_entry_face().
+//texture is the index of the texture on that face.
+CL(float3) aabb_face_tex_coords(__global const aabb* shape, const CL(float3) pos, const int face, const float texture);
 #endif //AABB_H
@@ -7,16 +7,24 @@
 #include "kernels/linearCongruential.cl"
 #endif
 
-//TODO: lens simulation
-ray generateRay(const camera cam, const CL(int2) pixel, unsigned long int width, unsigned long int height, size_t* seed)
+//Ray from the camera through a position on the screen in units of pixels.  pixelPos does not
+//have to be in the center of a pixel.
+ray camera_rayThrough(const camera cam, const CL(float2) pixelPos, unsigned long int width, unsigned long int height)
 {
   ray thisRay;
   thisRay.position = cam.position;
 
   const float aspectRatio = (float)width / (float)height;
-  const CL(float2) ndc = (CL(float2)){(float)(pixel.x + random(seed))/(float)width, (float)(pixel.y + random(seed))/(float)height};
-  const CL(float3) pixelPos = cam.right*(ndc.x - 0.5f)*aspectRatio + cam.up*(ndc.y - 0.5f) + cam.focalPos;
-  thisRay.direction = normalize(pixelPos /** cam.size*/ - thisRay.position);
+  const CL(float2) ndc = (CL(float2)){pixelPos.x/(float)width, pixelPos.y/(float)height};
+  const CL(float3) pixelPos3D = cam.right*(ndc.x - 0.5f)*aspectRatio + cam.up*(ndc.y - 0.5f) + cam.focalPos;
+  thisRay.direction = normalize(pixelPos3D /** cam.size*/ - thisRay.position);
 
   return thisRay;
 }
+
+//TODO: lens simulation
+ray generateRay(const camera cam, const CL(int2) pixel, unsigned long int width, unsigned long int height, size_t* seed)
+{
+  const float jitterX = random(seed), jitterY = random(seed);
+  return camera_rayThrough(cam, (CL(float2)){(float)pixel.x + jitterX, (float)pixel.y + jitterY}, width, height);
+}
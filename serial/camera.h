@@ -19,6 +19,7 @@ typedef struct camera_tag
   float dummy[3]; //Ensure alignment
 } camera;
 
+ray camera_rayThrough(const camera cam, const CL(float2) pixelPos, unsigned long int width, unsigned long int height);
 ray generateRay(const camera cam, const CL(int2) pixel, unsigned long int width, unsigned long int height, size_t* seed);
 
 #endif //CAMERA_H
@@ -15,21 +15,20 @@ CL(float2) distBetweenCells(const grid params, const ray thisRay)
 //Find distance to the edge of this cell
 CL(float2) distToCellEdge(const grid params, const ray thisRay, const CL(int2) currentCell)
 {
-  return ((convert_float(currentCell) + step(0.f, thisRay.direction.xz))*params.cellSize + params.origin - thisRay.position.xz)/thisRay.direction.xz;
+  return ((convert_float2(currentCell) + step(0.f, thisRay.direction.xz))*params.cellSize + params.origin - thisRay.position.xz)/thisRay.direction.xz;
 }
 
 //Find the grid cell at a position.  This might return a cell that is outside params.
 //If so, try using nextCell with {0, 0} as currentCell.
 CL(int2) positionToCell(const grid params, const CL(float3) pos)
 {
-  //TODO: This line uses swizzling, so it won't compile on the host without major upgrades to my vector library
-  return convert_int_sat_rtn((pos.xz - params.origin) / params.cellSize);
+  return convert_int2_sat_rtn((pos.xz - params.origin) / params.cellSize);
 }
 
 //Find the distance to the camera's first intersection with a grid's boundary.
 float grid_intersect(const grid rect, const ray thisRay)
 {
-  const CL(float2) diff = thisRay.position.xz - (rect.origin + convert_float(rect.max) * rect.cellSize / 2.f);
+  const CL(float2) diff = thisRay.position.xz - (rect.origin + convert_float2(rect.max) * rect.cellSize / 2.f);
   const CL(float2) dirInv = (CL(float2)){1.f/thisRay.direction.x, 1.f/thisRay.direction.z};
 
   //X
@@ -10,9 +10,16 @@ typedef struct gridTag
   CL(int2) max; //Extent of the grid in x and y
   CL(float2) cellSize; //Size of each cell
   CL(float2) origin; //Global position of the center of this grid
-  CL(int2) filler; //Keep alignment the same on CPU and GPU
+  CL(int2) largeBoxes; //Range of indices in the list of volume indices for volumes that cover so many cells
+                       //that they are tested once per ray instead of being put into cells.
 } grid;
 
+//Find the distance between intersections with cell edges along each axis for a given ray
+CL(float2) distBetweenCells(const grid params, const ray thisRay);
+
+//Find the distance to the edges of currentCell along each axis that thisRay is heading towards
+CL(float2) distToCellEdge(const grid params, const ray thisRay, const CL(int2) currentCell);
+
 //Find the next cell that this ray enters
 CL(int2) nextCell(const grid params, const ray thisRay, const CL(int2) currentCell);
 
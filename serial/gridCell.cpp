@@ -0,0 +1,82 @@
+//File: gridCell.cpp
+//Brief: Encoding of gridCells and where each gridCell lives in memory.  Cells are stored in Morton (Z) order
+//       within tiles of 8 x 8 cells, and tiles are stored row by row.  A ray that
+//       crosses a cell diagonally then reads nearby memory instead of jumping a
+//       whole row of cells.  Tiles keep the padding small when the grid isn't a
+//       square with a power of 2 on each side.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifdef NOT_ON_DEVICE
+#include "serial/grid.h"
+#include "serial/gridCell.h"
+#endif //NOT_ON_DEVICE
+
+//Spread the lowest 3 bits of value out to every other bit
+int gridCell_spreadBits(int value)
+{
+  value &= 0x7;
+  value = (value | (value << 2)) & 0x13;
+  return (value | (value << 1)) & 0x15;
+}
+
+//Index of cell in the list of gridCells
+int grid_cellIndex(const grid params, const CL(int2) cell)
+{
+  const int tilesX = (params.max.x + GRID_TILE_SIZE - 1) / GRID_TILE_SIZE;
+  const int tile = cell.x / GRID_TILE_SIZE + (cell.y / GRID_TILE_SIZE) * tilesX;
+  return tile * GRID_TILE_SIZE * GRID_TILE_SIZE + (gridCell_spreadBits(cell.x) | (gridCell_spreadBits(cell.y) << 1));
+}
+
+//Number of gridCells needed to store params including padding
+int grid_nCells(const grid params)
+{
+  const int tilesX = (params.max.x + GRID_TILE_SIZE - 1) / GRID_TILE_SIZE,
+            tilesY = (params.max.y + GRID_TILE_SIZE - 1) / GRID_TILE_SIZE;
+  return tilesX * tilesY * GRID_TILE_SIZE * GRID_TILE_SIZE;
+}
+
+//Make a gridCell that refers to count volume indices starting at begin in the list of volume indices
+gridCell gridCell_list(const int begin, const int count, const int nShared)
+{
+  gridCell cell;
+  cell.first = begin;
+  cell.second = (nShared << 16) | count;
+  return cell;
+}
+
+//Make a gridCell that stores 1 or 2 volumes directly.  Set second to -1 if there is only 1 volume.
+gridCell gridCell_inline(const int first, const int second)
+{
+  gridCell cell;
+  cell.first = ~first;
+  cell.second = ~second; //~(-1) is 0 which means there's no second volume
+  return cell;
+}
+
+//Whether this cell stores its volumes directly
+bool gridCell_isInline(const gridCell cell)
+{
+  return cell.first < 0;
+}
+
+//Number of volumes in a cell
+int gridCell_count(const gridCell cell)
+{
+  if(gridCell_isInline(cell)) return (cell.second < 0)?2:1;
+  return cell.second & GRIDCELL_MAX_COUNT;
+}
+
+//Number of volumes at the beginning of a cell that are also in other cells.  Always 0 for
+//cells that store their volumes directly.
+int gridCell_nShared(const gridCell cell)
+{
+  if(gridCell_isInline(cell)) return 0;
+  return (cell.second >> 16) & GRIDCELL_MAX_COUNT;
+}
+
+//Index of the which-th volume in a cell
+int gridCell_volume(const gridCell cell, __global const boxIndex* volumeIndices, const int which)
+{
+  if(gridCell_isInline(cell)) return ~((which == 0)?cell.first:cell.second);
+  return volumeIndices[cell.first + which];
+}
@@ -3,7 +3,10 @@
 //       To save memory and organize host-side programs more effectively,
 //       boxes are referred to by another "layer" of indices.  These
 //       intermediate indices must be contiguous in memory so that gridCell
-//       works.
+//       works.  Cells with only 1 or 2 volumes store them directly instead
+//       so that sparse parts of a city don't need an extra memory access.
+//       Use the gridCell_*() functions in gridCell.cpp instead of reading
+//       the encoded fields.
 //Author: Andrew Olivier aolivier@ur.rochester.edu
 
 #ifndef GRIDCELL_H
@@ -11,10 +14,56 @@
 
 typedef struct gridCellTag
 {
-  int begin; //Index of first volume index in this cell in list of indices
-  int end; //Index of last volume index in this cell in list of volume indices
-
-  int filler[2]; //Fill out this structure so that alignment always matches
+  //If first >= 0, this cell refers to a list of volume indices:
+  //  first is the index of the first volume index in this cell in the list of indices.
+  //  second is (nShared << 16) | count.  nShared is the number of volumes in this cell
+  //  that are also in other cells.  They come first in the list of indices so that a
+  //  ray only has to remember intersecting them.
+  //If first < 0, this cell stores its volumes directly:
+  //  first is ~(index of the first volume).
+  //  second is ~(index of the second volume) or >= 0 if there is only 1 volume.
+  int first;
+  int second;
 } gridCell;
 
+//Entries in the list of volume indices.  A kernel for a scene with no more than 65536 volumes can
+//be built with -DBOX_INDEX_16 to read half as much memory for each index.  The host always uses int.
+#ifdef BOX_INDEX_16
+  typedef ushort boxIndex;
+#else
+  typedef int boxIndex;
+#endif //BOX_INDEX_16
+
+//Cells that refer to lists can have at most this many volumes
+#define GRIDCELL_MAX_COUNT 0xffff
+
+//Make a gridCell that refers to count volume indices starting at begin in the list of volume indices
+gridCell gridCell_list(const int begin, const int count, const int nShared);
+
+//Make a gridCell that stores 1 or 2 volumes directly.  Set second to -1 if there is only 1 volume.
+gridCell gridCell_inline(const int first, const int second);
+
+//Whether this cell stores its volumes directly
+bool gridCell_isInline(const gridCell cell);
+
+//Number of volumes in a cell
+int gridCell_count(const gridCell cell);
+
+//Number of volumes at the beginning of a cell that are also in other cells.  Always 0 for
+//cells that store their volumes directly.
+int gridCell_nShared(const gridCell cell);
+
+//Index of the which-th volume in a cell
+int gridCell_volume(const gridCell cell, __global const boxIndex* volumeIndices, const int which);
+
+//Cells are in Morton order within square tiles that are this many cells on a side.
+//gridCell_spreadBits() only handles tiles up to 8 cells on a side.
+#define GRID_TILE_SIZE 8
+
+//Index of cell in the list of gridCells
+int grid_cellIndex(const grid params, const CL(int2) cell);
+
+//Number of gridCells needed to store params including padding
+int grid_nCells(const grid params);
+
 #endif //GRIDCELL_H
@@ -5,15 +5,16 @@
 #ifndef GROUNDPLANE_H
 #define GROUNDPLANE_H
 
-#define GROUND_TEXTURE 1
+#define GROUND_TEXTURE 0
 
 //Distance from a ray's origin to its intersection with y = 0.
-float plane_intersect(const ray thisRay);
+float groundPlane_intersect(const ray thisRay);
 
 //Normal at a point on a plane
-CL(float3) plane_normal(const CL(float3) pos);
+CL(float3) groundPlane_normal(const CL(float3) pos);
 
-//Coordinates into a rectangular texture on this plane
-CL(float3) plane_tex_coords(const CL(float2) texNorm, const CL(float3) pos);
+//Coordinates into a rectangular texture on this plane.
+//Normalized so that the original texture fits into a space of size texNorm.
+CL(float3) groundPlane_tex_coords(const CL(float2) texNorm, const CL(float3) pos);
 
 #endif //GROUNDPLANE_H
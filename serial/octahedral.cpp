@@ -0,0 +1,42 @@
+//File: octahedral.cpp
+//Brief: Map directions onto a square by projecting the unit sphere onto an octahedron
+//       and unfolding the octahedron.  Used to look up the sky by ray direction.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifdef NOT_ON_DEVICE
+#include "serial/octahedral.h"
+#endif //NOT_ON_DEVICE
+
+//Texture coordinates in [0, 1] x [0, 1] for a direction.  dir doesn't have to be normalized.
+CL(float2) octahedral_encode(const CL(float3) dir)
+{
+  const float invL1Norm = 1.f/(fabs(dir.x) + fabs(dir.y) + fabs(dir.z));
+  float u = dir.x * invL1Norm, v = dir.z * invL1Norm;
+
+  //Fold the lower hemisphere out over the corners of the square
+  if(dir.y < 0.f)
+  {
+    const float foldedU = (1.f - fabs(v)) * ((u < 0.f)?-1.f:1.f);
+    v = (1.f - fabs(u)) * ((v < 0.f)?-1.f:1.f);
+    u = foldedU;
+  }
+
+  return (CL(float2)){0.5f*u + 0.5f, 0.5f*v + 0.5f};
+}
+
+//Unit direction for texture coordinates in [0, 1] x [0, 1]
+CL(float3) octahedral_decode(const CL(float2) texCoords)
+{
+  float u = 2.f*texCoords.x - 1.f, v = 2.f*texCoords.y - 1.f;
+  const float y = 1.f - fabs(u) - fabs(v);
+
+  //Undo folding the lower hemisphere
+  if(y < 0.f)
+  {
+    const float foldedU = (1.f - fabs(v)) * ((u < 0.f)?-1.f:1.f);
+    v = (1.f - fabs(u)) * ((v < 0.f)?-1.f:1.f);
+    u = foldedU;
+  }
+
+  return normalize((CL(float3)){u, y, v});
+}
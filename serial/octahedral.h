@@ -0,0 +1,17 @@
+//File: octahedral.h
+//Brief: Map directions onto a square by projecting the unit sphere onto an octahedron
+//       and unfolding the octahedron.  Unlike latitude and longitude, this needs no trig
+//       functions, and texels cover roughly equal solid angles.  +y is the center of the
+//       square, and -y is its corners.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef OCTAHEDRAL_H
+#define OCTAHEDRAL_H
+
+//Texture coordinates in [0, 1] x [0, 1] for a direction.  dir doesn't have to be normalized.
+CL(float2) octahedral_encode(const CL(float3) dir);
+
+//Unit direction for texture coordinates in [0, 1] x [0, 1]
+CL(float3) octahedral_decode(const CL(float2) texCoords);
+
+#endif //OCTAHEDRAL_H
@@ -30,6 +30,8 @@ CL(float3) sphere_normal(const sphere shape, const CL(float3) pos)
 }
 
 //Return texture coordinates for mapping a rectangle onto a hemisphere at pos.
+//Too slow for the device now that it uses octahedral maps, but still useful to
+//convert rectangular sky textures into octahedral maps on the host.
 CL(float3) sphere_tex_coords(const sphere shape, const CL(float3) pos)
 {
   const CL(float3) normal = sphere_normal(shape, pos);
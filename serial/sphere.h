@@ -5,7 +5,7 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
-#define SKY_TEXTURE 0
+#define SKY_TEXTURE -1 //Not a real texture.  The sky is looked up by direction in an octahedral map instead.
 
 typedef struct sphere_tag
 {
@@ -0,0 +1,20 @@
+//File: traversalStats.h
+//Brief: Counters for how much work grid traversal does on the device.  Each
+//       work group adds up its counters in __local memory and then adds them
+//       to a single traversalStats in global memory.  Use them to see whether
+//       changes to the grid or to traversal actually save box tests.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef TRAVERSALSTATS_H
+#define TRAVERSALSTATS_H
+
+typedef struct traversalStatsTag
+{
+  SCALAR(uint) nRays; //Number of rays traced through the grid
+  SCALAR(uint) nBoxTests; //Number of ray-box intersection tests
+  SCALAR(uint) nMailboxHits; //Number of ray-box intersection tests skipped because a ray
+                             //already tested that box in another grid cell.
+  SCALAR(uint) nLocalTiles; //Number of tiles whose primary rays read grid cells from __local memory
+} traversalStats;
+
+#endif //TRAVERSALSTATS_H
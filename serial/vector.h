@@ -10,6 +10,7 @@
 #ifdef NOT_ON_DEVICE
   #include "algebra/vector.h"
   #include <cmath>
+  #include <climits>
   #define CL(type) cl:: type
   #define SCALAR(type) cl_##type
   #define __global
@@ -19,6 +20,7 @@
   using std::min;
   using std::max;
   #define FLT_EPSILON CL_FLT_EPSILON
+  #define FLT_MAX CL_FLT_MAX
   template <class VECTOR>
   VECTOR normalize(const VECTOR& vec)
   {
@@ -29,6 +31,54 @@
   {
     return lhs.dot(rhs);
   }
+
+  //OpenCL C built-ins that serial/ code uses on vectors.  Scalars still get the versions in <cmath>.
+  inline cl::float2 fabs(const cl::float2 vec)
+  {
+    return cl::float2{std::fabs(vec.x), std::fabs(vec.y)};
+  }
+
+  inline cl::float3 fabs(const cl::float3 vec)
+  {
+    return cl::float3{std::fabs(vec.x), std::fabs(vec.y), std::fabs(vec.z)};
+  }
+
+  //0 where x < edge and 1 everywhere else
+  inline cl::float2 step(const cl::float2 edge, const cl::float2 x)
+  {
+    return cl::float2{(x.x < edge.x)?0.f:1.f, (x.y < edge.y)?0.f:1.f};
+  }
+
+  inline cl::float2 step(const float edge, const cl::float2 x)
+  {
+    return step(cl::float2{edge, edge}, x);
+  }
+
+  inline cl::float2 convert_float2(const cl::int2 vec)
+  {
+    return cl::float2{(float)vec.x, (float)vec.y};
+  }
+
+  //Round toward negative infinity.  The _sat version also clamps to what an int can hold
+  //and turns NaN into 0 like the device does.
+  inline cl::int2 convert_int2_rtn(const cl::float2 vec)
+  {
+    return cl::int2{(int)std::floor(vec.x), (int)std::floor(vec.y)};
+  }
+
+  inline int convert_int_sat_rtn(const float value)
+  {
+    if(std::isnan(value)) return 0;
+    const float rounded = std::floor(value);
+    if(rounded <= (float)INT_MIN) return INT_MIN;
+    if(rounded >= (float)INT_MAX) return INT_MAX;
+    return (int)rounded;
+  }
+
+  inline cl::int2 convert_int2_sat_rtn(const cl::float2 vec)
+  {
+    return cl::int2{convert_int_sat_rtn(vec.x), convert_int_sat_rtn(vec.y)};
+  }
 #else
   #define CL(type) type
   #define SCALAR(type) type
@@ -0,0 +1,20 @@
+//File: workQueue.h
+//Brief: Tiles of pixels for one dispatch of the path tracing kernel.  The host
+//       chooses which tiles to render and how many, and work groups take tiles
+//       from next until there are none left.  Launching fewer work groups than
+//       tiles keeps the same work groups running until the whole dispatch is done
+//       instead of waiting for the slowest work group in each wave.
+//Author: Andrew Olivier aolivier@ur.rochester.edu
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+typedef struct workQueueTag
+{
+  SCALAR(int) next; //Number of tiles taken by work groups after their first tile.  The host sets this to 0.
+  SCALAR(int) firstTile; //Tile in the image where this dispatch starts.  Tiles are row by row across the image.
+  SCALAR(int) nTiles; //Number of tiles in this dispatch
+  SCALAR(int) filler; //Keep alignment the same on CPU and GPU
+} workQueue;
+
+#endif //WORKQUEUE_H